@@ -0,0 +1,133 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <atomic>
+
+namespace vk
+{
+	/*
+	* CPU reference BVH over the triangle layout used by AccelerationStructure::addGeometry
+	* Vertices are R32G32B32_SFLOAT with a stride, indices are uint32 triangles
+	* Built with binned SAH, bounds use SSE or NEON when available and large subtrees are split on worker threads
+	* Doesn't need a Vulkan device, so BVH quality can be measured on machines without ray tracing hardware
+	*/
+	class CpuBvh {
+	public:
+		enum SplitMethod {
+			eSPLIT_METHOD_SAH = 0,
+			eSPLIT_METHOD_MEDIAN = 1 // object median on the longest axis, baseline for comparisons
+		};
+
+		struct Node {
+			float    boundsMin[3];
+			uint32_t leftFirst; // first primitive of a leaf, left child of an inner node, the right child follows it
+			float    boundsMax[3];
+			uint32_t primitiveCount; // 0 for inner nodes
+
+			bool isLeaf() const { return primitiveCount > 0; }
+		};
+
+		struct Ray {
+			float origin[3];
+			float tMin;
+			float direction[3];
+			float tMax;
+		};
+
+		struct Hit {
+			float    t;
+			float    u;
+			float    v;
+			uint32_t primitiveIndex; // index of the triangle in the index buffer, UINT32_MAX on a miss
+		};
+
+		struct BuildStats {
+			double   buildMilliseconds = 0.0;
+			uint32_t nodeCount = 0;
+			uint32_t leafCount = 0;
+			uint32_t maxDepth = 0;
+			float    sahCost = 0.0f;
+		};
+
+		CpuBvh();
+		~CpuBvh();
+
+		// the geometry is copied, the pointers only have to be valid during the build
+		void build(const float* pVertices, uint32_t vertexCount, uint32_t vertexStride, const uint32_t* pIndices, uint32_t indexCount);
+
+		// closest hit, returns false on a miss
+		bool intersect(const Ray& ray, Hit& hit) const;
+
+		// any hit, cheaper than intersect for shadow rays
+		bool occluded(const Ray& ray) const;
+
+		// traces the rays on the worker threads, returns the rays per second
+		double intersect(const Ray* pRays, Hit* pHits, uint32_t rayCount) const;
+
+		void setSplitMethod(SplitMethod splitMethod) { m_splitMethod = splitMethod; }
+
+		// amount of bins per axis for the SAH, default 16
+		void setBinCount(uint32_t binCount);
+
+		// nodes with at most this many primitives become leaves if splitting doesn't pay off, default 4
+		void setMaxLeafSize(uint32_t maxLeafSize) { m_maxLeafSize = maxLeafSize; }
+
+		// 0 uses all hardware threads
+		void setThreadCount(uint32_t threadCount) { m_threadCount = threadCount; }
+
+		// relative costs of a node traversal and a triangle intersection used by the SAH
+		void setTraversalCost(float traversalCost) { m_traversalCost = traversalCost; }
+		void setIntersectionCost(float intersectionCost) { m_intersectionCost = intersectionCost; }
+
+		const BuildStats& getBuildStats() const { return m_buildStats; }
+
+		const std::vector<Node>& getNodes() const { return m_nodes; }
+
+		// SAH cost of the whole tree relative to the root surface area
+		float computeSahCost() const;
+
+		/*
+		* Builds the mesh with the median split and the SAH with several bin and thread counts
+		* and traces rayCount random rays through each, then prints build time, node count, SAH cost and ray throughput
+		*/
+		static void compareBuilders(const float* pVertices, uint32_t vertexCount, uint32_t vertexStride, const uint32_t* pIndices, uint32_t indexCount, uint32_t rayCount = 1 << 20);
+
+	private:
+		struct Triangle {
+			float v0[4];
+			float v1[4];
+			float v2[4];
+		};
+
+		void buildNode(uint32_t nodeIndex, uint32_t first, uint32_t count, uint32_t depth);
+
+		// returns the primitive offset of the split or 0 if the node stays a leaf
+		uint32_t splitSah(Node& node, uint32_t first, uint32_t count, const float centroidMin[4], const float centroidMax[4]);
+		uint32_t splitMedian(uint32_t first, uint32_t count, const float centroidMin[4], const float centroidMax[4]);
+
+		bool intersectTriangle(const Ray& ray, uint32_t primitiveIndex, Hit& hit) const;
+
+		uint32_t getThreadCount() const;
+
+		SplitMethod m_splitMethod = eSPLIT_METHOD_SAH;
+		uint32_t m_binCount = 16;
+		uint32_t m_maxLeafSize = 4;
+		uint32_t m_threadCount = 0;
+		float m_traversalCost = 1.0f;
+		float m_intersectionCost = 1.0f;
+
+		std::vector<Triangle> m_triangles;
+		std::vector<float> m_primitiveBounds; // min xyz_ max xyz_ per primitive
+		std::vector<float> m_centroids; // xyz_ per primitive
+		std::vector<uint32_t> m_primitiveIndices;
+		std::vector<Node> m_nodes;
+
+		std::atomic<uint32_t> m_nodeCount{ 0 };
+		std::atomic<uint32_t> m_leafCount{ 0 };
+		std::atomic<uint32_t> m_maxDepth{ 0 };
+		std::atomic<uint32_t> m_activeTasks{ 0 };
+
+		BuildStats m_buildStats;
+	};
+}
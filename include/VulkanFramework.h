@@ -3,6 +3,16 @@
 #include <iostream>
 #include <chrono>
 #include <vector>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <ctime>
+#include <cstring>
+#include <limits>
 
 #define GLFW_INCLUDE_VULKAN
 #include "GLFW/glfw3.h"
@@ -26,6 +36,60 @@ extern PFN_vkCmdBuildAccelerationStructuresKHR vkCmdBuildAccelerationStructuresK
 #define vkCmdBuildAccelerationStructuresKHR vkCmdBuildAccelerationStructuresKHR_
 extern PFN_vkDestroyAccelerationStructureKHR vkDestroyAccelerationStructureKHR_;
 #define vkDestroyAccelerationStructureKHR vkDestroyAccelerationStructureKHR_
+extern PFN_vkCreateShadersEXT vkCreateShadersEXT_;
+#define vkCreateShadersEXT vkCreateShadersEXT_
+extern PFN_vkDestroyShaderEXT vkDestroyShaderEXT_;
+#define vkDestroyShaderEXT vkDestroyShaderEXT_
+extern PFN_vkCmdBindShadersEXT vkCmdBindShadersEXT_;
+#define vkCmdBindShadersEXT vkCmdBindShadersEXT_
+extern PFN_vkCmdSetPolygonModeEXT vkCmdSetPolygonModeEXT_;
+#define vkCmdSetPolygonModeEXT vkCmdSetPolygonModeEXT_
+extern PFN_vkCmdSetRasterizationSamplesEXT vkCmdSetRasterizationSamplesEXT_;
+#define vkCmdSetRasterizationSamplesEXT vkCmdSetRasterizationSamplesEXT_
+extern PFN_vkCmdSetSampleMaskEXT vkCmdSetSampleMaskEXT_;
+#define vkCmdSetSampleMaskEXT vkCmdSetSampleMaskEXT_
+extern PFN_vkCmdSetAlphaToCoverageEnableEXT vkCmdSetAlphaToCoverageEnableEXT_;
+#define vkCmdSetAlphaToCoverageEnableEXT vkCmdSetAlphaToCoverageEnableEXT_
+extern PFN_vkCmdSetColorBlendEnableEXT vkCmdSetColorBlendEnableEXT_;
+#define vkCmdSetColorBlendEnableEXT vkCmdSetColorBlendEnableEXT_
+extern PFN_vkCmdSetColorBlendEquationEXT vkCmdSetColorBlendEquationEXT_;
+#define vkCmdSetColorBlendEquationEXT vkCmdSetColorBlendEquationEXT_
+extern PFN_vkCmdSetColorWriteMaskEXT vkCmdSetColorWriteMaskEXT_;
+#define vkCmdSetColorWriteMaskEXT vkCmdSetColorWriteMaskEXT_
+extern PFN_vkCmdSetVertexInputEXT vkCmdSetVertexInputEXT_;
+#define vkCmdSetVertexInputEXT vkCmdSetVertexInputEXT_
+extern PFN_vkCmdSetDepthClampEnableEXT vkCmdSetDepthClampEnableEXT_;
+#define vkCmdSetDepthClampEnableEXT vkCmdSetDepthClampEnableEXT_
+extern PFN_vkCmdSetLogicOpEnableEXT vkCmdSetLogicOpEnableEXT_;
+#define vkCmdSetLogicOpEnableEXT vkCmdSetLogicOpEnableEXT_
+extern PFN_vkCmdSetPatchControlPointsEXT vkCmdSetPatchControlPointsEXT_;
+#define vkCmdSetPatchControlPointsEXT vkCmdSetPatchControlPointsEXT_
+extern PFN_vkCmdSetTessellationDomainOriginEXT vkCmdSetTessellationDomainOriginEXT_;
+#define vkCmdSetTessellationDomainOriginEXT vkCmdSetTessellationDomainOriginEXT_
+extern PFN_vkCmdPushDescriptorSetKHR vkCmdPushDescriptorSetKHR_;
+#define vkCmdPushDescriptorSetKHR vkCmdPushDescriptorSetKHR_
+extern PFN_vkCmdPushDescriptorSetWithTemplateKHR vkCmdPushDescriptorSetWithTemplateKHR_;
+#define vkCmdPushDescriptorSetWithTemplateKHR vkCmdPushDescriptorSetWithTemplateKHR_
+extern PFN_vkGetDescriptorSetLayoutSizeEXT vkGetDescriptorSetLayoutSizeEXT_;
+#define vkGetDescriptorSetLayoutSizeEXT vkGetDescriptorSetLayoutSizeEXT_
+extern PFN_vkGetDescriptorSetLayoutBindingOffsetEXT vkGetDescriptorSetLayoutBindingOffsetEXT_;
+#define vkGetDescriptorSetLayoutBindingOffsetEXT vkGetDescriptorSetLayoutBindingOffsetEXT_
+extern PFN_vkGetDescriptorEXT vkGetDescriptorEXT_;
+#define vkGetDescriptorEXT vkGetDescriptorEXT_
+extern PFN_vkCmdBindDescriptorBuffersEXT vkCmdBindDescriptorBuffersEXT_;
+#define vkCmdBindDescriptorBuffersEXT vkCmdBindDescriptorBuffersEXT_
+extern PFN_vkCmdSetDescriptorBufferOffsetsEXT vkCmdSetDescriptorBufferOffsetsEXT_;
+#define vkCmdSetDescriptorBufferOffsetsEXT vkCmdSetDescriptorBufferOffsetsEXT_
+extern PFN_vkCmdWriteAccelerationStructuresPropertiesKHR vkCmdWriteAccelerationStructuresPropertiesKHR_;
+#define vkCmdWriteAccelerationStructuresPropertiesKHR vkCmdWriteAccelerationStructuresPropertiesKHR_
+extern PFN_vkCmdCopyAccelerationStructureKHR vkCmdCopyAccelerationStructureKHR_;
+#define vkCmdCopyAccelerationStructureKHR vkCmdCopyAccelerationStructureKHR_
+extern PFN_vkCmdCopyAccelerationStructureToMemoryKHR vkCmdCopyAccelerationStructureToMemoryKHR_;
+#define vkCmdCopyAccelerationStructureToMemoryKHR vkCmdCopyAccelerationStructureToMemoryKHR_
+extern PFN_vkCmdCopyMemoryToAccelerationStructureKHR vkCmdCopyMemoryToAccelerationStructureKHR_;
+#define vkCmdCopyMemoryToAccelerationStructureKHR vkCmdCopyMemoryToAccelerationStructureKHR_
+extern PFN_vkGetDeviceAccelerationStructureCompatibilityKHR vkGetDeviceAccelerationStructureCompatibilityKHR_;
+#define vkGetDeviceAccelerationStructureCompatibilityKHR vkGetDeviceAccelerationStructureCompatibilityKHR_
 
 #define PRINT_PHYSICAL_DEVICES true
 #define PRINT_QUEUE_FAMILIES  false
@@ -143,6 +207,8 @@ namespace vk
 		VkPhysicalDevice m_physicalDevice;
 	};
 
+	struct Descriptor; // forward declaration
+
 	class CommandBuffer {
 	public:
 		CommandBuffer();
@@ -163,15 +229,30 @@ namespace vk
 		void submit(VkQueue* queue, VkFence fence, uint32_t waitSemaphoreCount, VkSemaphore* waitSemaphores, VkPipelineStageFlags* waitDstStageMask, uint32_t signalSemaphoreCount, VkSemaphore* signalSemaphores);
 		void submit(VkQueue* queue, VkFence fence);
 		void submit(VkFence fence);
+		// submits to the given queue instead of one from the queue handler, e.g. getAsyncComputeQueue()
+		void submitTo(VkQueue queue, VkFence fence);
 		void submit(VkQueue* queue);
 		void submit();
 
 		void addWaitSemaphore(VkSemaphore waitSemaphore, VkPipelineStageFlags waitDstStageMask);
+		// waits until the timeline semaphore reached value
+		void addWaitSemaphore(VkSemaphore waitSemaphore, VkPipelineStageFlags waitDstStageMask, uint64_t value);
 
 		void delWaitSemaphore(int index);
 
-		void addSignalSemaphore(VkSemaphore signalSemaphore) { m_signalSemaphores.push_back(signalSemaphore); }
-		void delSignalSemaphore(int index) { m_signalSemaphores.erase(m_signalSemaphores.begin() + index); }
+		void addSignalSemaphore(VkSemaphore signalSemaphore) { addSignalSemaphore(signalSemaphore, 0); }
+		// sets the timeline semaphore to value
+		void addSignalSemaphore(VkSemaphore signalSemaphore, uint64_t value) { m_signalSemaphores.push_back(signalSemaphore); m_signalValues.push_back(value); }
+		void delSignalSemaphore(int index) { m_signalSemaphores.erase(m_signalSemaphores.begin() + index); m_signalValues.erase(m_signalValues.begin() + index); }
+
+		/*
+		* Records the descriptors into the command buffer with VK_KHR_push_descriptor, no set is allocated or written
+		* The set of the layout has to be created with VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR, see DescriptorSet::setPushDescriptor
+		*/
+		void pushDescriptors(VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint32_t set, const Descriptor* pDescriptors, uint32_t descriptorCount);
+		void pushDescriptors(VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint32_t set, const std::vector<Descriptor>& descriptors);
+		// the template has to be of type VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_PUSH_DESCRIPTORS_KHR
+		void pushDescriptors(VkDescriptorUpdateTemplate updateTemplate, VkPipelineLayout layout, uint32_t set, const void* pData);
 
 		const VkCommandBuffer& getVkCommandBuffer() { return m_commandBuffer; }
 
@@ -183,6 +264,13 @@ namespace vk
 		std::vector<VkSemaphore> m_waitSemaphores;
 		std::vector<VkPipelineStageFlags> m_waitDstStageMasks;
 		std::vector<VkSemaphore> m_signalSemaphores;
+		std::vector<uint64_t> m_waitValues; // timeline values, ignored for binary semaphores
+		std::vector<uint64_t> m_signalValues;
+
+		// reused by pushDescriptors so recording doesn't allocate
+		std::vector<uint8_t> m_pushScratch;
+		std::vector<VkWriteDescriptorSet> m_pushWrites;
+		std::vector<VkWriteDescriptorSetAccelerationStructureKHR> m_pushAccelerationStructureWrites;
 	};
 
 	class Buffer : public Registerable {
@@ -257,6 +345,79 @@ namespace vk
 		VkDeviceSize m_size = 0;
 		VkBufferUsageFlags m_usage;
 		VkMemoryPropertyFlags m_memoryPropertyFlags;
+
+		friend class DeletionQueue;
+	};
+
+	/*
+	* Linear allocator for small per-frame uniform data in one persistently mapped buffer
+	* Every frame in flight owns a region of the buffer, a region is reused once the fence of its frame is signaled
+	* Allocations can be bound as VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC with their offset or read through their device address
+	*/
+	class UniformAllocator {
+	public:
+		struct Allocation {
+			VkBuffer        buffer;
+			VkDeviceSize    offset;
+			VkDeviceSize    size;
+			void*           pData;
+			VkDeviceAddress deviceAddress; // 0 without VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+
+			uint32_t getDynamicOffset() const { return static_cast<uint32_t>(offset); }
+		};
+
+		UniformAllocator();
+		~UniformAllocator();
+
+		void init();
+
+		void destroy();
+
+		// suballocates size bytes aligned to minUniformBufferOffsetAlignment, safe to call from multiple threads
+		Allocation allocate(VkDeviceSize size);
+
+		template<typename T>
+		Allocation allocate(const T& data) {
+			Allocation allocation = allocate(sizeof(T));
+			memcpy(allocation.pData, &data, sizeof(T));
+			return allocation;
+		}
+
+		/*
+		* Retires the current frame and starts allocating from the next region
+		* The fence has to signal once the gpu finished the frame's commands, it is waited on before the region is reused
+		*/
+		void nextFrame(VkFence fence);
+
+		// bytes available to a single frame
+		void setFrameSize(VkDeviceSize frameSize) { m_frameSize = frameSize; }
+
+		// amount of regions, has to be at least the amount of frames in flight
+		void setFrameCount(uint32_t frameCount) { m_frameCount = frameCount; }
+
+		// VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT enables Allocation::deviceAddress
+		void setUsage(VkBufferUsageFlags usage) { m_usage = usage; }
+
+		// the buffer to reference in a dynamic uniform buffer descriptor, its range has to cover the largest allocation
+		Buffer& getBuffer() { return m_buffer; }
+
+		VkDeviceSize getFrameUsage() const { return m_offset; }
+
+	private:
+		bool m_isInit = false;
+
+		Buffer m_buffer;
+		uint8_t* m_pMappedData = nullptr;
+		VkDeviceAddress m_deviceAddress = 0;
+
+		VkDeviceSize m_alignment = 1;
+		VkDeviceSize m_frameSize = 65536;
+		uint32_t m_frameCount = VK_MIN_AMOUNT_OF_SWAPCHAIN_IMAGES;
+		VkBufferUsageFlags m_usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+
+		uint32_t m_frameIndex = 0;
+		std::atomic<VkDeviceSize> m_offset{ 0 }; // offset into the current frame's region
+		std::vector<VkFence> m_frameFences = {};
 	};
 
 	class Image : public Registerable {
@@ -504,6 +665,26 @@ namespace vk
 	};
 
 	class DescriptorPool; //forward decleration
+	class DescriptorAllocator; //forward decleration
+	class DescriptorBuffer; //forward decleration
+
+	/*
+	* Shares descriptor set layouts between sets with identical bindings
+	* Bindings are compared independent of their order, layouts are reference counted
+	*/
+	namespace descriptorSetLayoutCache {
+		// returns a layout matching the bindings, creates it if there is none yet
+		VkDescriptorSetLayout acquire(const VkDescriptorSetLayoutBinding* pBindings, uint32_t bindingCount, VkDescriptorSetLayoutCreateFlags flags = 0);
+
+		// destroys the layout when it was released as often as it was acquired
+		void release(VkDescriptorSetLayout setLayout);
+
+		// amount of distinct layouts alive
+		uint32_t getLayoutCount();
+
+		// amount of acquired references, getReferenceCount() - getLayoutCount() layouts were deduplicated
+		uint32_t getReferenceCount();
+	}
 
 	class DescriptorSet : public Registerable {
 	public:
@@ -516,6 +697,10 @@ namespace vk
 
 		void allocate();
 
+		/*
+		* Writes the descriptor elements changed since the last update, does nothing without changes
+		* A fully changed set is written through an update template
+		*/
 		void update();
 
 		void destroy();
@@ -530,21 +715,58 @@ namespace vk
 
 		void setDescriptor(uint32_t index, Descriptor descriptor);
 
+		// changes a single array element of a descriptor, only this element is written by the next update
+		void setImageInfo(uint32_t index, uint32_t arrayElement, DescriptorImageInfo imageInfo);
+		void setBufferInfo(uint32_t index, uint32_t arrayElement, DescriptorBufferInfo bufferInfo);
+
+		// marks array elements of a descriptor to be written by the next update, e.g. after a referenced resource changed
+		void markDirty(uint32_t index, uint32_t firstElement, uint32_t elementCount);
+
+		// a referenced resource was recreated, the next update rewrites every descriptor, call it from the Registery callback
+		void markDependencyChanged();
+
 		void setDescriptorPool(const DescriptorPool* descriptorPool);
 
+		/*
+		* Places the set in a descriptor buffer instead of a pool, update writes the descriptors with vkGetDescriptorEXT
+		* Buffers referenced by the set need VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, texel buffer views aren't supported
+		*/
+		void setDescriptorBuffer(DescriptorBuffer* descriptorBuffer);
+
+		// sets the offset of this set in the bound descriptor buffer, see DescriptorBuffer::cmdBind
+		void cmdBindDescriptorBuffer(VkCommandBuffer cmd, VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint32_t set);
+
+		// push descriptor sets aren't allocated, update packs the descriptors and cmdPush records them
+		void setPushDescriptor(bool isPushDescriptor);
+
+		// records the descriptors of a push descriptor set, uses a push template per pipeline layout when possible
+		void cmdPush(VkCommandBuffer cmd, VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint32_t set);
+
+		// allocates the set from a growable allocator instead of a fixed DescriptorPool
+		// sets of a transient allocator become invalid on its reset and have to be allocated again
+		void setDescriptorAllocator(DescriptorAllocator* descriptorAllocator);
+
 		Descriptor getDescriptor(uint32_t index);
 
 		VkDescriptorSetLayout getVkDescriptorSetLayout() const { return m_descriptorSetLayout; }
 
 	private:
+		// copies the infos of the given array elements into the scratch buffer
+		void packDescriptor(uint32_t index, uint32_t firstElement, uint32_t endElement);
+
+		// writes the given array elements into the mapped descriptor buffer
+		void writeDescriptorBuffer(uint32_t index, uint32_t firstElement, uint32_t endElement);
+
 		bool m_isInit = false;
 		bool m_isAlloc = false;
+		bool m_isPushDescriptor = false;
 
 		enum DescriptorSetChangeFlags {
 			eNONE = 0x0,
 			eDESCRIPTORS = 0x1,
 			eDESCRIPTOR_COUNT = 0x2,
-			eDESCRIPTOR_POOL = 0x4
+			eDESCRIPTOR_POOL = 0x4,
+			eDEPENDENCIES = 0x8
 		};
 		uint32_t m_changes = eNONE;
 
@@ -552,10 +774,39 @@ namespace vk
 		VkDescriptorSetLayout m_descriptorSetLayout = VK_NULL_HANDLE;
 
 		const DescriptorPool* m_pDescriptorPool = nullptr;
+		DescriptorAllocator* m_pDescriptorAllocator = nullptr;
+
+		DescriptorBuffer* m_pDescriptorBuffer = nullptr;
+		VkDeviceSize m_descriptorBufferOffset = 0;
+		// space owned in the descriptor buffer, kept over a reinit since the linear buffer can't free it
+		const DescriptorBuffer* m_pOwnedDescriptorBuffer = nullptr;
+		VkDeviceSize m_descriptorBufferSize = 0;
+		uint32_t m_descriptorBufferGeneration = 0;
+		std::vector<VkDeviceSize> m_bindingOffsets = {};
 
 		std::vector<Descriptor> m_descriptors = {};
 
+		// dirty array elements [first, end) per descriptor
+		std::vector<std::pair<uint32_t, uint32_t>> m_dirtyRanges = {};
+
+		// packed descriptor infos, persistent so updates don't allocate
+		VkDescriptorUpdateTemplate m_updateTemplate = VK_NULL_HANDLE;
+		std::vector<uint8_t> m_scratch = {};
+		std::vector<size_t> m_scratchOffsets = {};
+		std::vector<VkWriteDescriptorSet> m_writes = {};
+		std::vector<VkWriteDescriptorSetAccelerationStructureKHR> m_accelerationStructureWrites = {};
+		std::vector<VkDescriptorUpdateTemplateEntry> m_templateEntries = {};
+
+		struct PushTemplate {
+			VkPipelineBindPoint bindPoint;
+			VkPipelineLayout layout;
+			uint32_t set;
+			VkDescriptorUpdateTemplate updateTemplate;
+		};
+		std::vector<PushTemplate> m_pushTemplates = {};
+
 		friend class DescriptorPool;
+		friend class DescriptorBuffer;
 	};
 
 	class DescriptorPool {
@@ -593,6 +844,142 @@ namespace vk
 		std::vector<VkDescriptorPoolSize> m_poolSizes = {};
 	};
 
+	/*
+	* Backend for DescriptorSets using VK_EXT_descriptor_buffer
+	* Descriptors live in a persistently mapped buffer, sets are placed linearly and bound by offset
+	* Pipelines using it have to be created with VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT
+	*/
+	class DescriptorBuffer {
+	public:
+		DescriptorBuffer();
+		~DescriptorBuffer();
+
+		operator VkBuffer() { return m_buffer; }
+
+		void init();
+
+		void destroy();
+
+		// reserves space for the set and places it in this buffer
+		// use setSize for variable amounts of sets
+		void addDescriptorSet(DescriptorSet& descriptorSet);
+
+		void setSize(VkDeviceSize size) { m_size = size; }
+
+		// resource descriptors only buffers can skip VK_BUFFER_USAGE_SAMPLER_DESCRIPTOR_BUFFER_BIT_EXT
+		void setUsage(VkBufferUsageFlags usage) { m_usage = usage; }
+
+		// returns the offset of size bytes, aligned to descriptorBufferOffsetAlignment
+		VkDeviceSize allocate(VkDeviceSize size);
+
+		// frees every set placed in the buffer, they have to be allocated again
+		void reset() { m_offset = 0; m_generation++; }
+
+		// binds this buffer as the only descriptor buffer, sets select their range with cmdBindDescriptorBuffer
+		void cmdBind(VkCommandBuffer cmd);
+
+		uint8_t* getMappedData() { return m_pMappedData; }
+
+		VkDeviceAddress getVkDeviceAddress() const { return m_buffer.getVkDeviceAddress(); }
+
+		VkDeviceSize getSize() const { return m_size; }
+
+		VkDeviceSize getUsedSize() const { return m_offset; }
+
+		// changes whenever the allocated space is given back by init or reset
+		uint32_t getGeneration() const { return m_generation; }
+
+		static const VkPhysicalDeviceDescriptorBufferPropertiesEXT& getProperties();
+
+		// size of a single descriptor of the type in a descriptor buffer
+		static size_t getDescriptorSize(VkDescriptorType type);
+
+	private:
+		bool m_isInit = false;
+
+		Buffer m_buffer;
+		uint8_t* m_pMappedData = nullptr;
+
+		VkDeviceSize m_size = 0;
+		VkDeviceSize m_offset = 0;
+		uint32_t m_generation = 0;
+		VkBufferUsageFlags m_usage = VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT | VK_BUFFER_USAGE_SAMPLER_DESCRIPTOR_BUFFER_BIT_EXT;
+	};
+
+	/*
+	* Allocates descriptor sets from a chain of pools, a new pool is created whenever the current one runs out
+	* Transient allocators skip freeing single sets and reset all pools at once, e.g. once per frame
+	* Usage is tracked per descriptor type, the peak usage can be used to size fixed DescriptorPools
+	*/
+	class DescriptorAllocator {
+	public:
+		DescriptorAllocator();
+		~DescriptorAllocator();
+
+		void init();
+
+		void destroy();
+
+		// the pool sizes are the descriptors needed by the set, they are used for the usage report and to size new pools
+		VkDescriptorSet allocate(VkDescriptorSetLayout setLayout, const VkDescriptorPoolSize* pPoolSizes = nullptr, uint32_t poolSizeCount = 0);
+
+		// only available for allocators that aren't transient
+		void free(VkDescriptorSet descriptorSet);
+
+		// resets all pools, every set allocated before becomes invalid
+		// the caller has to make sure no set is used by the gpu anymore
+		void reset();
+
+		// transient allocators can only be reset, default is true
+		void setTransient(bool isTransient);
+
+		// amount of sets the first pool is sized for, every new pool doubles it up to a maximum of 4096
+		void setSetsPerPool(uint32_t setsPerPool);
+
+		// amount of descriptors of the type per set in a new pool
+		void setPoolSizeRatio(VkDescriptorType type, float ratio);
+
+		bool isTransient() const { return m_isTransient; }
+
+		uint32_t getPoolCount() const;
+
+		// descriptors of the type currently allocated
+		uint32_t getUsage(VkDescriptorType type) const;
+
+		// maximum amount of descriptors of the type allocated at once
+		uint32_t getPeakUsage(VkDescriptorType type) const;
+		std::vector<VkDescriptorPoolSize> getPeakUsage() const;
+
+		uint32_t getPeakSetCount() const { return m_peakSetCount; }
+
+		void printUsage() const;
+
+	private:
+		VkDescriptorPool createPool(const VkDescriptorPoolSize* pPoolSizes, uint32_t poolSizeCount);
+
+		VkResult allocateFromPool(VkDescriptorPool descriptorPool, VkDescriptorSetLayout setLayout, VkDescriptorSet* pDescriptorSet);
+
+		void addUsage(const VkDescriptorPoolSize* pPoolSizes, uint32_t poolSizeCount, int32_t sign);
+
+		bool m_isInit = false;
+		bool m_isTransient = true;
+
+		uint32_t m_setsPerPool = 64;
+		std::vector<std::pair<VkDescriptorType, float>> m_poolSizeRatios = {};
+
+		VkDescriptorPool m_currentPool = VK_NULL_HANDLE;
+		std::vector<VkDescriptorPool> m_usedPools = {};
+		std::vector<VkDescriptorPool> m_freePools = {};
+
+		// pool and descriptors of every set, only tracked for allocators that aren't transient
+		std::unordered_map<VkDescriptorSet, std::pair<VkDescriptorPool, std::vector<VkDescriptorPoolSize>>> m_allocations;
+
+		std::vector<VkDescriptorPoolSize> m_usage = {};
+		std::vector<VkDescriptorPoolSize> m_peakUsage = {};
+		uint32_t m_setCount = 0;
+		uint32_t m_peakSetCount = 0;
+	};
+
 	class Shader {
 	public:
 		Shader();
@@ -615,6 +1002,9 @@ namespace vk
 		// compiles shaders and copies them into every dstDir
 		static void compile(std::string srcDir, std::vector<std::string> srcNames, std::vector<std::string> dstDirs);
 
+		// compiles a single shader, returns false if the compiler reported an error
+		static bool compile(std::string srcPath, std::string dstPath);
+
 	private:
 		bool m_isInit = false;
 
@@ -622,6 +1012,8 @@ namespace vk
 		VkShaderModule m_module = VK_NULL_HANDLE;
 
 		VkPipelineShaderStageCreateInfo m_shaderStage{VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO, nullptr, 0};
+
+		friend class ShaderHotReloader;
 	};
 
 	class RenderPass {
@@ -752,6 +1144,9 @@ namespace vk
 
 		void setPrimitiveTopology(VkPrimitiveTopology primitiveTopology) { m_inputAssemblyStateCreateInfo.topology = primitiveTopology; }
 
+		// e.g. VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT
+		void setCreateFlags(VkPipelineCreateFlags createFlags) { m_createFlags = createFlags; }
+
 		void enableBlending();
 
 		void disableBlending();
@@ -772,11 +1167,15 @@ namespace vk
 		VkPipelineLayout getVkPipelineLayout() { return m_pipelineLayout; }
 
 	private:
+		// creates a pipeline from the current state, does not touch m_pipeline
+		VkPipeline createVkPipeline(const std::vector<VkPipelineShaderStageCreateInfo>& shaderStages) const;
+
 		bool m_isInit = false;
 
 		VkPipeline       m_pipeline;
 		VkPipelineLayout m_pipelineLayout;
 
+		VkPipelineCreateFlags m_createFlags = 0;
 		VkRenderPass m_renderPass;
 		uint32_t m_subpassIndex = 0;
 		std::vector<VkDescriptorSetLayout> m_setLayouts;
@@ -797,6 +1196,142 @@ namespace vk
 		VkPipelineColorBlendAttachmentState    m_colorBlendAttachment;
 		VkPipelineColorBlendStateCreateInfo    m_colorBlendStateCreateInfo;
 		VkPipelineDynamicStateCreateInfo       m_dynamicStateCreateInfo;
+
+		friend class ShaderHotReloader;
+	};
+
+	/*
+	* Alternative to Pipeline using VK_EXT_shader_object
+	* The shaders are bound directly and all state is set dynamically, so no VkPipeline has to be created
+	* Linked shader objects let the driver optimize across stages like it does for a pipeline
+	*/
+	class ShaderObject {
+	public:
+		ShaderObject();
+		~ShaderObject();
+
+		void init();
+
+		void update();
+
+		void destroy();
+
+		// binds the shaders and sets all state
+		void cmdBind(VkCommandBuffer cmd);
+
+		// binds the shaders, graphics stages without a shader are bound to VK_NULL_HANDLE
+		void cmdBindShaders(VkCommandBuffer cmd);
+
+		// sets every state the bound shaders need, has to be called after binding
+		void cmdSetState(VkCommandBuffer cmd);
+
+		// the shader has to be initialized, its spirv is read again from shader.getPath()
+		void addShader(Shader& shader) { m_pShaders.push_back(&shader); }
+
+		void delShader(int index) { m_pShaders.erase(m_pShaders.begin() + index); }
+
+		// Called before init, linked shaders can only be bound together
+		void setLinked(bool linked) { m_isLinked = linked; }
+
+		void addDescriptorSetLayout(VkDescriptorSetLayout setLayout) { m_setLayouts.push_back(setLayout); }
+
+		void setDescriptorSetLayout(int index, VkDescriptorSetLayout setLayout) { m_setLayouts[index] = setLayout; }
+
+		void delDescriptorSetLayout(int index) { m_setLayouts.erase(m_setLayouts.begin() + index); }
+
+		void addPushConstantRange(VkPushConstantRange pushConstantRange) { m_pushConstantRanges.push_back(pushConstantRange); }
+
+		void delPushConstantRange(int index) { m_pushConstantRanges.erase(m_pushConstantRanges.begin() + index); }
+
+		void addVertexInputBindingDescription(const VkVertexInputBindingDescription& vertexInputBindingDescription);
+
+		void delVertexInputBindingDescription(int index);
+
+		void addVertexInputAttrubuteDescription(const VkVertexInputAttributeDescription& vertexInputAttributeDescription);
+
+		void delVertexInputAttrubuteDescription(int index);
+
+		void addViewport(const VkViewport& viewport) { m_viewports.push_back(viewport); }
+
+		void delViewport(int index) { m_viewports.erase(m_viewports.begin() + index); }
+
+		void addScissor(const VkRect2D& scissor) { m_scissors.push_back(scissor); }
+
+		void delScissor(int index) { m_scissors.erase(m_scissors.begin() + index); }
+
+		void setPrimitiveTopology(VkPrimitiveTopology primitiveTopology) { m_primitiveTopology = primitiveTopology; }
+
+		void setPolygonMode(VkPolygonMode polygonMode) { m_polygonMode = polygonMode; }
+
+		void setCullMode(VkCullModeFlags cullMode) { m_cullMode = cullMode; }
+
+		void setFrontFace(VkFrontFace frontFace) { m_frontFace = frontFace; }
+
+		// only set when a tessellation shader is bound, the topology has to be VK_PRIMITIVE_TOPOLOGY_PATCH_LIST then
+		void setPatchControlPoints(uint32_t patchControlPoints) { m_patchControlPoints = patchControlPoints; }
+
+		void setTessellationDomainOrigin(VkTessellationDomainOrigin domainOrigin) { m_tessellationDomainOrigin = domainOrigin; }
+
+		void enableBlending() { m_blendEnable = VK_TRUE; }
+
+		void disableBlending() { m_blendEnable = VK_FALSE; }
+
+		// the blend state is set for every color attachment of the render pass, default 1
+		void setColorAttachmentCount(uint32_t colorAttachmentCount) { m_colorAttachmentCount = colorAttachmentCount; }
+
+		void enableDepthTest() { m_depthTestEnable = VK_TRUE; }
+
+		void disableDepthTest() { m_depthTestEnable = VK_FALSE; }
+
+		void enableStencilTest() { m_stencilTestEnable = VK_TRUE; }
+
+		void disableStencilTest() { m_stencilTestEnable = VK_FALSE; }
+
+		void setStencilOpStates(VkStencilOpState front, VkStencilOpState back) { m_stencilFront = front; m_stencilBack = back; }
+		void setStencilOpStates(VkStencilOpState opState) { setStencilOpStates(opState, opState); }
+
+		VkPipelineLayout getVkPipelineLayout() { return m_pipelineLayout; }
+
+		VkShaderEXT getVkShaderEXT(int index) { return m_shaders[index]; }
+
+	private:
+		bool m_isInit = false;
+		bool m_isLinked = false;
+
+		VkPipelineLayout m_pipelineLayout = VK_NULL_HANDLE;
+		std::vector<VkShaderEXT> m_shaders;
+		std::vector<VkShaderStageFlagBits> m_shaderStages;
+
+		std::vector<Shader*> m_pShaders;
+		std::vector<VkDescriptorSetLayout> m_setLayouts;
+		std::vector<VkPushConstantRange> m_pushConstantRanges;
+		std::vector<VkVertexInputBindingDescription2EXT> m_vertexInputBindingDescriptions;
+		std::vector<VkVertexInputAttributeDescription2EXT> m_vertexInputAttributeDescriptions;
+		std::vector<VkViewport> m_viewports;
+		std::vector<VkRect2D> m_scissors;
+
+		VkPrimitiveTopology m_primitiveTopology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+		VkPolygonMode m_polygonMode = VK_POLYGON_MODE_FILL;
+		VkCullModeFlags m_cullMode = VK_CULL_MODE_BACK_BIT;
+		VkFrontFace m_frontFace = VK_FRONT_FACE_CLOCKWISE;
+		uint32_t m_patchControlPoints = 3;
+		VkTessellationDomainOrigin m_tessellationDomainOrigin = VK_TESSELLATION_DOMAIN_ORIGIN_UPPER_LEFT;
+		VkBool32 m_depthTestEnable = VK_FALSE;
+		VkCompareOp m_depthCompareOp = VK_COMPARE_OP_LESS;
+		VkBool32 m_stencilTestEnable = VK_FALSE;
+		VkStencilOpState m_stencilFront = {};
+		VkStencilOpState m_stencilBack = {};
+		uint32_t m_colorAttachmentCount = 1;
+		VkBool32 m_blendEnable = VK_TRUE;
+		VkColorBlendEquationEXT m_colorBlendEquation = {
+			VK_BLEND_FACTOR_SRC_ALPHA,
+			VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+			VK_BLEND_OP_ADD,
+			VK_BLEND_FACTOR_ONE,
+			VK_BLEND_FACTOR_ONE,
+			VK_BLEND_OP_ADD
+		};
+		VkColorComponentFlags m_colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
 	};
 
 	void acquireNextImage(VkSwapchainKHR swapchain, VkSemaphore semaphore, VkFence fence, uint32_t* pImageIndex);
@@ -817,6 +1352,8 @@ namespace vk
 	void allQueuesWaitIdle();
 
 	void createSemaphore(VkSemaphore* semaphore);
+	// requires the timelineSemaphore feature
+	void createTimelineSemaphore(VkSemaphore* semaphore, uint64_t initialValue = 0);
 	void destroySemaphore(VkSemaphore semaphore);
 
 	void createFence(VkFence* fence);
@@ -833,6 +1370,163 @@ namespace vk
 
 	uint32_t getQueueFamily();
 
+	/*
+	* Extra queue of the queue family for background work like acceleration structure builds
+	* Same family as the other queues so resources need no ownership transfer, falls back to the first queue if the family has only one
+	*/
+	VkQueue getAsyncComputeQueue();
+
+	/*
+	* Defers the destruction of vulkan objects until no frame in flight can reference them anymore
+	* push can be called from any thread, nextFrame has to be called once per frame
+	*/
+	class DeletionQueue {
+	public:
+		DeletionQueue();
+		~DeletionQueue();
+
+		void push(std::function<void()> destroyFunction);
+
+		// takes ownership of the buffers handles, the buffer is left uninitialized
+		void push(Buffer& buffer);
+
+		// destroys every object that was pushed more than frameDelay frames ago
+		void nextFrame();
+
+		// destroys every object immediately, the device has to be idle
+		void flush();
+
+		// amount of frames an object stays alive after being pushed
+		void setFrameDelay(uint32_t frameDelay) { m_frameDelay = frameDelay; }
+
+	private:
+		uint32_t m_frameDelay = VK_MIN_AMOUNT_OF_SWAPCHAIN_IMAGES;
+		uint64_t m_frame = 0;
+
+		std::mutex m_mutex;
+		std::vector<std::pair<uint64_t, std::function<void()>>> m_entries;
+	};
+
+	/*
+	* Shader binding table with any amount of records per region
+	* A record references a shader group of a ray tracing pipeline and can carry inline data after the group handle,
+	* shaders read it through shaderRecordEXT, e.g. a material index or a buffer device address per hit record
+	* Records can be changed individually, update() only writes the changed ones and keeps the buffer as long as the records fit
+	* On discrete gpus the table lives in device local memory and is filled through a staging buffer,
+	* so vkCmdTraceRaysKHR doesn't fetch the records over PCIe
+	*/
+	class ShaderBindingTable {
+	public:
+		enum MemoryPlacement {
+			eMEMORY_PLACEMENT_AUTO = 0, // host visible on integrated gpus or with resizable BAR, device local and staged otherwise
+			eMEMORY_PLACEMENT_DEVICE_LOCAL = 1,
+			eMEMORY_PLACEMENT_HOST_VISIBLE = 2
+		};
+
+		enum Region {
+			eREGION_RAYGEN = 0,
+			eREGION_MISS = 1,
+			eREGION_HIT = 2,
+			eREGION_CALLABLE = 3,
+			eREGION_COUNT = 4
+		};
+
+		ShaderBindingTable();
+		~ShaderBindingTable();
+
+		// fetches the group handles and writes all records, the table needs at least one raygen record
+		void init();
+
+		void destroy();
+
+		/*
+		* With a deletion queue changed tables are written into a new buffer and the old one is retired, so frames in flight can keep tracing
+		* Without one the records are rewritten in place and the frames that used the table have to be finished
+		* A staged table submits the copy and waits for it
+		* The buffer is otherwise only recreated when a region outgrew its capacity or the placement changed
+		*/
+		void update(DeletionQueue* pDeletionQueue = nullptr);
+
+		// the handles are fetched again on the next update, the group indices of the records have to stay valid
+		void setPipeline(VkPipeline pipeline);
+
+		// returns the index of the record inside its region
+		uint32_t addRecord(Region region, uint32_t groupIndex, const void* pData = nullptr, uint32_t dataSize = 0);
+
+		template<typename T>
+		uint32_t addRecord(Region region, uint32_t groupIndex, const T& data) {
+			return addRecord(region, groupIndex, &data, sizeof(T));
+		}
+
+		void setRecordGroup(Region region, uint32_t index, uint32_t groupIndex);
+
+		// writes dataSize bytes at offset into the inline data of the record, growing it if necessary
+		void setRecordData(Region region, uint32_t index, const void* pData, uint32_t dataSize, uint32_t offset = 0);
+
+		template<typename T>
+		void setRecordData(Region region, uint32_t index, const T& data, uint32_t offset = 0) {
+			setRecordData(region, index, &data, sizeof(T), offset);
+		}
+
+		// new records reference group 0 without data
+		void setRecordCount(Region region, uint32_t count);
+
+		// removes all records, the buffer is kept
+		void clear();
+
+		// reserves inline data for every record of the region so records can grow without changing the layout
+		void setMaxRecordDataSize(Region region, uint32_t size) { m_maxDataSizes[region] = size; }
+
+		uint32_t getRecordCount(Region region) const { return m_records[region].size(); }
+
+		// a trace call takes exactly one raygen record, index selects it
+		VkStridedDeviceAddressRegionKHR getRayGenRegion(uint32_t index = 0) const;
+		VkStridedDeviceAddressRegionKHR getMissRegion() const { return getRegion(eREGION_MISS); }
+		VkStridedDeviceAddressRegionKHR getHitRegion() const { return getRegion(eREGION_HIT); }
+		VkStridedDeviceAddressRegionKHR getCallRegion() const { return getRegion(eREGION_CALLABLE); }
+
+		Buffer& getBuffer() { return m_buffer; }
+
+		// applied on the next update, switching placements allows comparing the trace throughput of both
+		void setMemoryPlacement(MemoryPlacement memoryPlacement);
+
+		// true if the buffer is device local and written through a staging buffer
+		bool isStaged() const { return m_isStaged; }
+
+	private:
+		struct Record {
+			uint32_t groupIndex;
+			std::vector<uint8_t> data;
+			bool isDirty;
+		};
+
+		VkStridedDeviceAddressRegionKHR getRegion(Region region) const;
+
+		void reallocate(VkDeviceSize size, DeletionQueue* pDeletionQueue);
+
+		bool m_isInit = false;
+
+		VkPipeline m_pipeline = VK_NULL_HANDLE;
+		std::vector<uint8_t> m_handles;
+		uint32_t m_handleCount = 0;
+		bool m_handlesChanged = true;
+		bool m_writeAll = true;
+
+		Buffer m_buffer;
+		VkDeviceAddress m_deviceAddress = 0;
+		MemoryPlacement m_memoryPlacement = eMEMORY_PLACEMENT_AUTO;
+		bool m_isPlacementChanged = false;
+		bool m_isStaged = false;
+
+		std::vector<Record> m_records[eREGION_COUNT];
+		uint32_t m_maxDataSizes[eREGION_COUNT] = {};
+		VkDeviceSize m_offsets[eREGION_COUNT] = {};
+		VkDeviceSize m_strides[eREGION_COUNT] = {};
+		uint32_t m_capacities[eREGION_COUNT] = {}; // records that fit into the region of the current buffer
+
+		friend class ShaderHotReloader;
+	};
+
 	class RtPipeline {
 	public:
 		RtPipeline();
@@ -862,31 +1556,186 @@ namespace vk
 
 		void delDescriptorSetLayout(int index);
 
+		// e.g. VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT
+		void setCreateFlags(VkPipelineCreateFlags createFlags) { m_createFlags = createFlags; }
+
+		/*
+		* Compiles every shader group into its own pipeline library and links them into the pipeline, needs VK_KHR_pipeline_library
+		* update() then only compiles the groups that were added or whose shaders changed and relinks
+		* The sizes are the largest ray payload and hit attribute used by any shader of the pipeline
+		*/
+		void enableLibraries(uint32_t maxPipelineRayPayloadSize, uint32_t maxPipelineRayHitAttributeSize);
+
 		VkPipeline getVkPipeline() { return m_pipeline; }
 
 		VkPipelineLayout getVkPipelineLayout() { return m_pipelineLayout; }
 
-		VkStridedDeviceAddressRegionKHR getRayGenRegion() { return m_rgenRegion; }
-		VkStridedDeviceAddressRegionKHR getMissRegion() { return m_missRegion; }
-		VkStridedDeviceAddressRegionKHR getHitRegion() { return m_hitRegion; }
-		VkStridedDeviceAddressRegionKHR getCallRegion() { return m_callRegion; }
+		/*
+		* Filled with one record per shader group in group order by initShaderBindingTable and kept in sync with the groups on update
+		* Records added before the first initShaderBindingTable replace that layout and are left to the caller
+		*/
+		ShaderBindingTable& getShaderBindingTable() { return m_shaderBindingTable; }
+
+		VkStridedDeviceAddressRegionKHR getRayGenRegion(uint32_t index = 0) { return m_shaderBindingTable.getRayGenRegion(index); }
+		VkStridedDeviceAddressRegionKHR getMissRegion() { return m_shaderBindingTable.getMissRegion(); }
+		VkStridedDeviceAddressRegionKHR getHitRegion() { return m_shaderBindingTable.getHitRegion(); }
+		VkStridedDeviceAddressRegionKHR getCallRegion() { return m_shaderBindingTable.getCallRegion(); }
 
 	private:
+		// everything a pipeline is built from, as a copy so it can be built on another thread
+		struct BuildState {
+			VkPipelineLayout layout;
+			VkPipelineCreateFlags createFlags;
+			bool useLibraries;
+			VkRayTracingPipelineInterfaceCreateInfoKHR libraryInterface;
+			std::vector<VkPipelineShaderStageCreateInfo> stages;
+			std::vector<VkRayTracingShaderGroupCreateInfoKHR> groups;
+			std::vector<VkPipeline> libraries; // one per group with libraries, VK_NULL_HANDLE for the ones to compile
+		};
+
+		BuildState getBuildState() const;
+
+		static VkPipeline createVkPipeline(const BuildState& state);
+
+		// compiles a library for every group that has none, all in one call
+		static void compileLibraries(BuildState& state);
+
+		static VkPipeline linkLibraries(const BuildState& state);
+
+		void destroyLibraries();
+
+		// drops the libraries of groups using the module from the state, they are compiled again when it is built
+		static void invalidateLibraries(BuildState& state, VkShaderModule module);
+
 		bool m_isInit = false;
 
-		VkPipeline       m_pipeline;
-		VkPipelineLayout m_pipelineLayout;
+		VkPipeline       m_pipeline = VK_NULL_HANDLE;
+		VkPipelineLayout m_pipelineLayout = VK_NULL_HANDLE;
+		VkPipelineCreateFlags m_createFlags = 0;
+		bool m_isLayoutChanged = true;
+
+		bool m_useLibraries = false;
+		VkRayTracingPipelineInterfaceCreateInfoKHR m_libraryInterface = { VK_STRUCTURE_TYPE_RAY_TRACING_PIPELINE_INTERFACE_CREATE_INFO_KHR };
+		VkPipelineCreateFlags m_libraryCreateFlags = 0;
+		std::vector<VkPipeline> m_libraries; // one per shader group, VK_NULL_HANDLE until compiled
 
-		//ShaderBindingTable
-		Buffer m_rtSBTBuffer;
-		VkStridedDeviceAddressRegionKHR m_rgenRegion = {};
-		VkStridedDeviceAddressRegionKHR m_missRegion = {};
-		VkStridedDeviceAddressRegionKHR m_hitRegion = {};
-		VkStridedDeviceAddressRegionKHR m_callRegion = {};
+		ShaderBindingTable m_shaderBindingTable;
+		bool m_hasDefaultRecords = false;
 
 		std::vector<VkDescriptorSetLayout> m_descriptorSetLayouts;
 		std::vector<VkPipelineShaderStageCreateInfo> m_stages;
 		std::vector<VkRayTracingShaderGroupCreateInfoKHR> m_shaderGroupes;
+
+		friend class ShaderHotReloader;
+	};
+
+	/*
+	* Opt-in service that watches glsl sources and rebuilds the shaders and pipelines depending on them
+	* Compilation, shader module and pipeline creation run on a background thread from copies of the pipeline state,
+	* update() only starts the builds and swaps finished pipelines in at a frame boundary
+	* A dependent pipeline must not be changed or destroyed while it is rebuilt, call wait() first
+	*/
+	class ShaderHotReloader {
+	public:
+		ShaderHotReloader();
+		~ShaderHotReloader();
+
+		// starts the watcher thread
+		void init();
+
+		// stops the watcher thread and destroys all retired objects, the device has to be idle
+		void destroy();
+
+		// called once per frame, starts rebuilding the pipelines of reloaded shaders, swaps in finished ones
+		// and destroys objects no frame in flight can use anymore
+		void update();
+
+		// blocks until the started rebuilds are finished, the next update() swaps them in
+		void wait();
+
+		// srcPath is the glsl source that gets compiled into shader.getPath() whenever it changes
+		void addShader(Shader& shader, std::string srcPath);
+
+		// the pipeline gets rebuilt whenever the shader is reloaded
+		void addDependency(Shader& shader, Pipeline& pipeline);
+		void addDependency(Shader& shader, RtPipeline& rtPipeline);
+
+		// amount of frames a replaced pipeline stays alive
+		void setFrameDelay(uint32_t frameDelay) { m_deletionQueue.setFrameDelay(frameDelay); }
+
+	private:
+		struct Watch {
+			Shader*                  pShader;
+			std::string              srcPath;
+			std::string              directory;
+			std::string              fileName;
+			time_t                   lastWriteTime = 0;
+			std::vector<Pipeline*>   pipelines;
+			std::vector<RtPipeline*> rtPipelines;
+		};
+
+		struct Reload {
+			Shader*                  pShader;
+			VkShaderModule           module;
+			std::vector<Pipeline*>   pipelines;
+			std::vector<RtPipeline*> rtPipelines;
+		};
+
+		// the pipelines of a reload, built on the watcher thread from the state copied in update()
+		struct Build {
+			Reload                                 reload;
+			VkShaderModule                         oldModule;
+			std::vector<Pipeline>                  pipelineStates;   // copies using the new module
+			std::vector<VkPipeline>                oldPipelines;     // VK_NULL_HANDLE for pipelines that weren't initialized and aren't built
+			std::vector<RtPipeline::BuildState>    rtPipelineStates;
+			std::vector<VkPipeline>                oldRtPipelines;
+			std::vector<std::vector<VkPipeline>>   oldLibraries;
+			std::vector<VkPipeline>                pipelines;
+			std::vector<VkPipeline>                rtPipelines;
+			bool                                   isFailed = false;
+		};
+
+		// copies the state of the dependent pipelines with the new module
+		Build prepareBuild(const Reload& reload);
+
+		// runs on the watcher thread, keeps the old shader if a pipeline fails
+		void buildPipelines(Build& build);
+
+		// builds the queued builds, runs on the watcher thread
+		void buildPending();
+
+		// false if the shader or a pipeline changed since its state was copied
+		bool isCurrent(const Build& build);
+
+		// swaps the built pipelines and the new module in
+		void apply(Build& build);
+
+		// destroys the pipelines and libraries the build created, not the module
+		static void destroyPipelines(Build& build);
+
+		void watch();
+
+		void reload(const Watch& watch);
+
+		Watch* findWatch(Shader* pShader);
+
+		void addDirectoryWatch(const std::string& directory);
+
+		std::atomic<bool> m_isRunning{ false };
+		std::thread m_thread;
+
+		std::mutex m_mutex;
+		std::vector<Watch> m_watches;
+		std::vector<Reload> m_pendingReloads;
+		std::vector<Build> m_pendingBuilds;
+		std::vector<Build> m_finishedBuilds;
+		std::vector<Shader*> m_buildingShaders; // one build per shader at a time, so they are swapped in in order
+		bool m_isBuilding = false;
+		std::condition_variable m_buildCondition;
+		DeletionQueue m_deletionQueue;
+
+		int m_inotifyFd = -1;
+		std::unordered_map<int, std::string> m_watchDescriptors;
 	};
 
 	class AccelerationStructure; // forward declaration
@@ -906,6 +1755,25 @@ namespace vk
 		void setShaderBindingTableRecordOffset(uint32_t offset);
 
 		void setFlags(VkGeometryInstanceFlagsKHR flags);
+
+		struct Batch {
+			const float* pMatrices; // 4x4 world matrices
+			bool isColumnMajor = true; // glm layout
+			uint32_t matrixStride = 16 * sizeof(float); // in bytes, allows reading the matrices out of larger per object structs
+
+			// per instance values, nullptr uses the value of the template instance for all
+			const VkDeviceAddress* pAccelerationStructureReferences = nullptr;
+			const uint32_t* pCustomIndices = nullptr;
+			const uint8_t* pMasks = nullptr;
+			const uint32_t* pShaderBindingTableRecordOffsets = nullptr;
+		};
+
+		/*
+		* Converts count world matrices into 3x4 row major transforms and writes complete instance records, e.g. into AccelerationStructure::mapInstances
+		* The conversion uses AVX2, SSE or NEON when the build enables them
+		*/
+		static void writeBatch(VkAccelerationStructureInstanceKHR* pDst, uint32_t count, const AccelerationStructureInstance& templateInstance, const Batch& batch);
+
 	private:
 		VkAccelerationStructureInstanceKHR m_instance;
 
@@ -923,8 +1791,15 @@ namespace vk
 
 		void destroy();
 
+		// builds the structure, the handle is kept while the new build fits the current buffer
 		void update();
 
+		/*
+		* Updates the structure in place for moved vertices or changed instance transforms
+		* Falls back to a full build when the primitive counts or build flags changed since the last build
+		*/
+		void refit();
+
 		/*
 		* Called before init
 		* Either VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR or VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR
@@ -939,9 +1814,139 @@ namespace vk
 		*/
 		void setGeometry(std::vector<AccelerationStructureInstance>& instances);
 
-		void addGeometry(const Buffer& vertexBuffer, uint32_t vertexStride, const Buffer& indexBuffer);// TODO add multiple geometries for BLAS
+		/*
+		* TLAS only, called after init
+		* Streams the instances through a ring of persistently mapped buffers, one per frame in flight
+		* Prefers device local host visible memory (ReBAR) and falls back to host memory
+		* Recreates the ring buffers and possibly the structure, the device must not use either anymore
+		*/
+		void setInstanceCapacity(uint32_t capacity);
+
+		void setInstanceCount(uint32_t count);
+
+		// only writes the cpu copy and marks the instance dirty, no gpu work is done
+		void setInstance(uint32_t index, const AccelerationStructureInstance& instance);
+
+		/*
+		* Copies the dirty instances into the current ring slot and records the TLAS build reading from it
+		* Refits unless the instance count changed, the slot advances afterwards so no cpu wait is needed
+		*/
+		void cmdBuildInstances(VkCommandBuffer cmd, bool isRefit = true);
+
+		/*
+		* Sets the instance count and returns the mapped ring slot the next cmdBuildInstances reads, for writing instances without the cpu copy
+		* The caller has to write all count instances before the next call on this TLAS
+		* Mixing with setInstance or building other slots reads the instances back into the cpu copy once
+		*/
+		VkAccelerationStructureInstanceKHR* mapInstances(uint32_t count);
+
+		// writes count instances from world matrices straight into the instance stream, see AccelerationStructureInstance::writeBatch
+		void setInstances(uint32_t count, const AccelerationStructureInstance& templateInstance, const AccelerationStructureInstance::Batch& batch);
+
+		/*
+		* Adds a triangle geometry to this BLAS, every geometry gets its own build range
+		* A BLAS either holds only triangle or only aabb geometries
+		*/
+		void addGeometry(const Buffer& vertexBuffer, uint32_t vertexStride, const Buffer& indexBuffer, VkGeometryFlagsKHR flags = VK_GEOMETRY_OPAQUE_BIT_KHR);
+
+		// adds a submesh of a shared vertex and index buffer, firstVertex is added to every index
+		void addGeometry(const Buffer& vertexBuffer, uint32_t vertexStride, const Buffer& indexBuffer,
+			uint32_t firstPrimitive, uint32_t primitiveCount, uint32_t firstVertex = 0, VkGeometryFlagsKHR flags = VK_GEOMETRY_OPAQUE_BIT_KHR);
+
+		struct TriangleGeometry {
+			const Buffer* pVertexBuffer;
+			uint32_t vertexStride;
+			VkDeviceSize vertexOffset = 0; // in bytes, aligned to the component size of the format
+			/*
+			* Any format with VK_FORMAT_FEATURE_ACCELERATION_STRUCTURE_VERTEX_BUFFER_BIT_KHR
+			* e.g. VK_FORMAT_R16G16B16A16_SFLOAT or VK_FORMAT_R16G16B16A16_SNORM to halve the vertex memory
+			*/
+			VkFormat vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
+
+			const Buffer* pIndexBuffer = nullptr; // nullptr for non indexed geometry
+			VkIndexType indexType = VK_INDEX_TYPE_UINT32; // VK_INDEX_TYPE_UINT16 or VK_INDEX_TYPE_UINT32
+			VkDeviceSize indexOffset = 0; // in bytes, aligned to the index size
+
+			uint32_t firstPrimitive = 0;
+			uint32_t primitiveCount = 0; // 0 uses every primitive behind the offsets
+			uint32_t firstVertex = 0; // added to every index
+
+			const Buffer* pTransformBuffer = nullptr; // optional VkTransformMatrixKHR, see setGeometryTransform
+			uint32_t transformOffset = 0;
+
+			VkGeometryFlagsKHR flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+		};
+
+		// adds a triangle geometry with compact vertex and index formats, offsets and a transform
+		void addGeometry(const TriangleGeometry& geometry);
+
+		// adds a single aabb, use addAabbs for many procedural primitives
+		void addGeometry(float aabbMin[3], float aabbMax[3]);
+
+		/*
+		* Adds one aabb geometry holding aabbCount primitives, uploaded with a single transfer
+		* stride is the distance between the aabbs in pAabbs, it has to be at least sizeof(VkAabbPositionsKHR)
+		*/
+		void addAabbs(const VkAabbPositionsKHR* pAabbs, uint32_t aabbCount, uint32_t stride = sizeof(VkAabbPositionsKHR), VkGeometryFlagsKHR flags = VK_GEOMETRY_OPAQUE_BIT_KHR);
+
+		/*
+		* Adds one aabb geometry reading aabbCount primitives from existing gpu data, nothing is copied
+		* The buffer needs VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR and VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+		* offset and stride have to be multiples of 8
+		*/
+		void addAabbs(const Buffer& aabbBuffer, uint32_t aabbCount, uint32_t stride = sizeof(VkAabbPositionsKHR), VkDeviceSize offset = 0, VkGeometryFlagsKHR flags = VK_GEOMETRY_OPAQUE_BIT_KHR);
+
+		/*
+		* Transforms the vertices of a triangle geometry by a VkTransformMatrixKHR read from the buffer at transformOffset
+		* transformOffset has to be a multiple of 16
+		*/
+		void setGeometryTransform(uint32_t geometryIndex, const Buffer& transformBuffer, uint32_t transformOffset = 0);
+
+		void setGeometryFlags(uint32_t geometryIndex, VkGeometryFlagsKHR flags);
 
-		void addGeometry(float aabbMax[3], float aabbMin[3]);
+		uint32_t getGeometryCount() const { return m_geometryVector.size(); }
+
+		/*
+		* e.g. VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR for static or PREFER_FAST_BUILD for often rebuilt structures
+		* refit requires VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR
+		* Default VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR
+		*/
+		void setBuildFlags(VkBuildAccelerationStructureFlagsKHR buildFlags) { m_buildFlags = buildFlags; }
+
+		// true if refit can update in place instead of rebuilding
+		bool canRefit() const;
+
+		// builds with VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR so compact can shrink the structure
+		void setCompaction(bool isCompactionEnabled) { m_isCompactionEnabled = isCompactionEnabled; }
+
+		/*
+		* Copies the built structure into a buffer of its compacted size, returns the bytes saved
+		* The old structure is retired through the deletionQueue or destroyed immediately without one
+		* The handle and device address change, TLAS instances referencing it have to be rebuilt
+		* Structures not built with compaction are skipped, builds through an AccelerationStructureBuilder have to be waited on first
+		*/
+		VkDeviceSize compact(DeletionQueue* pDeletionQueue = nullptr);
+
+		// compacts all structures built with compaction using one query and copy submission
+		static VkDeviceSize compact(const std::vector<AccelerationStructure*>& accelerationStructures, DeletionQueue* pDeletionQueue = nullptr);
+
+		// total bytes saved by compaction since the start of the application
+		static VkDeviceSize getCompactionSavedBytes();
+
+		VkDeviceSize getSize() const { return m_buffer.getSize(); }
+
+		/*
+		* BLAS only, copies the built structure into a blob with vkCmdCopyAccelerationStructureToMemoryKHR
+		* The blob starts with the driver and compatibility UUIDs of the device that wrote it
+		*/
+		std::vector<char> serialize();
+
+		/*
+		* BLAS only, called after init and after the geometries are added
+		* Replaces the structure with a serialized one instead of building it, the blob has to come from the same geometries and build flags
+		* Returns false and leaves the structure untouched if the blob isn't compatible with the driver
+		*/
+		bool deserialize(const void* pData, size_t size);
 
 		VkDeviceAddress getDeviceAddress();
 
@@ -949,16 +1954,443 @@ namespace vk
 		VkAccelerationStructureKHR* getVkAccelerationStructureKHRptr() { return &m_accelerationStructure; }
 
 	private:
+		void build(bool isRefit);
+
+		// throws if setInstanceCapacity wasn't called
+		void checkInstanceStream() const;
+
+		// widens the dirty range of every ring slot to cover [first, end)
+		void markInstancesDirty(uint32_t first, uint32_t end);
+
+		// copies the instances written through mapInstances into the cpu copy
+		void syncMappedInstances();
+
+		// sizes and if necessary recreates the structure for a build or refit, returns the needed scratch size
+		VkDeviceSize prepareBuild(VkAccelerationStructureBuildGeometryInfoKHR& buildGeometryInfo, bool isRefit = false);
+
+		VkBuildAccelerationStructureFlagsKHR getBuildFlags() const;
+
 		bool m_isInit = false;
+		bool m_isCompactionEnabled = false;
+
+		VkBuildAccelerationStructureFlagsKHR m_buildFlags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
+
+		// state of the last full build, a refit has to match it
+		bool m_isBuilt = false;
+		VkBuildAccelerationStructureFlagsKHR m_builtFlags = 0;
+		std::vector<uint32_t> m_builtPrimitiveCounts;
 
 		Buffer m_buffer;
 		VkAccelerationStructureKHR m_accelerationStructure;
 
 		VkAccelerationStructureTypeKHR m_type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR; // Has to be set by user before initializing
-		std::vector<vk::Buffer*> m_additionalBuffers; // Buffers like aabb buffers etc.
+		std::vector<Buffer> m_geometryBuffers; // geometry data owned by the structure, e.g. uploaded aabbs
 		std::vector<VkAccelerationStructureGeometryKHR> m_geometryVector;
 		std::vector<VkAccelerationStructureBuildRangeInfoKHR> m_buildRangeInfoVector;
 		Buffer m_instancesBuffer;
+
+		// instance stream
+		struct InstanceSlot {
+			Buffer buffer;
+			VkAccelerationStructureInstanceKHR* pMappedInstances;
+			VkDeviceAddress deviceAddress;
+			uint32_t dirtyFirst; // instances changed since this slot was written last [first, end)
+			uint32_t dirtyEnd;
+		};
+		std::vector<InstanceSlot> m_instanceSlots;
+		uint32_t m_instanceSlotIndex = 0;
+		int32_t m_mappedSlotIndex = -1; // slot written through mapInstances that the cpu copy doesn't have yet
+		std::vector<VkAccelerationStructureInstanceKHR> m_instances;
+		Buffer m_instanceScratchBuffer;
+		VkDeviceAddress m_instanceScratchAddress = 0;
+
+		friend class AccelerationStructureBuilder;
+		friend class AccelerationStructureCache;
+	};
+
+	/*
+	* Builds many acceleration structures without a scratch allocation and fence wait per structure
+	* The structures share one pooled scratch buffer, they are packed into chunks that fit it and every chunk is one command buffer
+	* Chunks run on the async compute queue and signal a timeline semaphore, build only waits for earlier builds when the scratch buffer has to grow
+	* Consumers wait on the gpu with addWait, the cpu can poll isFinished or block in wait
+	* Requires the timelineSemaphore feature
+	*/
+	class AccelerationStructureBuilder {
+	public:
+		AccelerationStructureBuilder();
+		~AccelerationStructureBuilder();
+
+		// frees the scratch buffer and the semaphore, waits for running builds
+		void destroy();
+
+		// queues the structure for the next build, it has to be initialized, adding it twice builds it once
+		void add(AccelerationStructure& accelerationStructure, bool isRefit = false);
+
+		// drops the structure from the queue and waits for chunks building it, call it before destroying a structure that was added
+		void remove(AccelerationStructure& accelerationStructure);
+
+		/*
+		* Records and submits the queued structures, returns the timeline value that is signaled once they are built
+		* Waits for earlier chunks that still build one of the queued structures, it might be recreated
+		*/
+		uint64_t build();
+
+		// true once every submitted chunk has finished, dependencies of the structures are updated as their chunks finish
+		bool isFinished();
+
+		void wait();
+
+		// blocks until the chunks up to the timeline value, e.g. a value returned by build, have finished
+		void wait(uint64_t timelineValue);
+
+		// makes the command buffer wait on the gpu for the last build, e.g. the one tracing rays with an RtPipeline
+		void addWait(CommandBuffer& cmd, VkPipelineStageFlags waitDstStageMask = VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR);
+
+		VkSemaphore getTimelineSemaphore() const { return m_timelineSemaphore; }
+
+		// value signaled once the last submitted build finished
+		uint64_t getTimelineValue() const { return m_timelineValue; }
+
+		// size of the shared scratch buffer, grows to fit the largest single structure, default 64MiB
+		void setScratchSize(VkDeviceSize scratchSize) { m_scratchSize = scratchSize; }
+
+		uint32_t getChunkCount() const { return m_chunks.size(); }
+
+	private:
+		struct Chunk {
+			CommandBuffer cmd;
+			uint64_t timelineValue;
+			std::vector<AccelerationStructure*> accelerationStructures;
+		};
+
+		void submitChunk(const std::vector<VkAccelerationStructureBuildGeometryInfoKHR>& buildInfos, const std::vector<const VkAccelerationStructureBuildRangeInfoKHR*>& buildRanges,
+			const std::vector<AccelerationStructure*>& accelerationStructures);
+
+		// frees the chunks up to completedValue and notifies the dependencies of their structures
+		void retire(uint64_t completedValue);
+
+		std::vector<std::pair<AccelerationStructure*, bool>> m_queued; // structure and if it is refitted
+		std::vector<Chunk> m_chunks; // in submission order
+
+		VkSemaphore m_timelineSemaphore = VK_NULL_HANDLE;
+		uint64_t m_timelineValue = 0;
+
+		Buffer m_scratchBuffer;
+		VkDeviceSize m_scratchSize = 64 * 1024 * 1024;
+	};
+
+	/*
+	* On disk cache of serialized BLAS, warm starts skip the build entirely
+	* Entries are keyed by a user supplied geometry hash, the driver UUID and the geometry layout and build flags of the structure
+	* Files carry a versioned header, entries of another driver or version are ignored and overwritten by the next store
+	*/
+	class AccelerationStructureCache {
+	public:
+		AccelerationStructureCache();
+		~AccelerationStructureCache();
+
+		// the directory has to exist
+		void init(const std::string& directory);
+
+		// FNV-1a, use it to hash the source geometry the buffers were filled with
+		static uint64_t hash(const void* pData, size_t size, uint64_t seed = 0xcbf29ce484222325);
+
+		/*
+		* The structure has to be initialized and have its geometries added
+		* Returns false on a miss, the structure then has to be built and stored
+		*/
+		bool load(AccelerationStructure& accelerationStructure, uint64_t geometryHash);
+
+		// the structure has to be built, compact it first to keep the entry small
+		void store(AccelerationStructure& accelerationStructure, uint64_t geometryHash);
+
+		// loads the structure or builds and stores it on a miss, returns true on a hit
+		// a failed store is logged, the built structure is kept
+		bool loadOrBuild(AccelerationStructure& accelerationStructure, uint64_t geometryHash);
+
+		uint32_t getHitCount() const { return m_hitCount; }
+		uint32_t getMissCount() const { return m_missCount; }
+
+	private:
+		struct FileHeader {
+			uint32_t magic;
+			uint32_t version;
+			uint8_t  driverUUID[VK_UUID_SIZE];
+			uint64_t key;
+			uint64_t dataSize;
+		};
+
+		uint64_t getKey(const AccelerationStructure& accelerationStructure, uint64_t geometryHash) const;
+
+		std::string getPath(uint64_t key) const;
+
+		bool m_isInit = false;
+
+		std::string m_directory;
+		uint8_t m_driverUUID[VK_UUID_SIZE];
+
+		uint32_t m_hitCount = 0;
+		uint32_t m_missCount = 0;
+	};
+
+	/*
+	* Shares one BLAS between identical triangle geometry inputs instead of building a copy per user
+	* The key covers the vertex and index buffer handles or a content hash, stride, ranges, geometry flags and build flags
+	* acquire returns the shared structure with its reference count incremented, release destroys it once the last user is gone
+	*/
+	class AccelerationStructureRegistry {
+	public:
+		struct Geometry {
+			const Buffer* pVertexBuffer;
+			uint32_t vertexStride;
+			const Buffer* pIndexBuffer;
+			uint32_t firstPrimitive = 0;
+			uint32_t primitiveCount = 0; // 0 uses the whole index buffer
+			uint32_t firstVertex = 0;
+			VkGeometryFlagsKHR flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+		};
+
+		AccelerationStructureRegistry();
+		~AccelerationStructureRegistry();
+
+		// destroys every structure, references that weren't released become invalid
+		void destroy();
+
+		/*
+		* Identical buffer handles mean identical geometry
+		* A destroyed buffer's handle can be reused by an unrelated one, release the structures before destroying their buffers
+		*/
+		AccelerationStructure& acquire(const Buffer& vertexBuffer, uint32_t vertexStride, const Buffer& indexBuffer, VkGeometryFlagsKHR flags = VK_GEOMETRY_OPAQUE_BIT_KHR);
+		AccelerationStructure& acquire(const std::vector<Geometry>& geometries);
+
+		/*
+		* Matches the same mesh uploaded into different buffers, e.g. contentHash = AccelerationStructureCache::hash of the vertices and indices
+		* The buffers of the first acquire are the ones the structure is built from and refitted with
+		*/
+		AccelerationStructure& acquire(uint64_t contentHash, const std::vector<Geometry>& geometries);
+
+		// the structure is destroyed through the deletionQueue, or immediately without one, once its reference count reaches 0
+		void release(AccelerationStructure& accelerationStructure, DeletionQueue* pDeletionQueue = nullptr);
+
+		// new structures are queued in the builder instead of being built immediately
+		void setBuilder(AccelerationStructureBuilder* pBuilder) { m_pBuilder = pBuilder; }
+
+		// build flags of new structures, part of the key
+		void setBuildFlags(VkBuildAccelerationStructureFlagsKHR buildFlags) { m_buildFlags = buildFlags; }
+
+		uint32_t getUniqueCount() const { return m_entries.size(); }
+
+		// acquires served by an existing structure since the start
+		uint32_t getDuplicateCount() const { return m_duplicateCount; }
+
+		// memory the current references would take with one structure each
+		VkDeviceSize getSavedBytes() const;
+
+		void printStats() const;
+
+	private:
+		struct Entry {
+			AccelerationStructure* pAccelerationStructure;
+			uint32_t referenceCount;
+		};
+
+		AccelerationStructure& acquireKey(uint64_t key, const std::vector<Geometry>& geometries);
+
+		mutable std::mutex m_mutex;
+
+		AccelerationStructureBuilder* m_pBuilder = nullptr;
+		VkBuildAccelerationStructureFlagsKHR m_buildFlags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
+
+		std::unordered_map<uint64_t, Entry> m_entries;
+		std::unordered_map<AccelerationStructure*, uint64_t> m_keys;
+
+		uint32_t m_duplicateCount = 0;
+	};
+
+	/*
+	* Culls TLAS instances on the cpu and picks a BLAS LOD per instance before they are streamed into the TLAS
+	* Instances beyond the max distance or outside the frustum extended by a margin are dropped, LODs are chosen by projected screen space error
+	* Runs on worker threads with SSE or NEON, the surviving instances are written compacted into the instance stream of the TLAS
+	*/
+	class InstanceProcessor {
+	public:
+		struct Lod {
+			AccelerationStructure* pAccelerationStructure;
+			float geometricError; // object space deviation from the full detail mesh
+		};
+
+		InstanceProcessor();
+		~InstanceProcessor();
+
+		/*
+		* lods are ordered from the finest to the coarsest, the bounding sphere is in object space
+		* Returns the mesh index, the device addresses of the lods are read here
+		*/
+		uint32_t addMesh(const std::vector<Lod>& lods, const float boundsCenter[3], float boundsRadius);
+
+		// returns the instance index
+		uint32_t addInstance(uint32_t mesh, const VkTransformMatrixKHR& transform, uint32_t customIndex = 0, uint32_t mask = 0xFF,
+			uint32_t shaderBindingTableRecordOffset = 0, VkGeometryInstanceFlagsKHR flags = 0);
+
+		void setTransform(uint32_t instance, const VkTransformMatrixKHR& transform);
+
+		void clear();
+
+		/*
+		* viewProjection is column major like glm with vulkan clip space, only the side planes are used
+		* verticalFov is in radians, viewportHeight in pixels
+		*/
+		void setView(const float viewProjection[16], const float cameraPosition[3], float verticalFov, float viewportHeight);
+
+		// instances whose bounds are further away are dropped, default no limit
+		void setMaxDistance(float maxDistance) { m_maxDistance = maxDistance; }
+
+		// extends the frustum by this world space distance, keeps nearby off screen geometry for shadows and reflections
+		void setFrustumMargin(float frustumMargin) { m_frustumMargin = frustumMargin; }
+
+		// the coarsest LOD whose error projects below this many pixels is picked, default 1
+		void setMaxScreenSpaceError(float maxScreenSpaceError) { m_maxScreenSpaceError = maxScreenSpaceError; }
+
+		void setFrustumCulling(bool isFrustumCullingEnabled) { m_isFrustumCullingEnabled = isFrustumCullingEnabled; }
+
+		// 0 uses all hardware threads
+		void setThreadCount(uint32_t threadCount) { m_threadCount = threadCount; }
+
+		/*
+		* Culls and writes the visible instances into the instance stream of the TLAS, see AccelerationStructure::setInstanceCapacity
+		* Returns the visible count, the instance count changes so build with cmdBuildInstances(cmd, false)
+		*/
+		uint32_t process(AccelerationStructure& tlas);
+
+		uint32_t getInstanceCount() const { return m_meshIndices.size(); }
+		uint32_t getVisibleCount() const { return m_visibleCount; }
+
+	private:
+		struct Mesh {
+			float center[3];
+			float radius;
+			uint32_t lodFirst;
+			uint32_t lodCount;
+		};
+
+		struct LodReference {
+			VkDeviceAddress accelerationStructureReference;
+			float geometricError;
+		};
+
+		// culls instances [first, end) and appends the visible ones to instances
+		void processRange(uint32_t first, uint32_t end, std::vector<VkAccelerationStructureInstanceKHR>& instances) const;
+
+		std::vector<Mesh> m_meshes;
+		std::vector<LodReference> m_lods;
+
+		std::vector<VkAccelerationStructureInstanceKHR> m_instances; // reference is filled in by process
+		std::vector<uint32_t> m_meshIndices;
+		std::vector<float> m_scales; // largest axis scale of the transform
+
+		// world space bounding spheres as structure of arrays, padded to a multiple of 4
+		std::vector<float> m_sphereX;
+		std::vector<float> m_sphereY;
+		std::vector<float> m_sphereZ;
+		std::vector<float> m_sphereRadius;
+
+		float m_planes[4][4] = {}; // left, right, bottom, top as xyz normal and w distance
+		float m_cameraPosition[3] = {};
+		float m_errorToPixels = 1.0f;
+
+		float m_maxDistance = std::numeric_limits<float>::max();
+		float m_frustumMargin = 0.0f;
+		float m_maxScreenSpaceError = 1.0f;
+		bool m_isFrustumCullingEnabled = true;
+		uint32_t m_threadCount = 0;
+
+		std::vector<std::vector<VkAccelerationStructureInstanceKHR>> m_threadInstances;
+		uint32_t m_visibleCount = 0;
+	};
+
+	/*
+	* Global bindless resource table built on descriptor indexing
+	* Resources get a stable index that shaders use to access them, the set is bound once and updated after bind
+	* Shader bindings:
+	*   0: sampler2D images[]
+	*   1: buffer storageBuffers[]
+	*   2: accelerationStructureEXT accelerationStructures[] (variable count)
+	* Requires the matching descriptorBinding*UpdateAfterBind, descriptorBindingPartiallyBound,
+	* descriptorBindingVariableDescriptorCount and runtimeDescriptorArray features
+	*/
+	class BindlessDescriptorTable {
+	public:
+		enum Binding {
+			eIMAGE_BINDING = 0,
+			eSTORAGE_BUFFER_BINDING = 1,
+			eACCELERATION_STRUCTURE_BINDING = 2
+		};
+
+		BindlessDescriptorTable();
+		~BindlessDescriptorTable();
+
+		operator VkDescriptorSet() const { return m_descriptorSet; }
+
+		void init();
+
+		void destroy();
+
+		// returns the index of the resource in its array
+		uint32_t addImage(Image& image, Sampler& sampler, VkImageLayout imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		uint32_t addStorageBuffer(Buffer& buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE);
+		uint32_t addAccelerationStructure(AccelerationStructure& accelerationStructure);
+
+		// rewrites an index, e.g. after the resource was recreated
+		void setImage(uint32_t index, Image& image, Sampler& sampler, VkImageLayout imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		void setStorageBuffer(uint32_t index, Buffer& buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE);
+		void setAccelerationStructure(uint32_t index, AccelerationStructure& accelerationStructure);
+
+		// the index is reused once no frame in flight can access it anymore
+		void removeImage(uint32_t index) { retireSlot(m_imageSlots, index); }
+		void removeStorageBuffer(uint32_t index) { retireSlot(m_storageBufferSlots, index); }
+		void removeAccelerationStructure(uint32_t index) { retireSlot(m_accelerationStructureSlots, index); }
+
+		// called once per frame, makes removed indices available again
+		void nextFrame();
+
+		// Called before init
+		void setImageCapacity(uint32_t capacity) { m_imageSlots.capacity = capacity; }
+		void setStorageBufferCapacity(uint32_t capacity) { m_storageBufferSlots.capacity = capacity; }
+		void setAccelerationStructureCapacity(uint32_t capacity) { m_accelerationStructureSlots.capacity = capacity; }
+		void setStages(VkShaderStageFlags stages) { m_stages = stages; }
+
+		// amount of frames a removed index stays reserved
+		void setFrameDelay(uint32_t frameDelay) { m_frameDelay = frameDelay; }
+
+		VkDescriptorSet getVkDescriptorSet() const { return m_descriptorSet; }
+
+		VkDescriptorSetLayout getVkDescriptorSetLayout() const { return m_descriptorSetLayout; }
+
+	private:
+		struct SlotAllocator {
+			uint32_t capacity;
+			uint32_t next = 0;
+			std::vector<uint32_t> freeSlots = {};
+			std::vector<std::pair<uint64_t, uint32_t>> retiredSlots = {}; // frame of removal and index
+		};
+
+		uint32_t allocateSlot(SlotAllocator& slots);
+
+		void retireSlot(SlotAllocator& slots, uint32_t index);
+
+		bool m_isInit = false;
+
+		VkDescriptorPool m_descriptorPool = VK_NULL_HANDLE;
+		VkDescriptorSetLayout m_descriptorSetLayout = VK_NULL_HANDLE;
+		VkDescriptorSet m_descriptorSet = VK_NULL_HANDLE;
+
+		VkShaderStageFlags m_stages = VK_SHADER_STAGE_ALL;
+		uint32_t m_frameDelay = VK_MIN_AMOUNT_OF_SWAPCHAIN_IMAGES;
+		uint64_t m_frame = 0;
+
+		SlotAllocator m_imageSlots = { 4096 };
+		SlotAllocator m_storageBufferSlots = { 4096 };
+		SlotAllocator m_accelerationStructureSlots = { 1024 };
 	};
 }
 
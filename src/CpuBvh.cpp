@@ -0,0 +1,645 @@
+#include "CpuBvh.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VK_CPU_BVH_SSE
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define VK_CPU_BVH_NEON
+#endif
+
+namespace {
+
+	/*
+	* Minimal 4-wide float vector, lane 3 is padding
+	* Falls back to scalar code when neither SSE nor NEON is available
+	*/
+	struct Float4 {
+#if defined(VK_CPU_BVH_SSE)
+		__m128 v;
+
+		static Float4 load(const float* p) { return { _mm_loadu_ps(p) }; }
+		static Float4 splat(float f) { return { _mm_set1_ps(f) }; }
+		static Float4 set(float x, float y, float z, float w) { return { _mm_setr_ps(x, y, z, w) }; }
+		void store(float* p) const { _mm_storeu_ps(p, v); }
+
+		friend Float4 min(Float4 a, Float4 b) { return { _mm_min_ps(a.v, b.v) }; }
+		friend Float4 max(Float4 a, Float4 b) { return { _mm_max_ps(a.v, b.v) }; }
+		friend Float4 operator+(Float4 a, Float4 b) { return { _mm_add_ps(a.v, b.v) }; }
+		friend Float4 operator-(Float4 a, Float4 b) { return { _mm_sub_ps(a.v, b.v) }; }
+		friend Float4 operator*(Float4 a, Float4 b) { return { _mm_mul_ps(a.v, b.v) }; }
+
+		// takes xyz from a and w from b, bitwise so NaNs in a.w don't leak
+		static Float4 selectXyz(Float4 a, Float4 b) {
+			const __m128 mask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+			return { _mm_or_ps(_mm_and_ps(mask, a.v), _mm_andnot_ps(mask, b.v)) };
+		}
+		float hmax() const {
+			__m128 t = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+			t = _mm_max_ps(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 0, 3, 2)));
+			return _mm_cvtss_f32(t);
+		}
+		float hmin() const {
+			__m128 t = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+			t = _mm_min_ps(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 0, 3, 2)));
+			return _mm_cvtss_f32(t);
+		}
+#elif defined(VK_CPU_BVH_NEON)
+		float32x4_t v;
+
+		static Float4 load(const float* p) { return { vld1q_f32(p) }; }
+		static Float4 splat(float f) { return { vdupq_n_f32(f) }; }
+		static Float4 set(float x, float y, float z, float w) { const float f[4] = { x, y, z, w }; return { vld1q_f32(f) }; }
+		void store(float* p) const { vst1q_f32(p, v); }
+
+		friend Float4 min(Float4 a, Float4 b) { return { vminq_f32(a.v, b.v) }; }
+		friend Float4 max(Float4 a, Float4 b) { return { vmaxq_f32(a.v, b.v) }; }
+		friend Float4 operator+(Float4 a, Float4 b) { return { vaddq_f32(a.v, b.v) }; }
+		friend Float4 operator-(Float4 a, Float4 b) { return { vsubq_f32(a.v, b.v) }; }
+		friend Float4 operator*(Float4 a, Float4 b) { return { vmulq_f32(a.v, b.v) }; }
+
+		static Float4 selectXyz(Float4 a, Float4 b) {
+			const uint32_t m[4] = { 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0 };
+			return { vbslq_f32(vld1q_u32(m), a.v, b.v) };
+		}
+		float hmax() const {
+			float32x2_t t = vpmax_f32(vget_low_f32(v), vget_high_f32(v));
+			return vget_lane_f32(vpmax_f32(t, t), 0);
+		}
+		float hmin() const {
+			float32x2_t t = vpmin_f32(vget_low_f32(v), vget_high_f32(v));
+			return vget_lane_f32(vpmin_f32(t, t), 0);
+		}
+#else
+		float v[4];
+
+		static Float4 load(const float* p) { return { { p[0], p[1], p[2], p[3] } }; }
+		static Float4 splat(float f) { return { { f, f, f, f } }; }
+		static Float4 set(float x, float y, float z, float w) { return { { x, y, z, w } }; }
+		void store(float* p) const { for (int i = 0; i < 4; i++) p[i] = v[i]; }
+
+		friend Float4 min(Float4 a, Float4 b) { return { { std::min(a.v[0], b.v[0]), std::min(a.v[1], b.v[1]), std::min(a.v[2], b.v[2]), std::min(a.v[3], b.v[3]) } }; }
+		friend Float4 max(Float4 a, Float4 b) { return { { std::max(a.v[0], b.v[0]), std::max(a.v[1], b.v[1]), std::max(a.v[2], b.v[2]), std::max(a.v[3], b.v[3]) } }; }
+		friend Float4 operator+(Float4 a, Float4 b) { return { { a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3] } }; }
+		friend Float4 operator-(Float4 a, Float4 b) { return { { a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3] } }; }
+		friend Float4 operator*(Float4 a, Float4 b) { return { { a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3] } }; }
+
+		static Float4 selectXyz(Float4 a, Float4 b) { return { { a.v[0], a.v[1], a.v[2], b.v[3] } }; }
+		float hmax() const { return std::max(std::max(v[0], v[1]), std::max(v[2], v[3])); }
+		float hmin() const { return std::min(std::min(v[0], v[1]), std::min(v[2], v[3])); }
+#endif
+	};
+
+	float surfaceArea(const float* pMin, const float* pMax) {
+		float x = pMax[0] - pMin[0];
+		float y = pMax[1] - pMin[1];
+		float z = pMax[2] - pMin[2];
+		return 2.0f * (x * y + y * z + z * x);
+	}
+
+	struct Bin {
+		Float4 boundsMin = Float4::splat(std::numeric_limits<float>::max());
+		Float4 boundsMax = Float4::splat(-std::numeric_limits<float>::max());
+		uint32_t count = 0;
+	};
+
+	// subtrees below this many primitives are always built on the current thread
+	const uint32_t parallelBuildThreshold = 4096;
+
+	const uint32_t traversalStackSize = 128;
+
+	// fixed size traversal stack that spills onto the heap, so degenerate deep trees still traverse exactly
+	struct TraversalStack {
+		uint32_t nodes[traversalStackSize];
+		std::vector<uint32_t> spill;
+		uint32_t size = 0;
+
+		void push(uint32_t node) {
+			if (size < traversalStackSize)
+				nodes[size] = node;
+			else
+				spill.push_back(node);
+			size++;
+		}
+
+		uint32_t pop() {
+			size--;
+			if (size < traversalStackSize)
+				return nodes[size];
+			uint32_t node = spill.back();
+			spill.pop_back();
+			return node;
+		}
+	};
+
+	// precomputed per ray values for the slab test
+	struct RayData {
+		Float4 origin;
+		Float4 invDirection;
+		Float4 tMin;
+		Float4 tMax;
+	};
+
+	RayData prepareRay(const vk::CpuBvh::Ray& ray) {
+		RayData data;
+		float inv[4];
+		for (int i = 0; i < 3; i++) {
+			// avoid inf * 0 = NaN when a component is exactly zero
+			float d = std::fabs(ray.direction[i]) > 1e-20f ? ray.direction[i] : std::copysign(1e-20f, ray.direction[i]);
+			inv[i] = 1.0f / d;
+		}
+		inv[3] = 0.0f;
+		data.origin = Float4::set(ray.origin[0], ray.origin[1], ray.origin[2], 0.0f);
+		data.invDirection = Float4::load(inv);
+		data.tMin = Float4::splat(ray.tMin);
+		data.tMax = Float4::splat(ray.tMax);
+		return data;
+	}
+
+	// SIMD slab test, returns the entry distance or +inf on a miss
+	float intersectNode(const vk::CpuBvh::Node& node, const RayData& ray, float tMax) {
+		// lane 3 loads leftFirst/primitiveCount, selectXyz replaces it before the reduction
+		Float4 t0 = (Float4::load(node.boundsMin) - ray.origin) * ray.invDirection;
+		Float4 t1 = (Float4::load(node.boundsMax) - ray.origin) * ray.invDirection;
+		float tNear = Float4::selectXyz(min(t0, t1), ray.tMin).hmax();
+		float tFar = Float4::selectXyz(max(t0, t1), Float4::splat(tMax)).hmin();
+		return tNear <= tFar ? tNear : std::numeric_limits<float>::infinity();
+	}
+
+	double millisecondsSince(std::chrono::high_resolution_clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	// runs func(begin, end) on threadCount threads over [0, count)
+	template<class Func>
+	void parallelFor(uint32_t count, uint32_t threadCount, Func func) {
+		threadCount = std::max(1u, std::min(threadCount, count / 1024 + 1));
+		if (threadCount == 1) {
+			func(0u, count);
+			return;
+		}
+		std::vector<std::thread> threads;
+		threads.reserve(threadCount - 1);
+		uint32_t chunk = (count + threadCount - 1) / threadCount;
+		for (uint32_t i = 1; i < threadCount; i++) {
+			uint32_t begin = std::min(count, i * chunk);
+			uint32_t end = std::min(count, begin + chunk);
+			threads.emplace_back(func, begin, end);
+		}
+		func(0u, std::min(count, chunk));
+		for (std::thread& thread : threads)
+			thread.join();
+	}
+}
+
+namespace vk
+{
+	CpuBvh::CpuBvh() {}
+
+	CpuBvh::~CpuBvh() {}
+
+	void CpuBvh::setBinCount(uint32_t binCount) {
+		if (binCount < 2) {
+			std::cerr << "ERROR: CpuBvh needs at least 2 bins, got " << binCount << "\n";
+			throw std::runtime_error("CpuBvh needs at least 2 bins");
+		}
+		m_binCount = binCount;
+	}
+
+	uint32_t CpuBvh::getThreadCount() const {
+		if (m_threadCount > 0) return m_threadCount;
+		return std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	void CpuBvh::build(const float* pVertices, uint32_t vertexCount, uint32_t vertexStride, const uint32_t* pIndices, uint32_t indexCount) {
+		if (indexCount == 0 || indexCount % 3 != 0) {
+			std::cerr << "ERROR: CpuBvh index count has to be a non zero multiple of 3, got " << indexCount << "\n";
+			throw std::runtime_error("CpuBvh index count has to be a non zero multiple of 3");
+		}
+		if (vertexStride < 3 * sizeof(float) || vertexStride % sizeof(float) != 0) {
+			std::cerr << "ERROR: CpuBvh vertex stride " << vertexStride << " doesn't fit R32G32B32_SFLOAT positions\n";
+			throw std::runtime_error("CpuBvh vertex stride doesn't fit R32G32B32_SFLOAT positions");
+		}
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		uint32_t primitiveCount = indexCount / 3;
+		uint32_t threadCount = getThreadCount();
+		const char* pVertexBytes = reinterpret_cast<const char*>(pVertices);
+
+		m_triangles.resize(primitiveCount);
+		m_primitiveBounds.resize(size_t(primitiveCount) * 8);
+		m_centroids.resize(size_t(primitiveCount) * 4);
+		m_primitiveIndices.resize(primitiveCount);
+
+		std::atomic<bool> isIndexOutOfRange{ false };
+		parallelFor(primitiveCount, threadCount, [&](uint32_t begin, uint32_t end) {
+			const Float4 half = Float4::splat(0.5f);
+			for (uint32_t i = begin; i < end; i++) {
+				Triangle& triangle = m_triangles[i];
+				float* vertices[3] = { triangle.v0, triangle.v1, triangle.v2 };
+				for (uint32_t j = 0; j < 3; j++) {
+					uint32_t index = pIndices[i * 3 + j];
+					if (index >= vertexCount) {
+						isIndexOutOfRange = true;
+						index = 0;
+					}
+					const float* pPosition = reinterpret_cast<const float*>(pVertexBytes + size_t(index) * vertexStride);
+					vertices[j][0] = pPosition[0];
+					vertices[j][1] = pPosition[1];
+					vertices[j][2] = pPosition[2];
+					vertices[j][3] = 0.0f;
+				}
+				Float4 v0 = Float4::load(triangle.v0), v1 = Float4::load(triangle.v1), v2 = Float4::load(triangle.v2);
+				Float4 boundsMin = min(min(v0, v1), v2);
+				Float4 boundsMax = max(max(v0, v1), v2);
+				boundsMin.store(&m_primitiveBounds[size_t(i) * 8]);
+				boundsMax.store(&m_primitiveBounds[size_t(i) * 8 + 4]);
+				((boundsMin + boundsMax) * half).store(&m_centroids[size_t(i) * 4]);
+				m_primitiveIndices[i] = i;
+			}
+			});
+		if (isIndexOutOfRange) {
+			std::cerr << "ERROR: CpuBvh index out of range of the " << vertexCount << " vertices\n";
+			throw std::runtime_error("CpuBvh index out of range");
+		}
+
+		// a binary tree over n primitives has at most 2n - 1 nodes
+		m_nodes.resize(size_t(primitiveCount) * 2);
+		m_nodeCount = 1;
+		m_leafCount = 0;
+		m_maxDepth = 0;
+		m_activeTasks = 1;
+		buildNode(0, 0, primitiveCount, 1);
+		m_nodes.resize(m_nodeCount);
+		m_nodes.shrink_to_fit();
+
+		m_buildStats.buildMilliseconds = millisecondsSince(start);
+		m_buildStats.nodeCount = m_nodeCount;
+		m_buildStats.leafCount = m_leafCount;
+		m_buildStats.maxDepth = m_maxDepth;
+		m_buildStats.sahCost = computeSahCost();
+	}
+
+	void CpuBvh::buildNode(uint32_t nodeIndex, uint32_t first, uint32_t count, uint32_t depth) {
+		uint32_t currentDepth = m_maxDepth.load(std::memory_order_relaxed);
+		while (depth > currentDepth && !m_maxDepth.compare_exchange_weak(currentDepth, depth, std::memory_order_relaxed));
+
+		// node and centroid bounds in one pass
+		Float4 boundsMin = Float4::splat(std::numeric_limits<float>::max());
+		Float4 boundsMax = Float4::splat(-std::numeric_limits<float>::max());
+		Float4 centroidMin = boundsMin;
+		Float4 centroidMax = boundsMax;
+		for (uint32_t i = first; i < first + count; i++) {
+			uint32_t primitive = m_primitiveIndices[i];
+			boundsMin = min(boundsMin, Float4::load(&m_primitiveBounds[size_t(primitive) * 8]));
+			boundsMax = max(boundsMax, Float4::load(&m_primitiveBounds[size_t(primitive) * 8 + 4]));
+			Float4 centroid = Float4::load(&m_centroids[size_t(primitive) * 4]);
+			centroidMin = min(centroidMin, centroid);
+			centroidMax = max(centroidMax, centroid);
+		}
+
+		Node& node = m_nodes[nodeIndex];
+		float bounds[4];
+		boundsMin.store(bounds);
+		std::copy(bounds, bounds + 3, node.boundsMin);
+		boundsMax.store(bounds);
+		std::copy(bounds, bounds + 3, node.boundsMax);
+		float centroidBounds[8];
+		centroidMin.store(centroidBounds);
+		centroidMax.store(centroidBounds + 4);
+
+		uint32_t split = 0;
+		if (count > 1) {
+			if (m_splitMethod == eSPLIT_METHOD_SAH)
+				split = splitSah(node, first, count, centroidBounds, centroidBounds + 4);
+			else if (count > m_maxLeafSize)
+				split = splitMedian(first, count, centroidBounds, centroidBounds + 4);
+		}
+
+		if (split == 0) {
+			node.leftFirst = first;
+			node.primitiveCount = count;
+			m_leafCount.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		uint32_t left = m_nodeCount.fetch_add(2);
+		node.leftFirst = left;
+		node.primitiveCount = 0;
+
+		uint32_t leftCount = split - first;
+		uint32_t rightCount = count - leftCount;
+		if (std::min(leftCount, rightCount) >= parallelBuildThreshold && m_activeTasks.load() < getThreadCount()) {
+			m_activeTasks.fetch_add(1);
+			std::thread task([this, left, first, leftCount, depth]() {
+				buildNode(left, first, leftCount, depth + 1);
+				m_activeTasks.fetch_sub(1);
+				});
+			buildNode(left + 1, split, rightCount, depth + 1);
+			task.join();
+		}
+		else {
+			buildNode(left, first, leftCount, depth + 1);
+			buildNode(left + 1, split, rightCount, depth + 1);
+		}
+	}
+
+	uint32_t CpuBvh::splitSah(Node& node, uint32_t first, uint32_t count, const float centroidMin[4], const float centroidMax[4]) {
+		std::vector<Bin> bins(size_t(m_binCount) * 3);
+		float scale[3];
+		for (int axis = 0; axis < 3; axis++) {
+			float extent = centroidMax[axis] - centroidMin[axis];
+			scale[axis] = extent > 0.0f ? m_binCount / extent : 0.0f;
+		}
+
+		// bin all three axes in one pass over the primitives
+		for (uint32_t i = first; i < first + count; i++) {
+			uint32_t primitive = m_primitiveIndices[i];
+			const float* pCentroid = &m_centroids[size_t(primitive) * 4];
+			Float4 primitiveMin = Float4::load(&m_primitiveBounds[size_t(primitive) * 8]);
+			Float4 primitiveMax = Float4::load(&m_primitiveBounds[size_t(primitive) * 8 + 4]);
+			for (int axis = 0; axis < 3; axis++) {
+				uint32_t binIndex = std::min(m_binCount - 1, uint32_t((pCentroid[axis] - centroidMin[axis]) * scale[axis]));
+				Bin& bin = bins[axis * m_binCount + binIndex];
+				bin.boundsMin = min(bin.boundsMin, primitiveMin);
+				bin.boundsMax = max(bin.boundsMax, primitiveMax);
+				bin.count++;
+			}
+		}
+
+		// sweep from the right to get the cost of every right side, then from the left to evaluate each plane
+		float bestCost = std::numeric_limits<float>::max();
+		int bestAxis = -1;
+		uint32_t bestPlane = 0;
+		std::vector<float> rightArea(m_binCount);
+		std::vector<uint32_t> rightCount(m_binCount);
+		for (int axis = 0; axis < 3; axis++) {
+			if (scale[axis] == 0.0f) continue;
+			const Bin* pBins = &bins[axis * m_binCount];
+
+			Bin accumulated;
+			float bounds[8];
+			for (uint32_t b = m_binCount - 1; b > 0; b--) {
+				accumulated.boundsMin = min(accumulated.boundsMin, pBins[b].boundsMin);
+				accumulated.boundsMax = max(accumulated.boundsMax, pBins[b].boundsMax);
+				accumulated.count += pBins[b].count;
+				accumulated.boundsMin.store(bounds);
+				accumulated.boundsMax.store(bounds + 4);
+				rightCount[b] = accumulated.count;
+				rightArea[b] = accumulated.count > 0 ? surfaceArea(bounds, bounds + 4) : 0.0f;
+			}
+
+			accumulated = Bin();
+			for (uint32_t plane = 1; plane < m_binCount; plane++) {
+				accumulated.boundsMin = min(accumulated.boundsMin, pBins[plane - 1].boundsMin);
+				accumulated.boundsMax = max(accumulated.boundsMax, pBins[plane - 1].boundsMax);
+				accumulated.count += pBins[plane - 1].count;
+				if (accumulated.count == 0 || rightCount[plane] == 0) continue;
+				accumulated.boundsMin.store(bounds);
+				accumulated.boundsMax.store(bounds + 4);
+				float cost = accumulated.count * surfaceArea(bounds, bounds + 4) + rightCount[plane] * rightArea[plane];
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestPlane = plane;
+				}
+			}
+		}
+
+		float nodeArea = surfaceArea(node.boundsMin, node.boundsMax);
+		float leafCost = count * m_intersectionCost;
+		float splitCost = m_traversalCost + (nodeArea > 0.0f ? bestCost / nodeArea : 0.0f) * m_intersectionCost;
+
+		if (bestAxis < 0) {
+			// every centroid is at the same spot, binning can't separate them
+			if (count <= m_maxLeafSize) return 0;
+			return first + count / 2;
+		}
+		if (splitCost >= leafCost && count <= m_maxLeafSize) return 0;
+
+		float axisMin = centroidMin[bestAxis];
+		float axisScale = scale[bestAxis];
+		uint32_t binCount = m_binCount;
+		auto it = std::partition(m_primitiveIndices.begin() + first, m_primitiveIndices.begin() + first + count, [&](uint32_t primitive) {
+			float centroid = m_centroids[size_t(primitive) * 4 + bestAxis];
+			return std::min(binCount - 1, uint32_t((centroid - axisMin) * axisScale)) < bestPlane;
+			});
+		return uint32_t(it - m_primitiveIndices.begin());
+	}
+
+	uint32_t CpuBvh::splitMedian(uint32_t first, uint32_t count, const float centroidMin[4], const float centroidMax[4]) {
+		int axis = 0;
+		for (int i = 1; i < 3; i++)
+			if (centroidMax[i] - centroidMin[i] > centroidMax[axis] - centroidMin[axis]) axis = i;
+
+		uint32_t split = first + count / 2;
+		std::nth_element(m_primitiveIndices.begin() + first, m_primitiveIndices.begin() + split, m_primitiveIndices.begin() + first + count, [&](uint32_t a, uint32_t b) {
+			return m_centroids[size_t(a) * 4 + axis] < m_centroids[size_t(b) * 4 + axis];
+			});
+		return split;
+	}
+
+	float CpuBvh::computeSahCost() const {
+		if (m_nodes.empty()) return 0.0f;
+		float rootArea = surfaceArea(m_nodes[0].boundsMin, m_nodes[0].boundsMax);
+		if (rootArea <= 0.0f) return 0.0f;
+
+		double cost = 0.0;
+		for (const Node& node : m_nodes) {
+			float area = surfaceArea(node.boundsMin, node.boundsMax) / rootArea;
+			if (node.isLeaf())
+				cost += double(area) * node.primitiveCount * m_intersectionCost;
+			else
+				cost += double(area) * m_traversalCost;
+		}
+		return float(cost);
+	}
+
+	bool CpuBvh::intersectTriangle(const Ray& ray, uint32_t primitiveIndex, Hit& hit) const {
+		// Moeller-Trumbore
+		const Triangle& triangle = m_triangles[primitiveIndex];
+		float e1[3], e2[3], p[3], s[3], q[3];
+		for (int i = 0; i < 3; i++) {
+			e1[i] = triangle.v1[i] - triangle.v0[i];
+			e2[i] = triangle.v2[i] - triangle.v0[i];
+			s[i] = ray.origin[i] - triangle.v0[i];
+		}
+		p[0] = ray.direction[1] * e2[2] - ray.direction[2] * e2[1];
+		p[1] = ray.direction[2] * e2[0] - ray.direction[0] * e2[2];
+		p[2] = ray.direction[0] * e2[1] - ray.direction[1] * e2[0];
+		float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+		if (std::fabs(det) < 1e-12f) return false;
+		float invDet = 1.0f / det;
+
+		float u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * invDet;
+		if (u < 0.0f || u > 1.0f) return false;
+
+		q[0] = s[1] * e1[2] - s[2] * e1[1];
+		q[1] = s[2] * e1[0] - s[0] * e1[2];
+		q[2] = s[0] * e1[1] - s[1] * e1[0];
+		float v = (ray.direction[0] * q[0] + ray.direction[1] * q[1] + ray.direction[2] * q[2]) * invDet;
+		if (v < 0.0f || u + v > 1.0f) return false;
+
+		float t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * invDet;
+		if (t < ray.tMin || t >= hit.t) return false;
+
+		hit.t = t;
+		hit.u = u;
+		hit.v = v;
+		hit.primitiveIndex = primitiveIndex;
+		return true;
+	}
+
+	bool CpuBvh::intersect(const Ray& ray, Hit& hit) const {
+		hit.t = ray.tMax;
+		hit.u = 0.0f;
+		hit.v = 0.0f;
+		hit.primitiveIndex = UINT32_MAX;
+		if (m_nodes.empty()) return false;
+
+		RayData rayData = prepareRay(ray);
+		if (intersectNode(m_nodes[0], rayData, hit.t) == std::numeric_limits<float>::infinity()) return false;
+
+		TraversalStack stack;
+		const Node* pNode = &m_nodes[0];
+		while (true) {
+			if (pNode->isLeaf()) {
+				for (uint32_t i = 0; i < pNode->primitiveCount; i++)
+					intersectTriangle(ray, m_primitiveIndices[pNode->leftFirst + i], hit);
+			}
+			else {
+				// visit the nearer child first and skip children behind the current hit
+				const Node* pLeft = &m_nodes[pNode->leftFirst];
+				const Node* pRight = pLeft + 1;
+				float tLeft = intersectNode(*pLeft, rayData, hit.t);
+				float tRight = intersectNode(*pRight, rayData, hit.t);
+				if (tLeft > tRight) {
+					std::swap(tLeft, tRight);
+					std::swap(pLeft, pRight);
+				}
+				if (tLeft != std::numeric_limits<float>::infinity()) {
+					if (tRight != std::numeric_limits<float>::infinity())
+						stack.push(uint32_t(pRight - m_nodes.data()));
+					pNode = pLeft;
+					continue;
+				}
+			}
+
+			// pop until a node is still in front of the closest hit
+			pNode = nullptr;
+			while (stack.size > 0) {
+				const Node* pCandidate = &m_nodes[stack.pop()];
+				if (intersectNode(*pCandidate, rayData, hit.t) != std::numeric_limits<float>::infinity()) {
+					pNode = pCandidate;
+					break;
+				}
+			}
+			if (!pNode) break;
+		}
+		return hit.primitiveIndex != UINT32_MAX;
+	}
+
+	bool CpuBvh::occluded(const Ray& ray) const {
+		if (m_nodes.empty()) return false;
+
+		RayData rayData = prepareRay(ray);
+		Hit hit = { ray.tMax, 0.0f, 0.0f, UINT32_MAX };
+		TraversalStack stack;
+		stack.push(0);
+		while (stack.size > 0) {
+			const Node& node = m_nodes[stack.pop()];
+			if (intersectNode(node, rayData, ray.tMax) == std::numeric_limits<float>::infinity()) continue;
+			if (node.isLeaf()) {
+				for (uint32_t i = 0; i < node.primitiveCount; i++)
+					if (intersectTriangle(ray, m_primitiveIndices[node.leftFirst + i], hit)) return true;
+			}
+			else {
+				stack.push(node.leftFirst + 1);
+				stack.push(node.leftFirst);
+			}
+		}
+		return false;
+	}
+
+	double CpuBvh::intersect(const Ray* pRays, Hit* pHits, uint32_t rayCount) const {
+		auto start = std::chrono::high_resolution_clock::now();
+		parallelFor(rayCount, getThreadCount(), [&](uint32_t begin, uint32_t end) {
+			for (uint32_t i = begin; i < end; i++)
+				intersect(pRays[i], pHits[i]);
+			});
+		double seconds = millisecondsSince(start) / 1000.0;
+		return seconds > 0.0 ? rayCount / seconds : 0.0;
+	}
+
+	void CpuBvh::compareBuilders(const float* pVertices, uint32_t vertexCount, uint32_t vertexStride, const uint32_t* pIndices, uint32_t indexCount, uint32_t rayCount) {
+		struct Config {
+			SplitMethod splitMethod;
+			uint32_t binCount;
+			uint32_t threadCount;
+		};
+		uint32_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+		const Config configs[] = {
+			{ eSPLIT_METHOD_MEDIAN, 0, hardwareThreads },
+			{ eSPLIT_METHOD_SAH, 8, hardwareThreads },
+			{ eSPLIT_METHOD_SAH, 16, 1 },
+			{ eSPLIT_METHOD_SAH, 16, hardwareThreads },
+			{ eSPLIT_METHOD_SAH, 32, hardwareThreads },
+		};
+
+		std::vector<Ray> rays;
+		std::vector<Hit> hits(rayCount);
+		std::cout << "CpuBvh comparison, " << indexCount / 3 << " triangles, " << rayCount << " rays\n";
+		std::cout << std::left
+			<< std::setw(8) << "split" << std::setw(6) << "bins" << std::setw(9) << "threads"
+			<< std::setw(12) << "build ms" << std::setw(10) << "nodes" << std::setw(10) << "leaves"
+			<< std::setw(7) << "depth" << std::setw(10) << "SAH" << "Mrays/s\n";
+
+		for (const Config& config : configs) {
+			CpuBvh bvh;
+			bvh.setSplitMethod(config.splitMethod);
+			if (config.binCount > 0) bvh.setBinCount(config.binCount);
+			bvh.setThreadCount(config.threadCount);
+			bvh.build(pVertices, vertexCount, vertexStride, pIndices, indexCount);
+
+			if (rays.empty() && rayCount > 0) {
+				// random rays from inside the slightly enlarged scene bounds, same set for every config
+				const Node& root = bvh.getNodes()[0];
+				std::mt19937 rng(1337);
+				std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+				std::normal_distribution<float> normal(0.0f, 1.0f);
+				rays.resize(rayCount);
+				for (Ray& ray : rays) {
+					for (int i = 0; i < 3; i++) {
+						float extent = root.boundsMax[i] - root.boundsMin[i];
+						ray.origin[i] = root.boundsMin[i] - 0.1f * extent + unit(rng) * 1.2f * extent;
+						ray.direction[i] = normal(rng);
+					}
+					ray.tMin = 0.0f;
+					ray.tMax = std::numeric_limits<float>::max();
+				}
+			}
+			double raysPerSecond = rayCount > 0 ? bvh.intersect(rays.data(), hits.data(), rayCount) : 0.0;
+
+			const BuildStats& stats = bvh.getBuildStats();
+			std::cout << std::left
+				<< std::setw(8) << (config.splitMethod == eSPLIT_METHOD_SAH ? "SAH" : "median")
+				<< std::setw(6) << config.binCount << std::setw(9) << config.threadCount
+				<< std::setw(12) << std::fixed << std::setprecision(2) << stats.buildMilliseconds
+				<< std::setw(10) << stats.nodeCount << std::setw(10) << stats.leafCount
+				<< std::setw(7) << stats.maxDepth << std::setw(10) << stats.sahCost
+				<< raysPerSecond / 1e6 << "\n";
+		}
+		std::cout << std::defaultfloat;
+	}
+}
@@ -2,6 +2,26 @@
 
 #include "VulkanUtils.h"
 
+#include <sys/stat.h>
+#include <cstdio>
+#include <cmath>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VK_FRAMEWORK_SSE
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define VK_FRAMEWORK_AVX2
+#endif
+#elif (defined(__ARM_NEON) && defined(__aarch64__)) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define VK_FRAMEWORK_NEON
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
 template <class integral>
 integral align_up(integral x, size_t a) {
 	return integral((x + (integral(a) - 1)) & ~integral(a - 1));
@@ -15,6 +35,33 @@ PFN_vkGetAccelerationStructureBuildSizesKHR vkGetAccelerationStructureBuildSizes
 PFN_vkCmdBuildAccelerationStructuresKHR vkCmdBuildAccelerationStructuresKHR_ = nullptr;
 PFN_vkGetAccelerationStructureDeviceAddressKHR vkGetAccelerationStructureDeviceAddressKHR_ = nullptr;
 PFN_vkDestroyAccelerationStructureKHR vkDestroyAccelerationStructureKHR_ = nullptr;
+PFN_vkCreateShadersEXT vkCreateShadersEXT_ = nullptr;
+PFN_vkDestroyShaderEXT vkDestroyShaderEXT_ = nullptr;
+PFN_vkCmdBindShadersEXT vkCmdBindShadersEXT_ = nullptr;
+PFN_vkCmdSetPolygonModeEXT vkCmdSetPolygonModeEXT_ = nullptr;
+PFN_vkCmdSetRasterizationSamplesEXT vkCmdSetRasterizationSamplesEXT_ = nullptr;
+PFN_vkCmdSetSampleMaskEXT vkCmdSetSampleMaskEXT_ = nullptr;
+PFN_vkCmdSetAlphaToCoverageEnableEXT vkCmdSetAlphaToCoverageEnableEXT_ = nullptr;
+PFN_vkCmdSetColorBlendEnableEXT vkCmdSetColorBlendEnableEXT_ = nullptr;
+PFN_vkCmdSetColorBlendEquationEXT vkCmdSetColorBlendEquationEXT_ = nullptr;
+PFN_vkCmdSetColorWriteMaskEXT vkCmdSetColorWriteMaskEXT_ = nullptr;
+PFN_vkCmdSetVertexInputEXT vkCmdSetVertexInputEXT_ = nullptr;
+PFN_vkCmdSetDepthClampEnableEXT vkCmdSetDepthClampEnableEXT_ = nullptr;
+PFN_vkCmdSetLogicOpEnableEXT vkCmdSetLogicOpEnableEXT_ = nullptr;
+PFN_vkCmdSetPatchControlPointsEXT vkCmdSetPatchControlPointsEXT_ = nullptr;
+PFN_vkCmdSetTessellationDomainOriginEXT vkCmdSetTessellationDomainOriginEXT_ = nullptr;
+PFN_vkCmdPushDescriptorSetKHR vkCmdPushDescriptorSetKHR_ = nullptr;
+PFN_vkCmdPushDescriptorSetWithTemplateKHR vkCmdPushDescriptorSetWithTemplateKHR_ = nullptr;
+PFN_vkGetDescriptorSetLayoutSizeEXT vkGetDescriptorSetLayoutSizeEXT_ = nullptr;
+PFN_vkGetDescriptorSetLayoutBindingOffsetEXT vkGetDescriptorSetLayoutBindingOffsetEXT_ = nullptr;
+PFN_vkGetDescriptorEXT vkGetDescriptorEXT_ = nullptr;
+PFN_vkCmdBindDescriptorBuffersEXT vkCmdBindDescriptorBuffersEXT_ = nullptr;
+PFN_vkCmdSetDescriptorBufferOffsetsEXT vkCmdSetDescriptorBufferOffsetsEXT_ = nullptr;
+PFN_vkCmdWriteAccelerationStructuresPropertiesKHR vkCmdWriteAccelerationStructuresPropertiesKHR_ = nullptr;
+PFN_vkCmdCopyAccelerationStructureKHR vkCmdCopyAccelerationStructureKHR_ = nullptr;
+PFN_vkCmdCopyAccelerationStructureToMemoryKHR vkCmdCopyAccelerationStructureToMemoryKHR_ = nullptr;
+PFN_vkCmdCopyMemoryToAccelerationStructureKHR vkCmdCopyMemoryToAccelerationStructureKHR_ = nullptr;
+PFN_vkGetDeviceAccelerationStructureCompatibilityKHR vkGetDeviceAccelerationStructureCompatibilityKHR_ = nullptr;
 
 namespace vk
 {
@@ -25,6 +72,13 @@ namespace vk
 	VkDevice device;
 	size_t queueFamily;
 	std::vector<VkQueue> queues;
+	VkQueue asyncComputeQueue = VK_NULL_HANDLE;
+	bool hasAsyncComputeQueue = false; // an extra queue was created after the queues of the queue handler
+
+	// features the device was created with, shader objects have to set the state some of them add
+	VkPhysicalDeviceFeatures enabledFeatures = {};
+	bool isTaskShaderEnabled = false;
+	bool isMeshShaderEnabled = false;
 
 	VkCommandPool commandPool;
 
@@ -72,6 +126,12 @@ namespace vk
 		vk::queues.resize(queueCreateCount);
 		deviceQueueCreateInfo.queueCount = queueCreateCount;
 
+		// one more queue of the same family for async work, a different family would need ownership transfers of every shared buffer
+		if (queueCount > queueCreateCount) {
+			deviceQueueCreateInfo.queueCount = queueCreateCount + 1;
+			vk::hasAsyncComputeQueue = true;
+		}
+
 		std::vector<float> prios(queueCount);
 		for (size_t i = 0; i < prios.size(); i++)
 			prios[i] = 1.0f;
@@ -91,6 +151,15 @@ namespace vk
 
 		VkResult result = vkCreateDevice(physicalDevice, &deviceCreateInfo, nullptr, &device);
 		VK_ASSERT(result);
+
+		vk::enabledFeatures = usedFeatures.features;
+		for (const VkBaseInStructure* pNext = (const VkBaseInStructure*)usedFeatures.pNext; pNext; pNext = pNext->pNext) {
+			if (pNext->sType == VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT) {
+				const VkPhysicalDeviceMeshShaderFeaturesEXT* pMeshShaderFeatures = (const VkPhysicalDeviceMeshShaderFeaturesEXT*)pNext;
+				vk::isTaskShaderEnabled = pMeshShaderFeatures->taskShader;
+				vk::isMeshShaderEnabled = pMeshShaderFeatures->meshShader;
+			}
+		}
 	}
 
 	void createSemaphore(VkSemaphore *semaphore)
@@ -98,6 +167,16 @@ namespace vk
 		VkSemaphoreCreateInfo createInfo{VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO, nullptr, 0};
 		vkCreateSemaphore(vk::device, &createInfo, nullptr, semaphore);
 	}
+	void createTimelineSemaphore(VkSemaphore* semaphore, uint64_t initialValue)
+	{
+		VkSemaphoreTypeCreateInfo typeCreateInfo{ VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO };
+		typeCreateInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+		typeCreateInfo.initialValue = initialValue;
+
+		VkSemaphoreCreateInfo createInfo{ VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO, &typeCreateInfo, 0 };
+		VkResult result = vkCreateSemaphore(vk::device, &createInfo, nullptr, semaphore);
+		VK_ASSERT(result);
+	}
 	void destroySemaphore(VkSemaphore semaphore)
 	{
 		vkDestroySemaphore(vk::device, semaphore, nullptr);
@@ -363,6 +442,11 @@ namespace vk
 		return physicalDevices;
 	}
 
+	// descriptor helpers, defined with DescriptorSet
+	static size_t getDescriptorInfoStride(VkDescriptorType type);
+	static void packDescriptorInfos(const Descriptor& descriptor, uint32_t firstElement, uint32_t endElement, uint8_t* pInfos);
+	static void setDescriptorWriteInfos(VkWriteDescriptorSet& write, const Descriptor& descriptor, uint8_t* pInfos, uint32_t firstElement, VkWriteDescriptorSetAccelerationStructureKHR* pAccelerationStructureWrite);
+
 	/* CommandBuffer */
 	CommandBuffer::CommandBuffer(){}
 
@@ -435,9 +519,23 @@ namespace vk
 		vkQueueSubmit(*queue, 1, &submitInfo, fence);
 	}
 	void CommandBuffer::submit(VkQueue* queue, VkFence fence) {
+		*queue = vkUtils::queueHandler::getQueue();
+		submitTo(*queue, fence);
+	}
+	void CommandBuffer::submitTo(VkQueue queue, VkFence fence) {
+		// values of binary semaphores are ignored, so one timeline info covers mixed lists
+		VkTimelineSemaphoreSubmitInfo timelineSubmitInfo{ VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO };
+		timelineSubmitInfo.waitSemaphoreValueCount = m_waitValues.size();
+		timelineSubmitInfo.pWaitSemaphoreValues = m_waitValues.data();
+		timelineSubmitInfo.signalSemaphoreValueCount = m_signalValues.size();
+		timelineSubmitInfo.pSignalSemaphoreValues = m_signalValues.data();
+		bool hasTimelineValues =
+			std::any_of(m_waitValues.begin(), m_waitValues.end(), [](uint64_t value) { return value != 0; }) ||
+			std::any_of(m_signalValues.begin(), m_signalValues.end(), [](uint64_t value) { return value != 0; });
+
 		VkSubmitInfo submitInfo;
 		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		submitInfo.pNext = nullptr;
+		submitInfo.pNext = hasTimelineValues ? &timelineSubmitInfo : nullptr;
 		submitInfo.waitSemaphoreCount = m_waitSemaphores.size();
 		submitInfo.pWaitSemaphores = m_waitSemaphores.data();
 		submitInfo.pWaitDstStageMask = m_waitDstStageMasks.data();
@@ -446,8 +544,7 @@ namespace vk
 		submitInfo.signalSemaphoreCount = m_signalSemaphores.size();
 		submitInfo.pSignalSemaphores = m_signalSemaphores.data();
 
-		*queue = vkUtils::queueHandler::getQueue();
-		VkResult result = vkQueueSubmit(*queue, 1, &submitInfo, fence);
+		VkResult result = vkQueueSubmit(queue, 1, &submitInfo, fence);
 		VK_ASSERT(result);
 	}
 	void CommandBuffer::submit(VkFence fence) {
@@ -468,13 +565,60 @@ namespace vk
 		vk::waitForFence(fence); vk::destroyFence(fence);
 	}
 
+	void CommandBuffer::pushDescriptors(VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint32_t set, const Descriptor* pDescriptors, uint32_t descriptorCount) {
+		size_t scratchSize = 0;
+		for (uint32_t i = 0; i < descriptorCount; i++)
+			scratchSize += getDescriptorInfoStride(pDescriptors[i].type) * pDescriptors[i].count;
+		m_pushScratch.resize(scratchSize);
+		m_pushWrites.clear();
+		m_pushAccelerationStructureWrites.clear();
+		m_pushAccelerationStructureWrites.reserve(descriptorCount); // writes point into it
+
+		size_t offset = 0;
+		for (uint32_t i = 0; i < descriptorCount; i++) {
+			const Descriptor& descriptor = pDescriptors[i];
+			uint8_t* pInfos = m_pushScratch.data() + offset;
+			offset += getDescriptorInfoStride(descriptor.type) * descriptor.count;
+			if (descriptor.count == 0)
+				continue;
+
+			packDescriptorInfos(descriptor, 0, descriptor.count, pInfos);
+
+			VkWriteDescriptorSet write{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+			write.pNext = descriptor.pNext;
+			write.dstSet = VK_NULL_HANDLE; // ignored for push descriptors
+			write.dstBinding = descriptor.binding;
+			write.dstArrayElement = 0;
+			write.descriptorCount = descriptor.count;
+			write.descriptorType = descriptor.type;
+			if (descriptor.type == VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR)
+				m_pushAccelerationStructureWrites.emplace_back();
+			setDescriptorWriteInfos(write, descriptor, pInfos, 0, descriptor.type == VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR ? &m_pushAccelerationStructureWrites.back() : nullptr);
+			m_pushWrites.push_back(write);
+		}
+
+		if (m_pushWrites.size() > 0)
+			vkCmdPushDescriptorSetKHR(m_commandBuffer, bindPoint, layout, set, m_pushWrites.size(), m_pushWrites.data());
+	}
+	void CommandBuffer::pushDescriptors(VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint32_t set, const std::vector<Descriptor>& descriptors) {
+		pushDescriptors(bindPoint, layout, set, descriptors.data(), descriptors.size());
+	}
+	void CommandBuffer::pushDescriptors(VkDescriptorUpdateTemplate updateTemplate, VkPipelineLayout layout, uint32_t set, const void* pData) {
+		vkCmdPushDescriptorSetWithTemplateKHR(m_commandBuffer, updateTemplate, layout, set, pData);
+	}
+
 	void CommandBuffer::addWaitSemaphore(VkSemaphore waitSemaphore, VkPipelineStageFlags waitDstStageMask) {
+		addWaitSemaphore(waitSemaphore, waitDstStageMask, 0);
+	}
+	void CommandBuffer::addWaitSemaphore(VkSemaphore waitSemaphore, VkPipelineStageFlags waitDstStageMask, uint64_t value) {
 		m_waitSemaphores.push_back(waitSemaphore);
 		m_waitDstStageMasks.push_back(waitDstStageMask);
+		m_waitValues.push_back(value);
 	}
 	void CommandBuffer::delWaitSemaphore(int index) {
 		m_waitSemaphores.erase(m_waitSemaphores.begin() + index);
 		m_waitDstStageMasks.erase(m_waitDstStageMasks.begin() + index);
+		m_waitValues.erase(m_waitValues.begin() + index);
 	}
 
 	/* Buffer */
@@ -743,6 +887,76 @@ namespace vk
 		commandBuffer.free();
 	}
 
+	/* UniformAllocator */
+	UniformAllocator::UniformAllocator() {}
+	UniformAllocator::~UniformAllocator() {}
+
+	void UniformAllocator::init() {
+		if (m_isInit)
+			return;
+		m_isInit = true;
+
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		m_alignment = properties.limits.minUniformBufferOffsetAlignment;
+		m_frameSize = align_up(m_frameSize, m_alignment);
+
+		m_buffer.setSize(m_frameSize * m_frameCount);
+		m_buffer.setUsage(m_usage);
+		m_buffer.init();
+		m_buffer.allocate(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+		m_buffer.map((void**)&m_pMappedData);
+		if (VK_IS_FLAG_ENABLED(m_usage, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT))
+			m_deviceAddress = m_buffer.getVkDeviceAddress();
+
+		m_frameFences.assign(m_frameCount, VK_NULL_HANDLE);
+		m_frameIndex = 0;
+		m_offset = 0;
+	}
+
+	void UniformAllocator::destroy() {
+		if (!m_isInit)
+			return;
+		m_isInit = false;
+
+		m_buffer.unmap();
+		m_pMappedData = nullptr;
+		m_deviceAddress = 0;
+		m_buffer.destroy();
+		m_frameFences.clear();
+	}
+
+	UniformAllocator::Allocation UniformAllocator::allocate(VkDeviceSize size) {
+		VkDeviceSize alignedSize = align_up(size, m_alignment);
+		VkDeviceSize offset = m_offset.fetch_add(alignedSize);
+		if (offset + alignedSize > m_frameSize) {
+			std::cerr << "ERROR: UniformAllocator frame is full, increase the frame size | FrameSize: " << m_frameSize << " Requested: " << offset + alignedSize << "\n";
+			throw std::runtime_error("UniformAllocator out of memory");
+		}
+
+		Allocation allocation;
+		allocation.buffer = m_buffer;
+		allocation.offset = m_frameIndex * m_frameSize + offset;
+		allocation.size = size;
+		allocation.pData = m_pMappedData + allocation.offset;
+		allocation.deviceAddress = m_deviceAddress ? m_deviceAddress + allocation.offset : 0;
+		return allocation;
+	}
+
+	void UniformAllocator::nextFrame(VkFence fence) {
+		m_frameFences[m_frameIndex] = fence;
+		m_frameIndex = (m_frameIndex + 1) % m_frameCount;
+
+		VkFence& frameFence = m_frameFences[m_frameIndex];
+		if (frameFence != VK_NULL_HANDLE) {
+			VkResult result = vkWaitForFences(device, 1, &frameFence, VK_TRUE, UINT64_MAX);
+			VK_ASSERT(result)
+			frameFence = VK_NULL_HANDLE;
+		}
+		m_offset = 0;
+	}
+
 	/* Image */
 	Image::Image(){}
 
@@ -1136,7 +1350,220 @@ namespace vk
 		return m_images[index].getVkImageView();
 	}
 
+	/* DescriptorSetLayoutCache */
+	namespace descriptorSetLayoutCache {
+		struct Key {
+			VkDescriptorSetLayoutCreateFlags flags;
+			std::vector<VkDescriptorSetLayoutBinding> bindings; // sorted by binding, pImmutableSamplers is not used
+			std::vector<std::vector<VkSampler>> immutableSamplers; // per binding in the same order, empty without
+
+			bool operator==(const Key& other) const {
+				if (flags != other.flags || bindings.size() != other.bindings.size() || immutableSamplers != other.immutableSamplers)
+					return false;
+				for (uint32_t i = 0; i < bindings.size(); i++) {
+					auto& a = bindings[i];
+					auto& b = other.bindings[i];
+					if (a.binding != b.binding || a.descriptorType != b.descriptorType || a.descriptorCount != b.descriptorCount || a.stageFlags != b.stageFlags)
+						return false;
+				}
+				return true;
+			}
+		};
+
+		struct KeyHash {
+			size_t operator()(const Key& key) const {
+				size_t hash = std::hash<uint32_t>()(key.flags);
+				auto combine = [&hash](size_t value) { hash ^= value + 0x9e3779b9 + (hash << 6) + (hash >> 2); };
+				for (uint32_t i = 0; i < key.bindings.size(); i++) {
+					auto& binding = key.bindings[i];
+					combine(binding.binding);
+					combine(binding.descriptorType);
+					combine(binding.descriptorCount);
+					combine(binding.stageFlags);
+					combine(key.immutableSamplers[i].size());
+					for (VkSampler sampler : key.immutableSamplers[i])
+						combine(std::hash<VkSampler>()(sampler));
+				}
+				return hash;
+			}
+		};
+
+		struct Entry {
+			VkDescriptorSetLayout setLayout;
+			uint32_t refCount;
+		};
+
+		std::mutex mutex;
+		std::unordered_map<Key, Entry, KeyHash> entries;
+		std::unordered_map<VkDescriptorSetLayout, Key> keys;
+		uint32_t referenceCount = 0;
+
+		VkDescriptorSetLayout acquire(const VkDescriptorSetLayoutBinding* pBindings, uint32_t bindingCount, VkDescriptorSetLayoutCreateFlags flags) {
+			Key key;
+			key.flags = flags;
+			key.bindings.assign(pBindings, pBindings + bindingCount);
+			std::sort(key.bindings.begin(), key.bindings.end(),
+				[](const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b) { return a.binding < b.binding; });
+			key.immutableSamplers.resize(key.bindings.size());
+			for (uint32_t i = 0; i < key.bindings.size(); i++) {
+				auto& binding = key.bindings[i];
+				if (binding.pImmutableSamplers)
+					key.immutableSamplers[i].assign(binding.pImmutableSamplers, binding.pImmutableSamplers + binding.descriptorCount);
+				binding.pImmutableSamplers = nullptr;
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+			referenceCount++;
+			auto it = entries.find(key);
+			if (it != entries.end()) {
+				it->second.refCount++;
+				return it->second.setLayout;
+			}
+
+			VkDescriptorSetLayoutCreateInfo createInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+			createInfo.flags = flags;
+			createInfo.bindingCount = bindingCount;
+			createInfo.pBindings = pBindings;
+
+			VkDescriptorSetLayout setLayout;
+			VkResult result = vkCreateDescriptorSetLayout(device, &createInfo, nullptr, &setLayout);
+			VK_ASSERT(result);
+
+			entries[key] = { setLayout, 1 };
+			keys[setLayout] = key;
+			return setLayout;
+		}
+
+		void release(VkDescriptorSetLayout setLayout) {
+			std::lock_guard<std::mutex> lock(mutex);
+			auto keyIt = keys.find(setLayout);
+			if (keyIt == keys.end())
+				return;
+			referenceCount--;
+
+			auto& entry = entries.at(keyIt->second);
+			entry.refCount--;
+			if (entry.refCount > 0)
+				return;
+
+			vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+			entries.erase(keyIt->second);
+			keys.erase(keyIt);
+		}
+
+		uint32_t getLayoutCount() {
+			std::lock_guard<std::mutex> lock(mutex);
+			return entries.size();
+		}
+
+		uint32_t getReferenceCount() {
+			std::lock_guard<std::mutex> lock(mutex);
+			return referenceCount;
+		}
+	}
+
 	/* DescriptorSet */
+	// size of one element in the packed info array of a descriptor
+	static size_t getDescriptorInfoStride(VkDescriptorType type) {
+		switch (type) {
+		case VK_DESCRIPTOR_TYPE_SAMPLER:
+		case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+		case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+		case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+		case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT:
+			return sizeof(VkDescriptorImageInfo);
+		case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER:
+		case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER:
+			return sizeof(VkBufferView);
+		case VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR:
+			return sizeof(VkAccelerationStructureKHR);
+		default:
+			return sizeof(VkDescriptorBufferInfo);
+		}
+	}
+
+	// copies the infos of the given array elements into pInfos, elements are getDescriptorInfoStride apart
+	static void packDescriptorInfos(const Descriptor& descriptor, uint32_t firstElement, uint32_t endElement, uint8_t* pInfos) {
+		switch (descriptor.type) {
+		case VK_DESCRIPTOR_TYPE_SAMPLER:
+		case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+		case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+		case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+		case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT: {
+			VkDescriptorImageInfo* pImageInfos = (VkDescriptorImageInfo*)pInfos;
+			for (uint32_t j = firstElement; j < endElement && j < descriptor.imageInfos.size(); j++) {
+				auto& imageInfo = descriptor.imageInfos[j];
+				pImageInfos[j].sampler = imageInfo.pSampler ? (VkSampler)*imageInfo.pSampler : VK_NULL_HANDLE;
+				pImageInfos[j].imageView = imageInfo.pImage ? imageInfo.pImage->getVkImageView() : VK_NULL_HANDLE;
+				pImageInfos[j].imageLayout = imageInfo.imageLayout;
+			}
+			break;
+		}
+		case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER:
+		case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER: {
+			VkBufferView* pBufferViews = (VkBufferView*)pInfos;
+			for (uint32_t j = firstElement; j < endElement && j < descriptor.texelBufferViews.size(); j++)
+				pBufferViews[j] = descriptor.texelBufferViews[j];
+			break;
+		}
+		case VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR: {
+			auto* pAccelerationStructureWrite = (const VkWriteDescriptorSetAccelerationStructureKHR*)descriptor.pNext;
+			if (!pAccelerationStructureWrite)
+				break;
+			VkAccelerationStructureKHR* pAccelerationStructures = (VkAccelerationStructureKHR*)pInfos;
+			for (uint32_t j = firstElement; j < endElement && j < pAccelerationStructureWrite->accelerationStructureCount; j++)
+				pAccelerationStructures[j] = pAccelerationStructureWrite->pAccelerationStructures[j];
+			break;
+		}
+		default: {
+			VkDescriptorBufferInfo* pBufferInfos = (VkDescriptorBufferInfo*)pInfos;
+			for (uint32_t j = firstElement; j < endElement && j < descriptor.bufferInfos.size(); j++) {
+				auto& bufferInfo = descriptor.bufferInfos[j];
+				pBufferInfos[j].buffer = *bufferInfo.pBuffer;
+				if (pBufferInfos[j].buffer == VK_NULL_HANDLE) {
+					pBufferInfos[j].offset = 0;
+					pBufferInfos[j].range = VK_WHOLE_SIZE;
+				}
+				else {
+					pBufferInfos[j].offset = bufferInfo.offset;
+					pBufferInfos[j].range = bufferInfo.range;
+				}
+			}
+			break;
+		}
+		}
+	}
+
+	// points the write at the packed infos of its array elements, acceleration structures need an extension struct
+	static void setDescriptorWriteInfos(VkWriteDescriptorSet& write, const Descriptor& descriptor, uint8_t* pInfos, uint32_t firstElement, VkWriteDescriptorSetAccelerationStructureKHR* pAccelerationStructureWrite) {
+		write.pImageInfo = nullptr;
+		write.pBufferInfo = nullptr;
+		write.pTexelBufferView = nullptr;
+
+		switch (descriptor.type) {
+		case VK_DESCRIPTOR_TYPE_SAMPLER:
+		case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+		case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+		case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+		case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT:
+			write.pImageInfo = (VkDescriptorImageInfo*)pInfos + firstElement;
+			break;
+		case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER:
+		case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER:
+			write.pTexelBufferView = (VkBufferView*)pInfos + firstElement;
+			break;
+		case VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR:
+			*pAccelerationStructureWrite = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR };
+			pAccelerationStructureWrite->accelerationStructureCount = write.descriptorCount;
+			pAccelerationStructureWrite->pAccelerationStructures = (VkAccelerationStructureKHR*)pInfos + firstElement;
+			write.pNext = pAccelerationStructureWrite;
+			break;
+		default:
+			write.pBufferInfo = (VkDescriptorBufferInfo*)pInfos + firstElement;
+			break;
+		}
+	}
+
 	DescriptorSet::DescriptorSet() {}
 	DescriptorSet::~DescriptorSet() {
 		for (auto descriptor : m_descriptors) {
@@ -1150,13 +1577,8 @@ namespace vk
 			return;
 		m_isInit = true;
 
-		VkDescriptorSetLayoutCreateInfo createInfo;
-		createInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-		createInfo.pNext = nullptr;
-		createInfo.flags = 0;
-		createInfo.bindingCount = m_descriptors.size();
-
-		VkDescriptorSetLayoutBinding* pBindings = new VkDescriptorSetLayoutBinding[createInfo.bindingCount];
+		uint32_t bindingCount = m_descriptors.size();
+		VkDescriptorSetLayoutBinding* pBindings = new VkDescriptorSetLayoutBinding[bindingCount];
 		for (uint32_t i = 0; i < m_descriptors.size(); i++) {
 			VkDescriptorSetLayoutBinding& binding = pBindings[i];
 			auto& descriptor = m_descriptors[i];
@@ -1166,12 +1588,67 @@ namespace vk
 			binding.stageFlags = descriptor.stages;
 			binding.pImmutableSamplers = nullptr;
 		}
-		createInfo.pBindings = pBindings;
 
-		vkCreateDescriptorSetLayout(device, &createInfo, nullptr, &m_descriptorSetLayout);
+		VkDescriptorSetLayoutCreateFlags layoutFlags = 0;
+		if (m_isPushDescriptor)
+			layoutFlags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR;
+		else if (m_pDescriptorBuffer)
+			layoutFlags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_DESCRIPTOR_BUFFER_BIT_EXT;
+		m_descriptorSetLayout = descriptorSetLayoutCache::acquire(pBindings, bindingCount, layoutFlags);
 
 		delete[] pBindings;
 
+		m_bindingOffsets.resize(m_pDescriptorBuffer ? m_descriptors.size() : 0);
+		for (uint32_t i = 0; i < m_bindingOffsets.size(); i++)
+			vkGetDescriptorSetLayoutBindingOffsetEXT(device, m_descriptorSetLayout, m_descriptors[i].binding, &m_bindingOffsets[i]);
+
+		// lay out every descriptor's infos contiguously, the same layout is used by the update template
+		std::vector<VkDescriptorUpdateTemplateEntry>& templateEntries = m_templateEntries;
+		templateEntries.clear();
+		bool isTemplateSupported = true;
+		size_t scratchSize = 0;
+		m_scratchOffsets.resize(m_descriptors.size());
+		m_dirtyRanges.resize(m_descriptors.size());
+		for (uint32_t i = 0; i < m_descriptors.size(); i++) {
+			auto& descriptor = m_descriptors[i];
+			size_t stride = getDescriptorInfoStride(descriptor.type);
+
+			m_scratchOffsets[i] = scratchSize;
+			scratchSize += stride * descriptor.count;
+			m_dirtyRanges[i] = { 0, descriptor.count };
+
+			if (descriptor.pNext && descriptor.type != VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR)
+				isTemplateSupported = false;
+			if (descriptor.count <= 0)
+				continue;
+
+			VkDescriptorUpdateTemplateEntry entry;
+			entry.dstBinding = descriptor.binding;
+			entry.dstArrayElement = 0;
+			entry.descriptorCount = descriptor.count;
+			entry.descriptorType = descriptor.type;
+			entry.offset = m_scratchOffsets[i];
+			entry.stride = stride;
+			templateEntries.push_back(entry);
+		}
+		m_scratch.resize(scratchSize);
+		m_writes.reserve(m_descriptors.size());
+		m_accelerationStructureWrites.reserve(m_descriptors.size()); // never reallocates, writes point into it
+
+		if (!isTemplateSupported)
+			templateEntries.clear(); // push sets fall back to writes as well
+
+		if (!m_isPushDescriptor && !m_pDescriptorBuffer && templateEntries.size() > 0) {
+			VkDescriptorUpdateTemplateCreateInfo templateCreateInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO };
+			templateCreateInfo.descriptorUpdateEntryCount = templateEntries.size();
+			templateCreateInfo.pDescriptorUpdateEntries = templateEntries.data();
+			templateCreateInfo.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET;
+			templateCreateInfo.descriptorSetLayout = m_descriptorSetLayout;
+
+			VkResult result = vkCreateDescriptorUpdateTemplate(device, &templateCreateInfo, nullptr, &m_updateTemplate);
+			VK_ASSERT(result);
+		}
+
 		m_changes = eDESCRIPTORS;
 
 		Registerable::init();
@@ -1182,6 +1659,38 @@ namespace vk
 			return;
 		m_isAlloc = true;
 
+		if (m_isPushDescriptor)
+			return; // push descriptors are recorded into command buffers, there is no set to allocate
+
+		if (m_pDescriptorBuffer) {
+			VkDeviceSize layoutSize;
+			vkGetDescriptorSetLayoutSizeEXT(device, m_descriptorSetLayout, &layoutSize);
+			// a set that fits its previous space reuses it, a larger layout leaves the old space unused until the buffer is reset
+			bool isReusable = m_pOwnedDescriptorBuffer == m_pDescriptorBuffer
+				&& m_descriptorBufferGeneration == m_pDescriptorBuffer->getGeneration()
+				&& layoutSize <= m_descriptorBufferSize;
+			if (!isReusable) {
+				m_descriptorBufferOffset = m_pDescriptorBuffer->allocate(layoutSize);
+				m_pOwnedDescriptorBuffer = m_pDescriptorBuffer;
+				m_descriptorBufferSize = layoutSize;
+				m_descriptorBufferGeneration = m_pDescriptorBuffer->getGeneration();
+			}
+			return;
+		}
+
+		if (m_pDescriptorAllocator) {
+			std::vector<VkDescriptorPoolSize> poolSizes;
+			for (const Descriptor& descriptor : m_descriptors) {
+				auto it = std::find_if(poolSizes.begin(), poolSizes.end(), [&](const VkDescriptorPoolSize& poolSize) { return poolSize.type == descriptor.type; });
+				if (it != poolSizes.end())
+					it->descriptorCount += descriptor.count;
+				else
+					poolSizes.push_back({ descriptor.type, descriptor.count });
+			}
+			m_descriptorSet = m_pDescriptorAllocator->allocate(m_descriptorSetLayout, poolSizes.data(), poolSizes.size());
+			return;
+		}
+
 		if (!m_pDescriptorPool) {
 			std::cerr << "ERROR: Invalid DescriptorPool: set has to be part of a DescriptorPool to be allocated | DescriptorPool: " << m_pDescriptorPool << "\n";
 			throw std::runtime_error("Invalid Descriptor Pool");
@@ -1208,76 +1717,160 @@ namespace vk
 			allocate();
 		}
 
-		std::vector<VkWriteDescriptorSet> writes = {};
-		for (auto& descriptor : m_descriptors) {
-			if (descriptor.count <= 0) continue;
+		// a recreated dependency has new handles and addresses, any binding can reference it
+		if (VK_IS_FLAG_ENABLED(m_changes, eDEPENDENCIES)) {
+			for (uint32_t i = 0; i < m_descriptors.size(); i++)
+				m_dirtyRanges[i] = { 0, m_descriptors[i].count };
+		}
 
-			writes.push_back({});
-			auto& write = writes.back();
-			write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			write.pNext = descriptor.pNext;
-			write.dstSet = m_descriptorSet;
-			write.dstBinding = descriptor.binding;
-			write.dstArrayElement = 0;
-			write.descriptorCount = descriptor.count;
-			write.descriptorType = descriptor.type;
+		bool hasDirtyElements = false;
+		bool isFullyDirty = true;
+		for (uint32_t i = 0; i < m_descriptors.size(); i++) {
+			auto& range = m_dirtyRanges[i];
+			hasDirtyElements |= range.first < range.second;
+			isFullyDirty &= range.first == 0 && range.second == m_descriptors[i].count;
+		}
+		m_changes = eNONE;
+		if (!hasDirtyElements)
+			return;
 
-			VkDescriptorImageInfo* pImageInfo = nullptr; // ImageDescription
-			if (descriptor.imageInfos.size()) {
-				pImageInfo = new VkDescriptorImageInfo[descriptor.count]{};
-				for (uint32_t j = 0; j < descriptor.count; j++) {
-					if (descriptor.imageInfos[j].pSampler) {
-						pImageInfo[j].sampler = *descriptor.imageInfos[j].pSampler;
-					}
-					pImageInfo[j].imageView = descriptor.imageInfos[j].pImage->getVkImageView();
-					pImageInfo[j].imageLayout = descriptor.imageInfos[j].imageLayout;
-				}
+		if (m_pDescriptorBuffer) {
+			for (uint32_t i = 0; i < m_descriptors.size(); i++) {
+				auto& range = m_dirtyRanges[i];
+				if (range.first < range.second)
+					writeDescriptorBuffer(i, range.first, range.second);
+				range = { 0, 0 };
 			}
-			write.pImageInfo = pImageInfo;
 
-			VkDescriptorBufferInfo* pBufferInfo = nullptr; // BufferDescription
-			if (descriptor.bufferInfos.size()) {
-				pBufferInfo = new VkDescriptorBufferInfo[descriptor.count]{};
-				for (uint32_t j = 0; j < descriptor.count; j++) {
-					pBufferInfo[j].buffer = *descriptor.bufferInfos[j].pBuffer;
-					if (pBufferInfo[j].buffer == VK_NULL_HANDLE) {
-						pBufferInfo[j].offset = 0;
-						pBufferInfo[j].range = VK_WHOLE_SIZE;
-					}
-					else {
-						pBufferInfo[j].offset = descriptor.bufferInfos[j].offset;
-						pBufferInfo[j].range = descriptor.bufferInfos[j].range;
-					}
-				}
+			Registerable::update();
+			return;
+		}
+
+		if (m_isPushDescriptor) {
+			// only the infos are refreshed, cmdPush records them
+			for (uint32_t i = 0; i < m_descriptors.size(); i++) {
+				auto& range = m_dirtyRanges[i];
+				if (range.first < range.second)
+					packDescriptor(i, range.first, range.second);
+				range = { 0, 0 };
 			}
-			write.pBufferInfo = pBufferInfo;
 
-			VkBufferView* pTexelBufferView = nullptr;
-			if (descriptor.texelBufferViews.size()) {
-				pTexelBufferView = descriptor.texelBufferViews.data();
+			Registerable::update();
+			return;
+		}
+
+		if (isFullyDirty && m_updateTemplate != VK_NULL_HANDLE) {
+			for (uint32_t i = 0; i < m_descriptors.size(); i++) {
+				packDescriptor(i, 0, m_descriptors[i].count);
+				m_dirtyRanges[i] = { 0, 0 };
 			}
-			write.pTexelBufferView = pTexelBufferView;
+			vkUpdateDescriptorSetWithTemplate(device, m_descriptorSet, m_updateTemplate, m_scratch.data());
+
+			Registerable::update();
+			return;
 		}
 
-		if (writes.size() > 0)
-			vkUpdateDescriptorSets(device, writes.size(), writes.data(), 0, nullptr);
+		m_writes.clear();
+		m_accelerationStructureWrites.clear();
+		for (uint32_t i = 0; i < m_descriptors.size(); i++) {
+			auto& descriptor = m_descriptors[i];
+			auto& range = m_dirtyRanges[i];
+			if (range.first >= range.second)
+				continue;
+			if (descriptor.pNext && descriptor.type != VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR)
+				range = { 0, descriptor.count }; // unknown extension structs can only describe the whole array
+
+			packDescriptor(i, range.first, range.second);
 
-		for (auto& write : writes) {
-			if (write.pBufferInfo)
-				delete write.pBufferInfo;
+			uint8_t* pInfos = m_scratch.data() + m_scratchOffsets[i];
 
-			if (write.pImageInfo)
-				delete write.pImageInfo;
+			VkWriteDescriptorSet write{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+			write.pNext = descriptor.pNext;
+			write.dstSet = m_descriptorSet;
+			write.dstBinding = descriptor.binding;
+			write.dstArrayElement = range.first;
+			write.descriptorCount = range.second - range.first;
+			write.descriptorType = descriptor.type;
+			if (descriptor.type == VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR)
+				m_accelerationStructureWrites.emplace_back();
+			setDescriptorWriteInfos(write, descriptor, pInfos, range.first, descriptor.type == VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR ? &m_accelerationStructureWrites.back() : nullptr);
 
-			if (write.pTexelBufferView)
-				delete write.pTexelBufferView;
+			m_writes.push_back(write);
+			range = { 0, 0 };
 		}
 
-		m_changes = eNONE;
+		if (m_writes.size() > 0)
+			vkUpdateDescriptorSets(device, m_writes.size(), m_writes.data(), 0, nullptr);
 
 		Registerable::update();
 	}
 
+	void DescriptorSet::packDescriptor(uint32_t index, uint32_t firstElement, uint32_t endElement) {
+		packDescriptorInfos(m_descriptors[index], firstElement, endElement, m_scratch.data() + m_scratchOffsets[index]);
+	}
+
+	void DescriptorSet::writeDescriptorBuffer(uint32_t index, uint32_t firstElement, uint32_t endElement) {
+		auto& descriptor = m_descriptors[index];
+		packDescriptor(index, firstElement, endElement);
+
+		uint8_t* pInfos = m_scratch.data() + m_scratchOffsets[index];
+		size_t descriptorSize = DescriptorBuffer::getDescriptorSize(descriptor.type);
+		uint8_t* pDst = m_pDescriptorBuffer->getMappedData() + m_descriptorBufferOffset + m_bindingOffsets[index];
+		VkDescriptorImageInfo* pImageInfos = (VkDescriptorImageInfo*)pInfos;
+
+		for (uint32_t j = firstElement; j < endElement; j++) {
+			VkDescriptorGetInfoEXT getInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT };
+			getInfo.type = descriptor.type;
+
+			VkDescriptorAddressInfoEXT addressInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_ADDRESS_INFO_EXT };
+			switch (descriptor.type) {
+			case VK_DESCRIPTOR_TYPE_SAMPLER:
+				getInfo.data.pSampler = &pImageInfos[j].sampler;
+				break;
+			case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+				getInfo.data.pCombinedImageSampler = &pImageInfos[j];
+				break;
+			case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+				getInfo.data.pSampledImage = &pImageInfos[j];
+				break;
+			case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+				getInfo.data.pStorageImage = &pImageInfos[j];
+				break;
+			case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT:
+				getInfo.data.pInputAttachmentImage = &pImageInfos[j];
+				break;
+			case VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR: {
+				VkAccelerationStructureDeviceAddressInfoKHR accelerationStructureAddressInfo{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR };
+				accelerationStructureAddressInfo.accelerationStructure = ((VkAccelerationStructureKHR*)pInfos)[j];
+				getInfo.data.accelerationStructure = accelerationStructureAddressInfo.accelerationStructure != VK_NULL_HANDLE
+					? vkGetAccelerationStructureDeviceAddressKHR(device, &accelerationStructureAddressInfo) : 0;
+				break;
+			}
+			case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+			case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER: {
+				if (j >= descriptor.bufferInfos.size() || !descriptor.bufferInfos[j].pBuffer || *descriptor.bufferInfos[j].pBuffer == VK_NULL_HANDLE) {
+					getInfo.data.pUniformBuffer = nullptr; // null descriptor
+					break;
+				}
+				auto& bufferInfo = descriptor.bufferInfos[j];
+				addressInfo.address = bufferInfo.pBuffer->getVkDeviceAddress() + bufferInfo.offset;
+				addressInfo.range = bufferInfo.range == VK_WHOLE_SIZE ? bufferInfo.pBuffer->getSize() - bufferInfo.offset : bufferInfo.range;
+				addressInfo.format = VK_FORMAT_UNDEFINED;
+				if (descriptor.type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER)
+					getInfo.data.pUniformBuffer = &addressInfo;
+				else
+					getInfo.data.pStorageBuffer = &addressInfo;
+				break;
+			}
+			default:
+				std::cerr << "ERROR: Descriptor type is not supported by DescriptorBuffer | VkDescriptorType: " << descriptor.type << "\n";
+				throw std::runtime_error("Unsupported descriptor type");
+			}
+
+			vkGetDescriptorEXT(device, &getInfo, descriptorSize, pDst + j * descriptorSize);
+		}
+	}
+
 	void DescriptorSet::destroy() {
 		Registerable::destroy();
 
@@ -1285,7 +1878,14 @@ namespace vk
 		
 		if (m_isInit) {
 			m_isInit = false;
-			vkDestroyDescriptorSetLayout(device, m_descriptorSetLayout, nullptr);
+			if (m_updateTemplate != VK_NULL_HANDLE) {
+				vkDestroyDescriptorUpdateTemplate(device, m_updateTemplate, nullptr);
+				m_updateTemplate = VK_NULL_HANDLE;
+			}
+			for (auto& pushTemplate : m_pushTemplates)
+				vkDestroyDescriptorUpdateTemplate(device, pushTemplate.updateTemplate, nullptr);
+			m_pushTemplates.clear();
+			descriptorSetLayoutCache::release(m_descriptorSetLayout);
 			m_descriptorSetLayout = VK_NULL_HANDLE;
 		}
 	}
@@ -1293,6 +1893,8 @@ namespace vk
 	void DescriptorSet::free() {
 		if (m_isAlloc) {
 			m_isAlloc = false;
+			if (m_pDescriptorAllocator && !m_pDescriptorAllocator->isTransient() && !m_isPushDescriptor)
+				m_pDescriptorAllocator->free(m_descriptorSet);
 			//vkFreeDescriptorSets(device, *m_pDescriptorPool, 1, &m_descriptorSet); TODO free descriptorSet for optimized descriptorPools
 			m_descriptorSet = VK_NULL_HANDLE;
 		}
@@ -1320,6 +1922,41 @@ namespace vk
 		if(oldCount != descriptor.count)
 			m_changes |= eDESCRIPTOR_COUNT;
 		m_changes |= eDESCRIPTORS;
+		markDirty(index, 0, descriptor.count);
+	}
+
+	void DescriptorSet::setImageInfo(uint32_t index, uint32_t arrayElement, DescriptorImageInfo imageInfo) {
+		auto& imageInfos = m_descriptors[index].imageInfos;
+		if (arrayElement >= imageInfos.size())
+			imageInfos.resize(arrayElement + 1);
+		imageInfos[arrayElement] = imageInfo;
+		m_changes |= eDESCRIPTORS;
+		markDirty(index, arrayElement, 1);
+	}
+
+	void DescriptorSet::setBufferInfo(uint32_t index, uint32_t arrayElement, DescriptorBufferInfo bufferInfo) {
+		auto& bufferInfos = m_descriptors[index].bufferInfos;
+		if (arrayElement >= bufferInfos.size())
+			bufferInfos.resize(arrayElement + 1);
+		bufferInfos[arrayElement] = bufferInfo;
+		m_changes |= eDESCRIPTORS;
+		markDirty(index, arrayElement, 1);
+	}
+
+	void DescriptorSet::markDirty(uint32_t index, uint32_t firstElement, uint32_t elementCount) {
+		if (index >= m_dirtyRanges.size() || elementCount == 0)
+			return; // not initialized yet, the whole set gets written after init
+
+		auto& range = m_dirtyRanges[index];
+		uint32_t endElement = std::min(firstElement + elementCount, m_descriptors[index].count);
+		if (range.first >= range.second)
+			range = { firstElement, endElement };
+		else
+			range = { std::min(range.first, firstElement), std::max(range.second, endElement) };
+	}
+
+	void DescriptorSet::markDependencyChanged() {
+		m_changes |= eDEPENDENCIES;
 	}
 
 	void DescriptorSet::setDescriptorPool(const DescriptorPool* pDescriptorPool) {
@@ -1327,6 +1964,82 @@ namespace vk
 		m_changes |= eDESCRIPTOR_POOL;
 	}
 
+	void DescriptorSet::cmdPush(VkCommandBuffer cmd, VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint32_t set) {
+		if (!m_isPushDescriptor) {
+			std::cerr << "ERROR: DescriptorSet::cmdPush called on a set that isn't a push descriptor set\n";
+			throw std::runtime_error("DescriptorSet is no push descriptor set");
+		}
+		if (m_templateEntries.size() == 0) {
+			m_writes.clear();
+			m_accelerationStructureWrites.clear();
+			for (uint32_t i = 0; i < m_descriptors.size(); i++) {
+				auto& descriptor = m_descriptors[i];
+				if (descriptor.count == 0)
+					continue;
+
+				VkWriteDescriptorSet write{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+				write.pNext = descriptor.pNext;
+				write.dstSet = VK_NULL_HANDLE;
+				write.dstBinding = descriptor.binding;
+				write.dstArrayElement = 0;
+				write.descriptorCount = descriptor.count;
+				write.descriptorType = descriptor.type;
+				if (descriptor.type == VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR)
+					m_accelerationStructureWrites.emplace_back();
+				setDescriptorWriteInfos(write, descriptor, m_scratch.data() + m_scratchOffsets[i], 0, descriptor.type == VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR ? &m_accelerationStructureWrites.back() : nullptr);
+				m_writes.push_back(write);
+			}
+			if (m_writes.size() > 0)
+				vkCmdPushDescriptorSetKHR(cmd, bindPoint, layout, set, m_writes.size(), m_writes.data());
+			return;
+		}
+
+		// push templates are bound to a pipeline layout, one is created per layout the set is pushed to
+		VkDescriptorUpdateTemplate updateTemplate = VK_NULL_HANDLE;
+		for (auto& pushTemplate : m_pushTemplates) {
+			if (pushTemplate.bindPoint == bindPoint && pushTemplate.layout == layout && pushTemplate.set == set) {
+				updateTemplate = pushTemplate.updateTemplate;
+				break;
+			}
+		}
+		if (updateTemplate == VK_NULL_HANDLE) {
+			VkDescriptorUpdateTemplateCreateInfo templateCreateInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO };
+			templateCreateInfo.descriptorUpdateEntryCount = m_templateEntries.size();
+			templateCreateInfo.pDescriptorUpdateEntries = m_templateEntries.data();
+			templateCreateInfo.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_PUSH_DESCRIPTORS_KHR;
+			templateCreateInfo.descriptorSetLayout = m_descriptorSetLayout;
+			templateCreateInfo.pipelineBindPoint = bindPoint;
+			templateCreateInfo.pipelineLayout = layout;
+			templateCreateInfo.set = set;
+
+			VkResult result = vkCreateDescriptorUpdateTemplate(device, &templateCreateInfo, nullptr, &updateTemplate);
+			VK_ASSERT(result);
+			m_pushTemplates.push_back({ bindPoint, layout, set, updateTemplate });
+		}
+
+		vkCmdPushDescriptorSetWithTemplateKHR(cmd, updateTemplate, layout, set, m_scratch.data());
+	}
+
+	void DescriptorSet::setDescriptorBuffer(DescriptorBuffer* pDescriptorBuffer) {
+		m_pDescriptorBuffer = pDescriptorBuffer;
+		m_changes |= eDESCRIPTOR_POOL;
+	}
+
+	void DescriptorSet::cmdBindDescriptorBuffer(VkCommandBuffer cmd, VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint32_t set) {
+		uint32_t bufferIndex = 0;
+		vkCmdSetDescriptorBufferOffsetsEXT(cmd, bindPoint, layout, set, 1, &bufferIndex, &m_descriptorBufferOffset);
+	}
+
+	void DescriptorSet::setPushDescriptor(bool isPushDescriptor) {
+		m_isPushDescriptor = isPushDescriptor;
+		m_changes |= eDESCRIPTOR_COUNT;
+	}
+
+	void DescriptorSet::setDescriptorAllocator(DescriptorAllocator* pDescriptorAllocator) {
+		m_pDescriptorAllocator = pDescriptorAllocator;
+		m_changes |= eDESCRIPTOR_POOL;
+	}
+
 	Descriptor DescriptorSet::getDescriptor(uint32_t index) {
 		return m_descriptors[index];
 	}
@@ -1395,51 +2108,542 @@ namespace vk
 			addPoolSize(poolSizes[i]);
 	}
 
-	//void descriptorPoolCreate(
-	//	std::vector<VkDescriptorPoolSize>&                      poolSizes,
-	//	std::vector<VkDescriptorSetLayoutCreateInfo>&           setLayoutCreateInfos,
-	//	std::vector<std::vector<VkDescriptorSetLayoutBinding>>& setLayoutCreateInfoBindings,
-	//	uint32_t&                                               descriptorSetCount,
-	//	uint32_t&                                               descriptorSetArrayLength,
-	//	VkDescriptorSet*&                                       pDescriptorSets,
-	//	VkDescriptorSetLayout*&                                 pDescriptorSetLayouts,
-	//	std::vector<VkWriteDescriptorSet>&                      writeDescriptorSets,
-	//	std::vector<uint32_t>&                                  writeDescriptorSetIndices,
-	//	VkDescriptorPool&                                       m_descriptorPool
-	//) {
-	//	VkDescriptorPoolCreateInfo descriptorPoolCreateInfo;
-	//	descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	//	descriptorPoolCreateInfo.pNext = nullptr;
-	//	descriptorPoolCreateInfo.flags = 0;
-	//	descriptorPoolCreateInfo.maxSets = setLayoutCreateInfos.size();
-	//	descriptorPoolCreateInfo.poolSizeCount = poolSizes.size();
-	//	descriptorPoolCreateInfo.pPoolSizes = poolSizes.data();
-	//
-	//	vkCreateDescriptorPool(vk::device, &descriptorPoolCreateInfo, nullptr, &m_descriptorPool);
-	//
-	//	pDescriptorSetLayouts = new VkDescriptorSetLayout[descriptorSetCount];
-	//	descriptorSetArrayLength = descriptorSetCount;
-	//	for (int i = 0; i < descriptorSetArrayLength; i++)
-	//	{
-	//		setLayoutCreateInfos[i].bindingCount = setLayoutCreateInfoBindings[i].size();
-	//		setLayoutCreateInfos[i].pBindings = setLayoutCreateInfoBindings[i].data();
-	//		vkCreateDescriptorSetLayout(vk::device, &setLayoutCreateInfos[i], nullptr, &pDescriptorSetLayouts[i]);
-	//	}
-	//
-	//	VkDescriptorSetAllocateInfo descriptorSetAllocateInfo;
-	//	descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	//	descriptorSetAllocateInfo.pNext = nullptr;
-	//	descriptorSetAllocateInfo.descriptorPool = m_descriptorPool;
-	//	descriptorSetAllocateInfo.descriptorSetCount = descriptorSetArrayLength;
-	//	descriptorSetAllocateInfo.pSetLayouts = pDescriptorSetLayouts;
-	//
-	//	pDescriptorSets = new VkDescriptorSet[descriptorSetArrayLength];
-	//	vkAllocateDescriptorSets(vk::device, &descriptorSetAllocateInfo, pDescriptorSets);
-	//
-	//	for (int i = 0; i < writeDescriptorSets.size(); i++)
-	//	{
-	//		writeDescriptorSets[i].dstSet = pDescriptorSets[writeDescriptorSetIndices[i]];
-	//	}
+	/* DescriptorBuffer */
+	DescriptorBuffer::DescriptorBuffer() {}
+	DescriptorBuffer::~DescriptorBuffer() {}
+
+	void DescriptorBuffer::init() {
+		if (m_isInit)
+			return;
+		m_isInit = true;
+
+		m_buffer.setSize(m_size);
+		m_buffer.setUsage(m_usage | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+		m_buffer.init();
+		m_buffer.allocate(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+		// stays mapped, descriptors are written straight into it
+		m_buffer.map((void**)&m_pMappedData);
+		m_offset = 0;
+		m_generation++;
+	}
+
+	void DescriptorBuffer::destroy() {
+		if (!m_isInit)
+			return;
+		m_isInit = false;
+
+		m_buffer.unmap();
+		m_pMappedData = nullptr;
+		m_buffer.destroy();
+	}
+
+	void DescriptorBuffer::addDescriptorSet(DescriptorSet& descriptorSet) {
+		// the layout size is only known after the set is initialized, so the size is estimated
+		VkDeviceSize setSize = getProperties().descriptorBufferOffsetAlignment;
+		for (Descriptor& descriptor : descriptorSet.m_descriptors)
+			setSize += getDescriptorSize(descriptor.type) * descriptor.count;
+		m_size += align_up(setSize, getProperties().descriptorBufferOffsetAlignment);
+		descriptorSet.setDescriptorBuffer(this);
+	}
+
+	VkDeviceSize DescriptorBuffer::allocate(VkDeviceSize size) {
+		VkDeviceSize offset = align_up(m_offset, getProperties().descriptorBufferOffsetAlignment);
+		if (offset + size > m_size) {
+			std::cerr << "ERROR: DescriptorBuffer is full | Size: " << m_size << " Requested: " << offset + size << "\n";
+			throw std::runtime_error("DescriptorBuffer out of memory");
+		}
+		m_offset = offset + size;
+		return offset;
+	}
+
+	void DescriptorBuffer::cmdBind(VkCommandBuffer cmd) {
+		VkDescriptorBufferBindingInfoEXT bindingInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_BUFFER_BINDING_INFO_EXT };
+		bindingInfo.address = m_buffer.getVkDeviceAddress();
+		bindingInfo.usage = m_usage;
+		vkCmdBindDescriptorBuffersEXT(cmd, 1, &bindingInfo);
+	}
+
+	const VkPhysicalDeviceDescriptorBufferPropertiesEXT& DescriptorBuffer::getProperties() {
+		static VkPhysicalDeviceDescriptorBufferPropertiesEXT properties = []() {
+			VkPhysicalDeviceDescriptorBufferPropertiesEXT descriptorBufferProperties{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_PROPERTIES_EXT };
+			VkPhysicalDeviceProperties2 properties2{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+			properties2.pNext = &descriptorBufferProperties;
+			vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+			return descriptorBufferProperties;
+		}();
+		return properties;
+	}
+
+	size_t DescriptorBuffer::getDescriptorSize(VkDescriptorType type) {
+		auto& properties = getProperties();
+		switch (type) {
+		case VK_DESCRIPTOR_TYPE_SAMPLER: return properties.samplerDescriptorSize;
+		case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER: return properties.combinedImageSamplerDescriptorSize;
+		case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE: return properties.sampledImageDescriptorSize;
+		case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE: return properties.storageImageDescriptorSize;
+		case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER: return properties.uniformTexelBufferDescriptorSize;
+		case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER: return properties.storageTexelBufferDescriptorSize;
+		case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER: return properties.uniformBufferDescriptorSize;
+		case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER: return properties.storageBufferDescriptorSize;
+		case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT: return properties.inputAttachmentDescriptorSize;
+		case VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR: return properties.accelerationStructureDescriptorSize;
+		default: return 0;
+		}
+	}
+
+	/* DescriptorAllocator */
+	// pools are never sized for more sets than this, further pools are chained instead
+	static const uint32_t maxSetsPerAllocatorPool = 4096;
+
+	DescriptorAllocator::DescriptorAllocator() {
+		m_poolSizeRatios = {
+			{ VK_DESCRIPTOR_TYPE_SAMPLER, 0.5f },
+			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4.0f },
+			{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 4.0f },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1.0f },
+			{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2.0f },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2.0f },
+			{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1.0f },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1.0f }
+		};
+	}
+	DescriptorAllocator::~DescriptorAllocator() {}
+
+	void DescriptorAllocator::init() {
+		if (m_isInit)
+			return;
+		m_isInit = true;
+
+		m_currentPool = createPool(nullptr, 0);
+	}
+
+	void DescriptorAllocator::destroy() {
+		if (!m_isInit)
+			return;
+		m_isInit = false;
+
+		if (m_currentPool != VK_NULL_HANDLE)
+			vkDestroyDescriptorPool(device, m_currentPool, nullptr);
+		m_currentPool = VK_NULL_HANDLE;
+		for (VkDescriptorPool descriptorPool : m_usedPools)
+			vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+		for (VkDescriptorPool descriptorPool : m_freePools)
+			vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+		m_usedPools.clear();
+		m_freePools.clear();
+		m_allocations.clear();
+		m_usage.clear();
+		m_setCount = 0;
+	}
+
+	VkDescriptorSet DescriptorAllocator::allocate(VkDescriptorSetLayout setLayout, const VkDescriptorPoolSize* pPoolSizes, uint32_t poolSizeCount) {
+		if (!m_isInit) {
+			std::cerr << "ERROR: DescriptorAllocator has to be initialized before allocating sets\n";
+			throw std::runtime_error("DescriptorAllocator not initialized");
+		}
+
+		VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+		VkResult result = allocateFromPool(m_currentPool, setLayout, &descriptorSet);
+
+		// chain the next pool, reset pools are reused before new ones are created
+		// a reused pool might lack the requested types, so a fresh pool sized for the set is the last resort
+		while (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL) {
+			m_usedPools.push_back(m_currentPool);
+			if (!m_freePools.empty()) {
+				m_currentPool = m_freePools.back();
+				m_freePools.pop_back();
+				result = allocateFromPool(m_currentPool, setLayout, &descriptorSet);
+				continue;
+			}
+			m_currentPool = createPool(pPoolSizes, poolSizeCount);
+			result = allocateFromPool(m_currentPool, setLayout, &descriptorSet);
+			break;
+		}
+		if (result != VK_SUCCESS) {
+			std::cerr << "ERROR: DescriptorAllocator failed to allocate a set from a new pool | VkResult: " << result << "\n";
+			throw std::runtime_error("Failed to allocate descriptor set");
+		}
+
+		addUsage(pPoolSizes, poolSizeCount, 1);
+		m_setCount++;
+		m_peakSetCount = std::max(m_peakSetCount, m_setCount);
+
+		if (!m_isTransient)
+			m_allocations[descriptorSet] = { m_currentPool, std::vector<VkDescriptorPoolSize>(pPoolSizes, pPoolSizes + poolSizeCount) };
+
+		return descriptorSet;
+	}
+
+	void DescriptorAllocator::free(VkDescriptorSet descriptorSet) {
+		if (m_isTransient) {
+			std::cerr << "ERROR: Sets of a transient DescriptorAllocator can't be freed, reset the allocator instead\n";
+			throw std::runtime_error("Free on transient DescriptorAllocator");
+		}
+
+		auto it = m_allocations.find(descriptorSet);
+		if (it == m_allocations.end())
+			return;
+
+		VkResult result = vkFreeDescriptorSets(device, it->second.first, 1, &descriptorSet);
+		VK_ASSERT(result)
+
+		addUsage(it->second.second.data(), it->second.second.size(), -1);
+		m_setCount--;
+		m_allocations.erase(it);
+	}
+
+	void DescriptorAllocator::reset() {
+		if (!m_isInit)
+			return;
+
+		// resetting a pool frees all its sets at once
+		VkResult result = vkResetDescriptorPool(device, m_currentPool, 0);
+		VK_ASSERT(result)
+		for (VkDescriptorPool descriptorPool : m_usedPools) {
+			result = vkResetDescriptorPool(device, descriptorPool, 0);
+			VK_ASSERT(result)
+			m_freePools.push_back(descriptorPool);
+		}
+		m_usedPools.clear();
+		m_allocations.clear();
+		m_usage.clear();
+		m_setCount = 0;
+	}
+
+	void DescriptorAllocator::setTransient(bool isTransient) {
+		if (m_isInit) {
+			std::cerr << "ERROR: DescriptorAllocator::setTransient has to be called before init\n";
+			throw std::runtime_error("DescriptorAllocator already initialized");
+		}
+		m_isTransient = isTransient;
+	}
+
+	void DescriptorAllocator::setSetsPerPool(uint32_t setsPerPool) {
+		m_setsPerPool = std::max(std::min(setsPerPool, maxSetsPerAllocatorPool), 1u);
+	}
+
+	void DescriptorAllocator::setPoolSizeRatio(VkDescriptorType type, float ratio) {
+		for (auto& poolSizeRatio : m_poolSizeRatios) {
+			if (poolSizeRatio.first == type) {
+				poolSizeRatio.second = ratio;
+				return;
+			}
+		}
+		m_poolSizeRatios.push_back({ type, ratio });
+	}
+
+	uint32_t DescriptorAllocator::getPoolCount() const {
+		return m_usedPools.size() + m_freePools.size() + (m_currentPool != VK_NULL_HANDLE ? 1 : 0);
+	}
+
+	uint32_t DescriptorAllocator::getUsage(VkDescriptorType type) const {
+		for (const VkDescriptorPoolSize& poolSize : m_usage)
+			if (poolSize.type == type)
+				return poolSize.descriptorCount;
+		return 0;
+	}
+
+	uint32_t DescriptorAllocator::getPeakUsage(VkDescriptorType type) const {
+		for (const VkDescriptorPoolSize& poolSize : m_peakUsage)
+			if (poolSize.type == type)
+				return poolSize.descriptorCount;
+		return 0;
+	}
+
+	std::vector<VkDescriptorPoolSize> DescriptorAllocator::getPeakUsage() const {
+		return m_peakUsage;
+	}
+
+	void DescriptorAllocator::printUsage() const {
+		std::cout << "DescriptorAllocator: " << getPoolCount() << " pools, " << m_setCount << " sets (peak " << m_peakSetCount << ")\n";
+		for (const VkDescriptorPoolSize& poolSize : m_peakUsage)
+			std::cout << "\tVkDescriptorType " << poolSize.type << ": " << getUsage(poolSize.type) << " (peak " << poolSize.descriptorCount << ")\n";
+	}
+
+	VkDescriptorPool DescriptorAllocator::createPool(const VkDescriptorPoolSize* pPoolSizes, uint32_t poolSizeCount) {
+		std::vector<VkDescriptorPoolSize> poolSizes;
+		poolSizes.reserve(m_poolSizeRatios.size() + poolSizeCount);
+		for (auto& poolSizeRatio : m_poolSizeRatios) {
+			uint32_t count = static_cast<uint32_t>(poolSizeRatio.second * m_setsPerPool);
+			if (count > 0)
+				poolSizes.push_back({ poolSizeRatio.first, count });
+		}
+		// the set that needed the new pool always fits, even with types missing from the ratios
+		for (uint32_t i = 0; i < poolSizeCount; i++) {
+			auto it = std::find_if(poolSizes.begin(), poolSizes.end(), [&](const VkDescriptorPoolSize& poolSize) { return poolSize.type == pPoolSizes[i].type; });
+			if (it == poolSizes.end())
+				poolSizes.push_back({ pPoolSizes[i].type, pPoolSizes[i].descriptorCount * m_setsPerPool });
+			else
+				it->descriptorCount = std::max(it->descriptorCount, pPoolSizes[i].descriptorCount);
+		}
+
+		VkDescriptorPoolCreateInfo createInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+		createInfo.pNext = nullptr;
+		createInfo.flags = m_isTransient ? 0 : VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+		createInfo.maxSets = m_setsPerPool;
+		createInfo.poolSizeCount = poolSizes.size();
+		createInfo.pPoolSizes = poolSizes.data();
+
+		VkDescriptorPool descriptorPool;
+		VkResult result = vkCreateDescriptorPool(device, &createInfo, nullptr, &descriptorPool);
+		VK_ASSERT(result)
+
+		m_setsPerPool = std::min(m_setsPerPool * 2, maxSetsPerAllocatorPool);
+		return descriptorPool;
+	}
+
+	VkResult DescriptorAllocator::allocateFromPool(VkDescriptorPool descriptorPool, VkDescriptorSetLayout setLayout, VkDescriptorSet* pDescriptorSet) {
+		VkDescriptorSetAllocateInfo allocateInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+		allocateInfo.pNext = nullptr;
+		allocateInfo.descriptorPool = descriptorPool;
+		allocateInfo.descriptorSetCount = 1;
+		allocateInfo.pSetLayouts = &setLayout;
+
+		return vkAllocateDescriptorSets(device, &allocateInfo, pDescriptorSet);
+	}
+
+	void DescriptorAllocator::addUsage(const VkDescriptorPoolSize* pPoolSizes, uint32_t poolSizeCount, int32_t sign) {
+		for (uint32_t i = 0; i < poolSizeCount; i++) {
+			auto it = std::find_if(m_usage.begin(), m_usage.end(), [&](const VkDescriptorPoolSize& poolSize) { return poolSize.type == pPoolSizes[i].type; });
+			if (it == m_usage.end())
+				it = m_usage.insert(m_usage.end(), VkDescriptorPoolSize{ pPoolSizes[i].type, 0 });
+			it->descriptorCount += sign * static_cast<int32_t>(pPoolSizes[i].descriptorCount);
+
+			auto peak = std::find_if(m_peakUsage.begin(), m_peakUsage.end(), [&](const VkDescriptorPoolSize& poolSize) { return poolSize.type == it->type; });
+			if (peak == m_peakUsage.end())
+				m_peakUsage.push_back(*it);
+			else
+				peak->descriptorCount = std::max(peak->descriptorCount, it->descriptorCount);
+		}
+	}
+
+	/* BindlessDescriptorTable */
+	BindlessDescriptorTable::BindlessDescriptorTable() {}
+	BindlessDescriptorTable::~BindlessDescriptorTable() {}
+
+	void BindlessDescriptorTable::init() {
+		if (m_isInit)
+			return;
+		m_isInit = true;
+
+		VkDescriptorSetLayoutBinding bindings[3];
+		bindings[eIMAGE_BINDING] = { eIMAGE_BINDING, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, m_imageSlots.capacity, m_stages, nullptr };
+		bindings[eSTORAGE_BUFFER_BINDING] = { eSTORAGE_BUFFER_BINDING, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_storageBufferSlots.capacity, m_stages, nullptr };
+		bindings[eACCELERATION_STRUCTURE_BINDING] = { eACCELERATION_STRUCTURE_BINDING, VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, m_accelerationStructureSlots.capacity, m_stages, nullptr };
+
+		VkDescriptorBindingFlags bindingFlags[3];
+		bindingFlags[eIMAGE_BINDING] = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT;
+		bindingFlags[eSTORAGE_BUFFER_BINDING] = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT;
+		bindingFlags[eACCELERATION_STRUCTURE_BINDING] = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT;
+
+		VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsCreateInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO };
+		bindingFlagsCreateInfo.bindingCount = 3;
+		bindingFlagsCreateInfo.pBindingFlags = bindingFlags;
+
+		VkDescriptorSetLayoutCreateInfo layoutCreateInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+		layoutCreateInfo.pNext = &bindingFlagsCreateInfo;
+		layoutCreateInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+		layoutCreateInfo.bindingCount = 3;
+		layoutCreateInfo.pBindings = bindings;
+
+		VkResult result = vkCreateDescriptorSetLayout(device, &layoutCreateInfo, nullptr, &m_descriptorSetLayout);
+		VK_ASSERT(result);
+
+		VkDescriptorPoolSize poolSizes[3] = {
+			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, m_imageSlots.capacity },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_storageBufferSlots.capacity },
+			{ VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, m_accelerationStructureSlots.capacity }
+		};
+
+		VkDescriptorPoolCreateInfo poolCreateInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+		poolCreateInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+		poolCreateInfo.maxSets = 1;
+		poolCreateInfo.poolSizeCount = 3;
+		poolCreateInfo.pPoolSizes = poolSizes;
+
+		result = vkCreateDescriptorPool(device, &poolCreateInfo, nullptr, &m_descriptorPool);
+		VK_ASSERT(result);
+
+		VkDescriptorSetVariableDescriptorCountAllocateInfo variableCountAllocateInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO };
+		variableCountAllocateInfo.descriptorSetCount = 1;
+		variableCountAllocateInfo.pDescriptorCounts = &m_accelerationStructureSlots.capacity;
+
+		VkDescriptorSetAllocateInfo allocateInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+		allocateInfo.pNext = &variableCountAllocateInfo;
+		allocateInfo.descriptorPool = m_descriptorPool;
+		allocateInfo.descriptorSetCount = 1;
+		allocateInfo.pSetLayouts = &m_descriptorSetLayout;
+
+		result = vkAllocateDescriptorSets(device, &allocateInfo, &m_descriptorSet);
+		VK_ASSERT(result);
+	}
+
+	void BindlessDescriptorTable::destroy() {
+		if (!m_isInit)
+			return;
+		m_isInit = false;
+
+		vkDestroyDescriptorPool(device, m_descriptorPool, nullptr);
+		vkDestroyDescriptorSetLayout(device, m_descriptorSetLayout, nullptr);
+		m_descriptorPool = VK_NULL_HANDLE;
+		m_descriptorSetLayout = VK_NULL_HANDLE;
+		m_descriptorSet = VK_NULL_HANDLE;
+
+		for (SlotAllocator* pSlots : { &m_imageSlots, &m_storageBufferSlots, &m_accelerationStructureSlots }) {
+			pSlots->next = 0;
+			pSlots->freeSlots.clear();
+			pSlots->retiredSlots.clear();
+		}
+	}
+
+	uint32_t BindlessDescriptorTable::addImage(Image& image, Sampler& sampler, VkImageLayout imageLayout) {
+		uint32_t index = allocateSlot(m_imageSlots);
+		setImage(index, image, sampler, imageLayout);
+		return index;
+	}
+
+	uint32_t BindlessDescriptorTable::addStorageBuffer(Buffer& buffer, VkDeviceSize offset, VkDeviceSize range) {
+		uint32_t index = allocateSlot(m_storageBufferSlots);
+		setStorageBuffer(index, buffer, offset, range);
+		return index;
+	}
+
+	uint32_t BindlessDescriptorTable::addAccelerationStructure(AccelerationStructure& accelerationStructure) {
+		uint32_t index = allocateSlot(m_accelerationStructureSlots);
+		setAccelerationStructure(index, accelerationStructure);
+		return index;
+	}
+
+	void BindlessDescriptorTable::setImage(uint32_t index, Image& image, Sampler& sampler, VkImageLayout imageLayout) {
+		VkDescriptorImageInfo imageInfo;
+		imageInfo.sampler = sampler;
+		imageInfo.imageView = image.getVkImageView();
+		imageInfo.imageLayout = imageLayout;
+
+		VkWriteDescriptorSet write{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+		write.dstSet = m_descriptorSet;
+		write.dstBinding = eIMAGE_BINDING;
+		write.dstArrayElement = index;
+		write.descriptorCount = 1;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		write.pImageInfo = &imageInfo;
+
+		vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+	}
+
+	void BindlessDescriptorTable::setStorageBuffer(uint32_t index, Buffer& buffer, VkDeviceSize offset, VkDeviceSize range) {
+		VkDescriptorBufferInfo bufferInfo;
+		bufferInfo.buffer = buffer;
+		bufferInfo.offset = offset;
+		bufferInfo.range = range;
+
+		VkWriteDescriptorSet write{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+		write.dstSet = m_descriptorSet;
+		write.dstBinding = eSTORAGE_BUFFER_BINDING;
+		write.dstArrayElement = index;
+		write.descriptorCount = 1;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		write.pBufferInfo = &bufferInfo;
+
+		vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+	}
+
+	void BindlessDescriptorTable::setAccelerationStructure(uint32_t index, AccelerationStructure& accelerationStructure) {
+		VkWriteDescriptorSetAccelerationStructureKHR accelerationStructureWrite{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR };
+		accelerationStructureWrite.accelerationStructureCount = 1;
+		accelerationStructureWrite.pAccelerationStructures = accelerationStructure.getVkAccelerationStructureKHRptr();
+
+		VkWriteDescriptorSet write{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+		write.pNext = &accelerationStructureWrite;
+		write.dstSet = m_descriptorSet;
+		write.dstBinding = eACCELERATION_STRUCTURE_BINDING;
+		write.dstArrayElement = index;
+		write.descriptorCount = 1;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+
+		vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+	}
+
+	void BindlessDescriptorTable::nextFrame() {
+		m_frame++;
+		for (SlotAllocator* pSlots : { &m_imageSlots, &m_storageBufferSlots, &m_accelerationStructureSlots }) {
+			auto& retiredSlots = pSlots->retiredSlots;
+			uint32_t i = 0;
+			while (i < retiredSlots.size()) {
+				if (m_frame - retiredSlots[i].first > m_frameDelay) {
+					pSlots->freeSlots.push_back(retiredSlots[i].second);
+					retiredSlots.erase(retiredSlots.begin() + i);
+				}
+				else {
+					i++;
+				}
+			}
+		}
+	}
+
+	uint32_t BindlessDescriptorTable::allocateSlot(SlotAllocator& slots) {
+		if (!slots.freeSlots.empty()) {
+			uint32_t index = slots.freeSlots.back();
+			slots.freeSlots.pop_back();
+			return index;
+		}
+		if (slots.next >= slots.capacity) {
+			std::cerr << "ERROR: BindlessDescriptorTable is full | Capacity: " << slots.capacity << "\n";
+			throw std::runtime_error("BindlessDescriptorTable is full");
+		}
+		return slots.next++;
+	}
+
+	void BindlessDescriptorTable::retireSlot(SlotAllocator& slots, uint32_t index) {
+		slots.retiredSlots.push_back({ m_frame, index });
+	}
+
+	//void descriptorPoolCreate(
+	//	std::vector<VkDescriptorPoolSize>&                      poolSizes,
+	//	std::vector<VkDescriptorSetLayoutCreateInfo>&           setLayoutCreateInfos,
+	//	std::vector<std::vector<VkDescriptorSetLayoutBinding>>& setLayoutCreateInfoBindings,
+	//	uint32_t&                                               descriptorSetCount,
+	//	uint32_t&                                               descriptorSetArrayLength,
+	//	VkDescriptorSet*&                                       pDescriptorSets,
+	//	VkDescriptorSetLayout*&                                 pDescriptorSetLayouts,
+	//	std::vector<VkWriteDescriptorSet>&                      writeDescriptorSets,
+	//	std::vector<uint32_t>&                                  writeDescriptorSetIndices,
+	//	VkDescriptorPool&                                       m_descriptorPool
+	//) {
+	//	VkDescriptorPoolCreateInfo descriptorPoolCreateInfo;
+	//	descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	//	descriptorPoolCreateInfo.pNext = nullptr;
+	//	descriptorPoolCreateInfo.flags = 0;
+	//	descriptorPoolCreateInfo.maxSets = setLayoutCreateInfos.size();
+	//	descriptorPoolCreateInfo.poolSizeCount = poolSizes.size();
+	//	descriptorPoolCreateInfo.pPoolSizes = poolSizes.data();
+	//
+	//	vkCreateDescriptorPool(vk::device, &descriptorPoolCreateInfo, nullptr, &m_descriptorPool);
+	//
+	//	pDescriptorSetLayouts = new VkDescriptorSetLayout[descriptorSetCount];
+	//	descriptorSetArrayLength = descriptorSetCount;
+	//	for (int i = 0; i < descriptorSetArrayLength; i++)
+	//	{
+	//		setLayoutCreateInfos[i].bindingCount = setLayoutCreateInfoBindings[i].size();
+	//		setLayoutCreateInfos[i].pBindings = setLayoutCreateInfoBindings[i].data();
+	//		vkCreateDescriptorSetLayout(vk::device, &setLayoutCreateInfos[i], nullptr, &pDescriptorSetLayouts[i]);
+	//	}
+	//
+	//	VkDescriptorSetAllocateInfo descriptorSetAllocateInfo;
+	//	descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	//	descriptorSetAllocateInfo.pNext = nullptr;
+	//	descriptorSetAllocateInfo.descriptorPool = m_descriptorPool;
+	//	descriptorSetAllocateInfo.descriptorSetCount = descriptorSetArrayLength;
+	//	descriptorSetAllocateInfo.pSetLayouts = pDescriptorSetLayouts;
+	//
+	//	pDescriptorSets = new VkDescriptorSet[descriptorSetArrayLength];
+	//	vkAllocateDescriptorSets(vk::device, &descriptorSetAllocateInfo, pDescriptorSets);
+	//
+	//	for (int i = 0; i < writeDescriptorSets.size(); i++)
+	//	{
+	//		writeDescriptorSets[i].dstSet = pDescriptorSets[writeDescriptorSetIndices[i]];
+	//	}
 	//
 	//	vkUpdateDescriptorSets(vk::device, writeDescriptorSets.size(), writeDescriptorSets.data(), 0, nullptr);
 	//}
@@ -1665,6 +2869,11 @@ namespace vk
 		}
 	}
 
+	bool Shader::compile(std::string srcPath, std::string dstPath) {
+		std::string vulkanVersion = "vulkan1.3";
+		return system((GLSLANG_VALIDATOR " --target-env " + vulkanVersion + " -V100 " + srcPath + " -o " + dstPath).c_str()) == 0;
+	}
+
 	/* RenderPass */
 	RenderPass::RenderPass(){}
 
@@ -1876,42 +3085,55 @@ namespace vk
 
 		vkCreatePipelineLayout(vk::device, &layoutCreateInfo, nullptr, &m_pipelineLayout);
 
-		m_vertexInputStateCreateInfo.vertexAttributeDescriptionCount = m_vertexInputAttributeDescriptions.size();
-		m_vertexInputStateCreateInfo.pVertexAttributeDescriptions = m_vertexInputAttributeDescriptions.data();
-		m_vertexInputStateCreateInfo.vertexBindingDescriptionCount = m_vertexInputBindingDescriptions.size();
-		m_vertexInputStateCreateInfo.pVertexBindingDescriptions = m_vertexInputBindingDescriptions.data();
+		m_pipeline = createVkPipeline(m_shaderStages);
+	}
+
+	VkPipeline Pipeline::createVkPipeline(const std::vector<VkPipelineShaderStageCreateInfo>& shaderStages) const {
+		// local copies, so pipelines can be created from other threads without writing to this object
+		VkPipelineVertexInputStateCreateInfo vertexInputStateCreateInfo = m_vertexInputStateCreateInfo;
+		vertexInputStateCreateInfo.vertexAttributeDescriptionCount = m_vertexInputAttributeDescriptions.size();
+		vertexInputStateCreateInfo.pVertexAttributeDescriptions = m_vertexInputAttributeDescriptions.data();
+		vertexInputStateCreateInfo.vertexBindingDescriptionCount = m_vertexInputBindingDescriptions.size();
+		vertexInputStateCreateInfo.pVertexBindingDescriptions = m_vertexInputBindingDescriptions.data();
 
-		m_viewportStateCreateInfo.viewportCount = m_viewports.size();
-		m_viewportStateCreateInfo.pViewports = m_viewports.data();
-		m_viewportStateCreateInfo.scissorCount = m_scissors.size();
-		m_viewportStateCreateInfo.pScissors = m_scissors.data();
+		VkPipelineViewportStateCreateInfo viewportStateCreateInfo = m_viewportStateCreateInfo;
+		viewportStateCreateInfo.viewportCount = m_viewports.size();
+		viewportStateCreateInfo.pViewports = m_viewports.data();
+		viewportStateCreateInfo.scissorCount = m_scissors.size();
+		viewportStateCreateInfo.pScissors = m_scissors.data();
 
-		m_dynamicStateCreateInfo.dynamicStateCount = m_dynamicStates.size();
-		m_dynamicStateCreateInfo.pDynamicStates = m_dynamicStates.data();
+		VkPipelineColorBlendStateCreateInfo colorBlendStateCreateInfo = m_colorBlendStateCreateInfo;
+		colorBlendStateCreateInfo.pAttachments = &m_colorBlendAttachment;
+
+		VkPipelineDynamicStateCreateInfo dynamicStateCreateInfo = m_dynamicStateCreateInfo;
+		dynamicStateCreateInfo.dynamicStateCount = m_dynamicStates.size();
+		dynamicStateCreateInfo.pDynamicStates = m_dynamicStates.data();
 
 		VkGraphicsPipelineCreateInfo createInfo;
 		createInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
 		createInfo.pNext = nullptr;
-		createInfo.flags = 0;
-		createInfo.stageCount = m_shaderStages.size();
-		createInfo.pStages = m_shaderStages.data();
-		createInfo.pVertexInputState = &m_vertexInputStateCreateInfo;
+		createInfo.flags = m_createFlags;
+		createInfo.stageCount = shaderStages.size();
+		createInfo.pStages = shaderStages.data();
+		createInfo.pVertexInputState = &vertexInputStateCreateInfo;
 		createInfo.pInputAssemblyState = &m_inputAssemblyStateCreateInfo;
 		createInfo.pTessellationState = nullptr;
-		createInfo.pViewportState = &m_viewportStateCreateInfo;
+		createInfo.pViewportState = &viewportStateCreateInfo;
 		createInfo.pRasterizationState = &m_rasterizationStateCreateInfo;
 		createInfo.pMultisampleState = &m_multisampleStateCreateInfo;
 		createInfo.pDepthStencilState = &m_depthStencilStateCreateInfo;
-		createInfo.pColorBlendState = &m_colorBlendStateCreateInfo;
-		createInfo.pDynamicState = &m_dynamicStateCreateInfo;
+		createInfo.pColorBlendState = &colorBlendStateCreateInfo;
+		createInfo.pDynamicState = &dynamicStateCreateInfo;
 		createInfo.layout = m_pipelineLayout;
 		createInfo.renderPass = m_renderPass;
 		createInfo.subpass = m_subpassIndex;
 		createInfo.basePipelineHandle = VK_NULL_HANDLE;
 		createInfo.basePipelineIndex = -1;
 
-		VkResult result = vkCreateGraphicsPipelines(vk::device, VK_NULL_HANDLE, 1, &createInfo, nullptr, &m_pipeline);
+		VkPipeline pipeline;
+		VkResult result = vkCreateGraphicsPipelines(vk::device, VK_NULL_HANDLE, 1, &createInfo, nullptr, &pipeline);
 		VK_ASSERT(result);
+		return pipeline;
 	}
 
 	void Pipeline::update() {
@@ -2013,23 +3235,251 @@ namespace vk
 		setStencilOpStates(opState, opState);
 	}
 
-	VkInstance getInstance() {
-		return instance;
+	/* ShaderObject */
+	ShaderObject::ShaderObject() {}
+
+	ShaderObject::~ShaderObject() {}
+
+	// graphics stages in the order they are executed
+	static const VkShaderStageFlagBits graphicsShaderStages[] = {
+		VK_SHADER_STAGE_VERTEX_BIT,
+		VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT,
+		VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT,
+		VK_SHADER_STAGE_GEOMETRY_BIT,
+		VK_SHADER_STAGE_FRAGMENT_BIT
+	};
+
+	void ShaderObject::init() {
+		if (m_isInit)
+			return;
+		m_isInit = true;
+
+		VkPipelineLayoutCreateInfo layoutCreateInfo{ VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+		layoutCreateInfo.setLayoutCount = m_setLayouts.size();
+		layoutCreateInfo.pSetLayouts = m_setLayouts.data();
+		layoutCreateInfo.pushConstantRangeCount = m_pushConstantRanges.size();
+		layoutCreateInfo.pPushConstantRanges = m_pushConstantRanges.data();
+
+		VkResult result = vkCreatePipelineLayout(device, &layoutCreateInfo, nullptr, &m_pipelineLayout);
+		VK_ASSERT(result);
+
+		uint32_t shaderCount = m_pShaders.size();
+		uint32_t graphicsShaderCount = 0;
+		std::vector<std::vector<char>> codes(shaderCount);
+		std::vector<VkShaderCreateInfoEXT> createInfos(shaderCount);
+		m_shaderStages.resize(shaderCount);
+		for (uint32_t i = 0; i < shaderCount; i++) {
+			VkPipelineShaderStageCreateInfo shaderStage = m_pShaders[i]->getShaderStage();
+			m_shaderStages[i] = shaderStage.stage;
+			codes[i] = vkUtils::readFile(m_pShaders[i]->getPath().c_str());
+			if (shaderStage.stage != VK_SHADER_STAGE_COMPUTE_BIT)
+				graphicsShaderCount++;
+		}
+
+		for (uint32_t i = 0; i < shaderCount; i++) {
+			VkPipelineShaderStageCreateInfo shaderStage = m_pShaders[i]->getShaderStage();
+
+			// the next stage is the closest following graphics stage that has a shader
+			VkShaderStageFlags nextStage = 0;
+			bool isAfterStage = false;
+			for (VkShaderStageFlagBits stage : graphicsShaderStages) {
+				if (isAfterStage && nextStage == 0) {
+					for (VkShaderStageFlagBits other : m_shaderStages) {
+						if (other == stage)
+							nextStage = stage;
+					}
+				}
+				isAfterStage |= stage == shaderStage.stage;
+			}
+
+			VkShaderCreateInfoEXT& createInfo = createInfos[i];
+			createInfo.sType = VK_STRUCTURE_TYPE_SHADER_CREATE_INFO_EXT;
+			createInfo.pNext = nullptr;
+			// compute shaders can't be linked, only the graphics stages are linked together
+			bool isLinked = m_isLinked && graphicsShaderCount > 1 && shaderStage.stage != VK_SHADER_STAGE_COMPUTE_BIT;
+			createInfo.flags = isLinked ? VK_SHADER_CREATE_LINK_STAGE_BIT_EXT : 0;
+			createInfo.stage = shaderStage.stage;
+			createInfo.nextStage = nextStage;
+			createInfo.codeType = VK_SHADER_CODE_TYPE_SPIRV_EXT;
+			createInfo.codeSize = codes[i].size();
+			createInfo.pCode = codes[i].data();
+			createInfo.pName = shaderStage.pName;
+			createInfo.setLayoutCount = m_setLayouts.size();
+			createInfo.pSetLayouts = m_setLayouts.data();
+			createInfo.pushConstantRangeCount = m_pushConstantRanges.size();
+			createInfo.pPushConstantRanges = m_pushConstantRanges.data();
+			createInfo.pSpecializationInfo = shaderStage.pSpecializationInfo;
+		}
+
+		m_shaders.resize(shaderCount);
+		result = vkCreateShadersEXT(device, shaderCount, createInfos.data(), nullptr, m_shaders.data());
+		VK_ASSERT(result);
 	}
 
-	VkPhysicalDevice getPhysicalDevice() {
-		return physicalDevice;
+	void ShaderObject::update() {
+		destroy();
+		init();
 	}
 
-	VkDevice getDevice() {
-		return device;
+	void ShaderObject::destroy() {
+		if (!m_isInit)
+			return;
+		m_isInit = false;
+
+		for (VkShaderEXT shader : m_shaders)
+			vkDestroyShaderEXT(device, shader, nullptr);
+		m_shaders.clear();
+		vkDestroyPipelineLayout(device, m_pipelineLayout, nullptr);
+		m_pipelineLayout = VK_NULL_HANDLE;
 	}
 
-	uint32_t getQueueFamily() {
-		return queueFamily;
+	void ShaderObject::cmdBind(VkCommandBuffer cmd) {
+		cmdBindShaders(cmd);
+		cmdSetState(cmd);
 	}
 
-	void createCommandPool(VkDevice &device, size_t queueFamily, VkCommandPool &commandPool)
+	void ShaderObject::cmdBindShaders(VkCommandBuffer cmd) {
+		bool hasGraphicsShader = false;
+		for (uint32_t i = 0; i < m_shaders.size(); i++) {
+			if (m_shaderStages[i] == VK_SHADER_STAGE_COMPUTE_BIT)
+				vkCmdBindShadersEXT(cmd, 1, &m_shaderStages[i], &m_shaders[i]);
+			else
+				hasGraphicsShader = true;
+		}
+		if (!hasGraphicsShader)
+			return;
+
+		const uint32_t stageCount = sizeof(graphicsShaderStages) / sizeof(graphicsShaderStages[0]);
+		VkShaderEXT shaders[stageCount];
+		for (uint32_t i = 0; i < stageCount; i++) {
+			shaders[i] = VK_NULL_HANDLE;
+			for (uint32_t j = 0; j < m_shaders.size(); j++) {
+				if (m_shaderStages[j] == graphicsShaderStages[i])
+					shaders[i] = m_shaders[j];
+			}
+		}
+		vkCmdBindShadersEXT(cmd, stageCount, graphicsShaderStages, shaders);
+
+		// with the features enabled task and mesh stages are part of the graphics state and have to be unbound as well
+		VkShaderStageFlagBits meshStages[2];
+		uint32_t meshStageCount = 0;
+		if (isTaskShaderEnabled)
+			meshStages[meshStageCount++] = VK_SHADER_STAGE_TASK_BIT_EXT;
+		if (isMeshShaderEnabled)
+			meshStages[meshStageCount++] = VK_SHADER_STAGE_MESH_BIT_EXT;
+		if (meshStageCount > 0) {
+			VkShaderEXT meshShaders[2] = { VK_NULL_HANDLE, VK_NULL_HANDLE };
+			vkCmdBindShadersEXT(cmd, meshStageCount, meshStages, meshShaders);
+		}
+	}
+
+	void ShaderObject::cmdSetState(VkCommandBuffer cmd) {
+		vkCmdSetViewportWithCount(cmd, m_viewports.size(), m_viewports.data());
+		vkCmdSetScissorWithCount(cmd, m_scissors.size(), m_scissors.data());
+
+		vkCmdSetVertexInputEXT(cmd,
+			m_vertexInputBindingDescriptions.size(), m_vertexInputBindingDescriptions.data(),
+			m_vertexInputAttributeDescriptions.size(), m_vertexInputAttributeDescriptions.data()
+		);
+		vkCmdSetPrimitiveTopology(cmd, m_primitiveTopology);
+		vkCmdSetPrimitiveRestartEnable(cmd, VK_FALSE);
+
+		vkCmdSetRasterizerDiscardEnable(cmd, VK_FALSE);
+		vkCmdSetPolygonModeEXT(cmd, m_polygonMode);
+		vkCmdSetCullMode(cmd, m_cullMode);
+		vkCmdSetFrontFace(cmd, m_frontFace);
+		vkCmdSetDepthBiasEnable(cmd, VK_FALSE);
+		vkCmdSetLineWidth(cmd, 1.0f);
+		if (enabledFeatures.depthClamp)
+			vkCmdSetDepthClampEnableEXT(cmd, VK_FALSE);
+
+		for (VkShaderStageFlagBits stage : m_shaderStages) {
+			if (stage == VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT)
+				vkCmdSetPatchControlPointsEXT(cmd, m_patchControlPoints);
+			if (stage == VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT)
+				vkCmdSetTessellationDomainOriginEXT(cmd, m_tessellationDomainOrigin);
+		}
+
+		VkSampleMask sampleMask = 0xFFFFFFFF;
+		vkCmdSetRasterizationSamplesEXT(cmd, VK_SAMPLE_COUNT_1_BIT);
+		vkCmdSetSampleMaskEXT(cmd, VK_SAMPLE_COUNT_1_BIT, &sampleMask);
+		vkCmdSetAlphaToCoverageEnableEXT(cmd, VK_FALSE);
+
+		vkCmdSetDepthTestEnable(cmd, m_depthTestEnable);
+		vkCmdSetDepthWriteEnable(cmd, m_depthTestEnable);
+		vkCmdSetDepthCompareOp(cmd, m_depthCompareOp);
+		vkCmdSetDepthBoundsTestEnable(cmd, VK_FALSE);
+		vkCmdSetStencilTestEnable(cmd, m_stencilTestEnable);
+		if (m_stencilTestEnable) {
+			vkCmdSetStencilOp(cmd, VK_STENCIL_FACE_FRONT_BIT, m_stencilFront.failOp, m_stencilFront.passOp, m_stencilFront.depthFailOp, m_stencilFront.compareOp);
+			vkCmdSetStencilOp(cmd, VK_STENCIL_FACE_BACK_BIT, m_stencilBack.failOp, m_stencilBack.passOp, m_stencilBack.depthFailOp, m_stencilBack.compareOp);
+			vkCmdSetStencilCompareMask(cmd, VK_STENCIL_FACE_FRONT_BIT, m_stencilFront.compareMask);
+			vkCmdSetStencilCompareMask(cmd, VK_STENCIL_FACE_BACK_BIT, m_stencilBack.compareMask);
+			vkCmdSetStencilWriteMask(cmd, VK_STENCIL_FACE_FRONT_BIT, m_stencilFront.writeMask);
+			vkCmdSetStencilWriteMask(cmd, VK_STENCIL_FACE_BACK_BIT, m_stencilBack.writeMask);
+			vkCmdSetStencilReference(cmd, VK_STENCIL_FACE_FRONT_BIT, m_stencilFront.reference);
+			vkCmdSetStencilReference(cmd, VK_STENCIL_FACE_BACK_BIT, m_stencilBack.reference);
+		}
+
+		if (enabledFeatures.logicOp)
+			vkCmdSetLogicOpEnableEXT(cmd, VK_FALSE);
+		if (m_colorAttachmentCount > 0) {
+			std::vector<VkBool32> blendEnables(m_colorAttachmentCount, m_blendEnable);
+			std::vector<VkColorBlendEquationEXT> colorBlendEquations(m_colorAttachmentCount, m_colorBlendEquation);
+			std::vector<VkColorComponentFlags> colorWriteMasks(m_colorAttachmentCount, m_colorWriteMask);
+			vkCmdSetColorBlendEnableEXT(cmd, 0, m_colorAttachmentCount, blendEnables.data());
+			vkCmdSetColorBlendEquationEXT(cmd, 0, m_colorAttachmentCount, colorBlendEquations.data());
+			vkCmdSetColorWriteMaskEXT(cmd, 0, m_colorAttachmentCount, colorWriteMasks.data());
+		}
+	}
+
+	void ShaderObject::addVertexInputBindingDescription(const VkVertexInputBindingDescription& vertexInputBindingDescription) {
+		VkVertexInputBindingDescription2EXT description{ VK_STRUCTURE_TYPE_VERTEX_INPUT_BINDING_DESCRIPTION_2_EXT };
+		description.binding = vertexInputBindingDescription.binding;
+		description.stride = vertexInputBindingDescription.stride;
+		description.inputRate = vertexInputBindingDescription.inputRate;
+		description.divisor = 1;
+		m_vertexInputBindingDescriptions.push_back(description);
+	}
+
+	void ShaderObject::delVertexInputBindingDescription(int index) {
+		m_vertexInputBindingDescriptions.erase(m_vertexInputBindingDescriptions.begin() + index);
+	}
+
+	void ShaderObject::addVertexInputAttrubuteDescription(const VkVertexInputAttributeDescription& vertexInputAttributeDescription) {
+		VkVertexInputAttributeDescription2EXT description{ VK_STRUCTURE_TYPE_VERTEX_INPUT_ATTRIBUTE_DESCRIPTION_2_EXT };
+		description.location = vertexInputAttributeDescription.location;
+		description.binding = vertexInputAttributeDescription.binding;
+		description.format = vertexInputAttributeDescription.format;
+		description.offset = vertexInputAttributeDescription.offset;
+		m_vertexInputAttributeDescriptions.push_back(description);
+	}
+
+	void ShaderObject::delVertexInputAttrubuteDescription(int index) {
+		m_vertexInputAttributeDescriptions.erase(m_vertexInputAttributeDescriptions.begin() + index);
+	}
+
+	VkInstance getInstance() {
+		return instance;
+	}
+
+	VkPhysicalDevice getPhysicalDevice() {
+		return physicalDevice;
+	}
+
+	VkDevice getDevice() {
+		return device;
+	}
+
+	uint32_t getQueueFamily() {
+		return queueFamily;
+	}
+
+	VkQueue getAsyncComputeQueue() {
+		return asyncComputeQueue;
+	}
+
+	void createCommandPool(VkDevice &device, size_t queueFamily, VkCommandPool &commandPool)
 	{
 		VkCommandPoolCreateInfo createInfo;
 		createInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
@@ -2071,7 +3521,108 @@ namespace vk
 		m_instance.flags = flags;
 	}
 
+	// writes rows 0 to 2 of one or two 4x4 matrices as 3x4 transforms
+	static void writeTransforms(VkTransformMatrixKHR* pDstA, VkTransformMatrixKHR* pDstB, const float* pA, const float* pB, bool isColumnMajor) {
+		if (!isColumnMajor) {
+			// row major already is the layout of the transform, the last row is dropped
+#if defined(VK_FRAMEWORK_AVX2)
+			_mm256_storeu_ps(&pDstA->matrix[0][0], _mm256_loadu_ps(pA));
+			_mm_storeu_ps(&pDstA->matrix[2][0], _mm_loadu_ps(pA + 8));
+			if (pDstB) {
+				_mm256_storeu_ps(&pDstB->matrix[0][0], _mm256_loadu_ps(pB));
+				_mm_storeu_ps(&pDstB->matrix[2][0], _mm_loadu_ps(pB + 8));
+			}
+#else
+			memcpy(pDstA, pA, sizeof(VkTransformMatrixKHR));
+			if (pDstB) memcpy(pDstB, pB, sizeof(VkTransformMatrixKHR));
+#endif
+			return;
+		}
+
+#if defined(VK_FRAMEWORK_AVX2)
+		// both matrices in one register, matrix A in the low and B in the high lane, the in lane shuffles transpose each
+		if (!pB) pB = pA;
+		__m256 c0 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(pA)), _mm_loadu_ps(pB), 1);
+		__m256 c1 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(pA + 4)), _mm_loadu_ps(pB + 4), 1);
+		__m256 c2 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(pA + 8)), _mm_loadu_ps(pB + 8), 1);
+		__m256 c3 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(pA + 12)), _mm_loadu_ps(pB + 12), 1);
+		__m256 t0 = _mm256_unpacklo_ps(c0, c1);
+		__m256 t1 = _mm256_unpackhi_ps(c0, c1);
+		__m256 t2 = _mm256_unpacklo_ps(c2, c3);
+		__m256 t3 = _mm256_unpackhi_ps(c2, c3);
+		__m256 row0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+		__m256 row1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+		__m256 row2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+		_mm_storeu_ps(pDstA->matrix[0], _mm256_castps256_ps128(row0));
+		_mm_storeu_ps(pDstA->matrix[1], _mm256_castps256_ps128(row1));
+		_mm_storeu_ps(pDstA->matrix[2], _mm256_castps256_ps128(row2));
+		if (pDstB) {
+			_mm_storeu_ps(pDstB->matrix[0], _mm256_extractf128_ps(row0, 1));
+			_mm_storeu_ps(pDstB->matrix[1], _mm256_extractf128_ps(row1, 1));
+			_mm_storeu_ps(pDstB->matrix[2], _mm256_extractf128_ps(row2, 1));
+		}
+#else
+		VkTransformMatrixKHR* pDsts[2] = { pDstA, pDstB };
+		const float* pSrcs[2] = { pA, pB };
+		for (int i = 0; i < 2 && pDsts[i]; i++) {
+#if defined(VK_FRAMEWORK_SSE)
+			__m128 c0 = _mm_loadu_ps(pSrcs[i]);
+			__m128 c1 = _mm_loadu_ps(pSrcs[i] + 4);
+			__m128 c2 = _mm_loadu_ps(pSrcs[i] + 8);
+			__m128 c3 = _mm_loadu_ps(pSrcs[i] + 12);
+			_MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+			_mm_storeu_ps(pDsts[i]->matrix[0], c0);
+			_mm_storeu_ps(pDsts[i]->matrix[1], c1);
+			_mm_storeu_ps(pDsts[i]->matrix[2], c2);
+#elif defined(VK_FRAMEWORK_NEON)
+			// the de-interleaving load transposes
+			float32x4x4_t rows = vld4q_f32(pSrcs[i]);
+			vst1q_f32(pDsts[i]->matrix[0], rows.val[0]);
+			vst1q_f32(pDsts[i]->matrix[1], rows.val[1]);
+			vst1q_f32(pDsts[i]->matrix[2], rows.val[2]);
+#else
+			for (int row = 0; row < 3; row++)
+				for (int column = 0; column < 4; column++)
+					pDsts[i]->matrix[row][column] = pSrcs[i][column * 4 + row];
+#endif
+		}
+#endif
+	}
+
+	void AccelerationStructureInstance::writeBatch(VkAccelerationStructureInstanceKHR* pDst, uint32_t count, const AccelerationStructureInstance& templateInstance, const Batch& batch) {
+		const VkAccelerationStructureInstanceKHR& templ = templateInstance.m_instance;
+		const uint8_t* pMatrixBytes = (const uint8_t*)batch.pMatrices;
+
+		// two instances per iteration, so the AVX2 path can transpose a pair in one register
+		for (uint32_t i = 0; i < count; i += 2) {
+			bool hasPair = i + 1 < count;
+			const float* pA = (const float*)(pMatrixBytes + size_t(i) * batch.matrixStride);
+			const float* pB = hasPair ? (const float*)(pMatrixBytes + size_t(i + 1) * batch.matrixStride) : nullptr;
+			writeTransforms(&pDst[i].transform, hasPair ? &pDst[i + 1].transform : nullptr, pA, pB, batch.isColumnMajor);
+
+			for (uint32_t j = i; j < i + (hasPair ? 2 : 1); j++) {
+				VkAccelerationStructureInstanceKHR& instance = pDst[j];
+				instance.instanceCustomIndex = batch.pCustomIndices ? batch.pCustomIndices[j] : templ.instanceCustomIndex;
+				instance.mask = batch.pMasks ? batch.pMasks[j] : templ.mask;
+				instance.instanceShaderBindingTableRecordOffset = batch.pShaderBindingTableRecordOffsets ? batch.pShaderBindingTableRecordOffsets[j] : templ.instanceShaderBindingTableRecordOffset;
+				instance.flags = templ.flags;
+				instance.accelerationStructureReference = batch.pAccelerationStructureReferences ? batch.pAccelerationStructureReferences[j] : templ.accelerationStructureReference;
+			}
+		}
+	}
+
 	/* AccelerationStructure */
+	static const VkPhysicalDeviceAccelerationStructurePropertiesKHR& getAccelerationStructureProperties() {
+		static VkPhysicalDeviceAccelerationStructurePropertiesKHR properties = []() {
+			VkPhysicalDeviceAccelerationStructurePropertiesKHR accelerationStructureProperties{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR };
+			VkPhysicalDeviceProperties2 properties2{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+			properties2.pNext = &accelerationStructureProperties;
+			vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+			return accelerationStructureProperties;
+		}();
+		return properties;
+	}
+
 	AccelerationStructure::AccelerationStructure() {}
 	AccelerationStructure::~AccelerationStructure() {}
 
@@ -2097,7 +3648,7 @@ namespace vk
 		// TLAS specific initialisation
 		if (m_type == VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR) {
 			m_instancesBuffer = Buffer(
-				sizeof(AccelerationStructureInstance),
+				sizeof(VkAccelerationStructureInstanceKHR),
 				VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
 			);
 			m_instancesBuffer.init(); m_instancesBuffer.allocate(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
@@ -2112,40 +3663,111 @@ namespace vk
 		if (!m_isInit) return;
 		m_isInit = false;
 
-		for (auto buffer : m_additionalBuffers) {
-			buffer->destroy();
-			delete buffer;
-		}
-		m_additionalBuffers.clear();
+		for (Buffer& buffer : m_geometryBuffers)
+			buffer.destroy();
+		m_geometryBuffers.clear();
 		vkDestroyAccelerationStructureKHR(device, m_accelerationStructure, nullptr);
 		m_buffer.destroy();
+		m_isBuilt = false;
 
 		// TLAS specific destruction
 		if (m_type == VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR) {
 			m_instancesBuffer.destroy();
+			for (InstanceSlot& slot : m_instanceSlots) {
+				slot.buffer.unmap();
+				slot.buffer.destroy();
+			}
+			m_instanceSlots.clear();
+			m_mappedSlotIndex = -1;
+			m_instanceScratchBuffer.destroy();
 		}
 	}
 
 	void AccelerationStructure::update() {
+		build(false);
+	}
+
+	void AccelerationStructure::refit() {
+		build(true);
+	}
+
+	bool AccelerationStructure::canRefit() const {
+		if (!m_isBuilt || !VK_IS_FLAG_ENABLED(m_builtFlags, VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR))
+			return false;
+		if (getBuildFlags() != m_builtFlags || m_buildRangeInfoVector.size() != m_builtPrimitiveCounts.size())
+			return false;
+		for (size_t i = 0; i < m_buildRangeInfoVector.size(); i++) {
+			if (m_buildRangeInfoVector[i].primitiveCount != m_builtPrimitiveCounts[i])
+				return false;
+		}
+		return true;
+	}
+
+	void AccelerationStructure::build(bool isRefit) {
 		if (m_geometryVector.empty())
 			return;
 
-		VkAccelerationStructureBuildGeometryInfoKHR buildGeometryInfo{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR };
+		VkAccelerationStructureKHR oldHandle = m_accelerationStructure;
+
+		VkAccelerationStructureBuildGeometryInfoKHR buildGeometryInfo;
+		VkDeviceSize scratchSize = prepareBuild(buildGeometryInfo, isRefit);
+
+		Buffer scratchBuffer = Buffer(scratchSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+		scratchBuffer.init(); scratchBuffer.allocate(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+		buildGeometryInfo.scratchData.deviceAddress = scratchBuffer.getVkDeviceAddress();
+
+		VkAccelerationStructureBuildRangeInfoKHR* pBuildRangeInfo = &m_buildRangeInfoVector[0];
+
+		CommandBuffer cmd; cmd.allocate(); cmd.begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+
+		vkCmdBuildAccelerationStructuresKHR(cmd, 1, &buildGeometryInfo, &pBuildRangeInfo);
+
+		cmd.end(); cmd.submit(); cmd.free();
+
+		scratchBuffer.destroy();
+
+		// dependencies only need updating when the handle changed
+		if (m_accelerationStructure != oldHandle)
+			Registerable::update();
+	}
+
+	VkBuildAccelerationStructureFlagsKHR AccelerationStructure::getBuildFlags() const {
+		VkBuildAccelerationStructureFlagsKHR buildFlags = m_buildFlags;
+		if (m_isCompactionEnabled)
+			buildFlags |= VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+		return buildFlags;
+	}
+
+	VkDeviceSize AccelerationStructure::prepareBuild(VkAccelerationStructureBuildGeometryInfoKHR& buildGeometryInfo, bool isRefit) {
+		isRefit &= canRefit();
+
+		buildGeometryInfo = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR };
 		buildGeometryInfo.pNext = nullptr;
 		buildGeometryInfo.type = m_type;
-		buildGeometryInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR;
-		buildGeometryInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
+		buildGeometryInfo.mode = isRefit ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR : VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+		buildGeometryInfo.flags = getBuildFlags();
 		buildGeometryInfo.geometryCount = m_geometryVector.size();
 		buildGeometryInfo.pGeometries = m_geometryVector.data();
-		buildGeometryInfo.srcAccelerationStructure = m_accelerationStructure;
+		buildGeometryInfo.srcAccelerationStructure = isRefit ? m_accelerationStructure : VK_NULL_HANDLE;
 		buildGeometryInfo.dstAccelerationStructure = m_accelerationStructure;
 
 		VkAccelerationStructureBuildSizesInfoKHR sizeInfo{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
 
+		// one maximum primitive count per geometry
+		std::vector<uint32_t> maxPrimitiveCounts(m_buildRangeInfoVector.size());
+		for (size_t i = 0; i < m_buildRangeInfoVector.size(); i++)
+			maxPrimitiveCounts[i] = m_buildRangeInfoVector[i].primitiveCount;
+
 		vkGetAccelerationStructureBuildSizesKHR(device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
-			&buildGeometryInfo, &m_buildRangeInfoVector[0].primitiveCount, &sizeInfo);
+			&buildGeometryInfo, maxPrimitiveCounts.data(), &sizeInfo);
+
+		// a refit writes in place, the topology and therefore the size are unchanged
+		if (isRefit)
+			return sizeInfo.updateScratchSize;
 
-		//if (sizeInfo.accelerationStructureSize != m_buffer.getSize()) {
+		// the structure is only recreated if the build doesn't fit, so its handle and address stay valid
+		if (sizeInfo.accelerationStructureSize > m_buffer.getSize()) {
 			m_buffer.resize(sizeInfo.accelerationStructureSize);
 
 			vkDestroyAccelerationStructureKHR(device, m_accelerationStructure, nullptr);
@@ -2162,27 +3784,14 @@ namespace vk
 
 			vkCreateAccelerationStructureKHR(device, &createInfo, nullptr, &m_accelerationStructure);
 
-			buildGeometryInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
-			buildGeometryInfo.srcAccelerationStructure = VK_NULL_HANDLE;
 			buildGeometryInfo.dstAccelerationStructure = m_accelerationStructure;
-		//}
-
-		Buffer scratchBuffer = Buffer(sizeInfo.buildScratchSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
-		scratchBuffer.init(); scratchBuffer.allocate(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-		buildGeometryInfo.scratchData.deviceAddress = scratchBuffer.getVkDeviceAddress();
-
-		VkAccelerationStructureBuildRangeInfoKHR* pBuildRangeInfo = &m_buildRangeInfoVector[0];
-
-		CommandBuffer cmd; cmd.allocate(); cmd.begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
-
-		vkCmdBuildAccelerationStructuresKHR(cmd, 1, &buildGeometryInfo, &pBuildRangeInfo);
-
-		cmd.end(); cmd.submit(); cmd.free();
+		}
 
-		scratchBuffer.destroy();
+		m_isBuilt = true;
+		m_builtFlags = buildGeometryInfo.flags;
+		m_builtPrimitiveCounts = maxPrimitiveCounts;
 
-		Registerable::update();
+		return sizeInfo.buildScratchSize;
 	}
 
 	void AccelerationStructure::setGeometry(std::vector<AccelerationStructureInstance>& instances) {
@@ -2190,8 +3799,8 @@ namespace vk
 		if (countInstances <= 0)
 			return;
 
-		if (countInstances * sizeof(AccelerationStructureInstance) != m_instancesBuffer.getSize())
-			m_instancesBuffer.resize(countInstances * sizeof(AccelerationStructureInstance));
+		if (countInstances * sizeof(VkAccelerationStructureInstanceKHR) != m_instancesBuffer.getSize())
+			m_instancesBuffer.resize(countInstances * sizeof(VkAccelerationStructureInstanceKHR));
 
 		m_instancesBuffer.uploadData(m_instancesBuffer.getSize(), instances.data());
 
@@ -2208,195 +3817,1916 @@ namespace vk
 		m_buildRangeInfoVector.push_back({(uint32_t)instances.size(), 0, 0, 0});
 	}
 
-	void AccelerationStructure::addGeometry(const Buffer& vertexBuffer, uint32_t vertexStride, const Buffer& indexBuffer) {
-		auto vertexAddress = vkUtils::getBufferDeviceAddress(device, vertexBuffer);
-		auto indexAddress = vkUtils::getBufferDeviceAddress(device, indexBuffer);
+	static_assert(sizeof(AccelerationStructureInstance) == sizeof(VkAccelerationStructureInstanceKHR), "AccelerationStructureInstance has to match VkAccelerationStructureInstanceKHR");
+
+	static bool isMemoryTypeAvailable(VkMemoryPropertyFlags memoryPropertyFlags) {
+		VkPhysicalDeviceMemoryProperties memoryProperties;
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+		for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+			if (VK_IS_FLAG_ENABLED(memoryProperties.memoryTypes[i].propertyFlags, memoryPropertyFlags))
+				return true;
+		}
+		return false;
+	}
+
+	// a large heap that is both device local and host visible, small heaps like the 256MB BAR window are left to the driver
+	static bool isResizableBarAvailable() {
+		VkPhysicalDeviceMemoryProperties memoryProperties;
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+		VkMemoryPropertyFlags memoryPropertyFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+		for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+			const VkMemoryType& memoryType = memoryProperties.memoryTypes[i];
+			if (VK_IS_FLAG_ENABLED(memoryType.propertyFlags, memoryPropertyFlags)
+				&& memoryProperties.memoryHeaps[memoryType.heapIndex].size > 256ull * 1024 * 1024)
+				return true;
+		}
+		return false;
+	}
+
+	void AccelerationStructure::setInstanceCapacity(uint32_t capacity) {
+		if (m_type != VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR) {
+			std::cerr << "ERROR: Instances can only be streamed into a TLAS\n";
+			throw std::runtime_error("Instance stream on BLAS");
+		}
+
+		syncMappedInstances(); // the new slots are filled from the cpu copy
+		for (InstanceSlot& slot : m_instanceSlots) {
+			slot.buffer.unmap();
+			slot.buffer.destroy();
+		}
+
+		VkMemoryPropertyFlags memoryPropertyFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+		if (isMemoryTypeAvailable(memoryPropertyFlags | VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+			memoryPropertyFlags |= VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+
+		m_instances.resize(std::min<size_t>(m_instances.size(), capacity));
+		m_instanceSlots.resize(VK_MIN_AMOUNT_OF_SWAPCHAIN_IMAGES);
+		for (InstanceSlot& slot : m_instanceSlots) {
+			slot.buffer = Buffer(std::max(capacity, 1u) * sizeof(VkAccelerationStructureInstanceKHR),
+				VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+			);
+			slot.buffer.init(); slot.buffer.allocate(memoryPropertyFlags);
+			slot.buffer.map((void**)&slot.pMappedInstances);
+			slot.deviceAddress = slot.buffer.getVkDeviceAddress();
+			slot.dirtyFirst = 0;
+			slot.dirtyEnd = m_instances.size();
+		}
+		m_instanceSlotIndex = 0;
+
+		// size the structure and scratch for the capacity, so builds never recreate it
+		VkAccelerationStructureGeometryKHR instanceGeometry{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR };
+		instanceGeometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
+		instanceGeometry.geometry.instances = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR };
+		instanceGeometry.geometry.instances.data.deviceAddress = m_instanceSlots[0].deviceAddress;
+
+		m_geometryVector = { instanceGeometry };
+		m_buildRangeInfoVector = { { capacity, 0, 0, 0 } };
+
+		VkAccelerationStructureKHR oldHandle = m_accelerationStructure;
+
+		VkAccelerationStructureBuildGeometryInfoKHR buildGeometryInfo;
+		VkDeviceSize buildScratchSize = prepareBuild(buildGeometryInfo);
+
+		VkAccelerationStructureBuildSizesInfoKHR sizeInfo{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
+		vkGetAccelerationStructureBuildSizesKHR(device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildGeometryInfo, &capacity, &sizeInfo);
+		m_isBuilt = false; // nothing was built yet, the first cmdBuildInstances has to build
+
+		VkDeviceSize alignment = getAccelerationStructureProperties().minAccelerationStructureScratchOffsetAlignment;
+		m_instanceScratchBuffer.destroy();
+		m_instanceScratchBuffer = Buffer(std::max(buildScratchSize, sizeInfo.updateScratchSize) + alignment,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+		);
+		m_instanceScratchBuffer.init(); m_instanceScratchBuffer.allocate(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		m_instanceScratchAddress = align_up(m_instanceScratchBuffer.getVkDeviceAddress(), alignment);
+
+		m_buildRangeInfoVector[0].primitiveCount = m_instances.size();
+
+		// dependencies only need updating when the handle changed
+		if (m_accelerationStructure != oldHandle)
+			Registerable::update();
+	}
+
+	void AccelerationStructure::checkInstanceStream() const {
+		if (m_instanceSlots.empty()) {
+			std::cerr << "ERROR: TLAS has no instance stream, call setInstanceCapacity first\n";
+			throw std::runtime_error("Instance stream not initialized");
+		}
+	}
+
+	void AccelerationStructure::markInstancesDirty(uint32_t first, uint32_t end) {
+		if (first >= end)
+			return;
+		for (InstanceSlot& slot : m_instanceSlots) {
+			if (slot.dirtyFirst >= slot.dirtyEnd) {
+				slot.dirtyFirst = first;
+				slot.dirtyEnd = end;
+			}
+			else {
+				slot.dirtyFirst = std::min(slot.dirtyFirst, first);
+				slot.dirtyEnd = std::max(slot.dirtyEnd, end);
+			}
+		}
+	}
+
+	void AccelerationStructure::syncMappedInstances() {
+		if (m_mappedSlotIndex < 0)
+			return;
+		// only read back when the data is needed elsewhere, mapped memory can be slow to read
+		memcpy(m_instances.data(), m_instanceSlots[m_mappedSlotIndex].pMappedInstances, m_instances.size() * sizeof(VkAccelerationStructureInstanceKHR));
+		m_mappedSlotIndex = -1;
+	}
+
+	void AccelerationStructure::setInstanceCount(uint32_t count) {
+		checkInstanceStream();
+		syncMappedInstances();
+		if (count > m_instanceSlots[0].buffer.getSize() / sizeof(VkAccelerationStructureInstanceKHR)) {
+			std::cerr << "ERROR: Instance count exceeds the capacity of the instance stream | Count: " << count << "\n";
+			throw std::runtime_error("Instance capacity exceeded");
+		}
+		uint32_t oldCount = m_instances.size();
+		m_instances.resize(count);
+		// the mapped slots hold garbage past the old count
+		markInstancesDirty(oldCount, count);
+	}
+
+	void AccelerationStructure::setInstance(uint32_t index, const AccelerationStructureInstance& instance) {
+		checkInstanceStream();
+		if (index >= m_instances.size()) {
+			std::cerr << "ERROR: Instance index out of range, call setInstanceCount first | Index: " << index << " Count: " << m_instances.size() << "\n";
+			throw std::runtime_error("Instance index out of range");
+		}
+		syncMappedInstances();
+		m_instances[index] = instance.m_instance;
+		markInstancesDirty(index, index + 1);
+	}
+
+	void AccelerationStructure::cmdBuildInstances(VkCommandBuffer cmd, bool isRefit) {
+		checkInstanceStream();
+		InstanceSlot& slot = m_instanceSlots[m_instanceSlotIndex];
+		uint32_t dirtyEnd = std::min<uint32_t>(slot.dirtyEnd, m_instances.size());
+		if (slot.dirtyFirst < dirtyEnd) {
+			syncMappedInstances();
+			memcpy(slot.pMappedInstances + slot.dirtyFirst, m_instances.data() + slot.dirtyFirst, (dirtyEnd - slot.dirtyFirst) * sizeof(VkAccelerationStructureInstanceKHR));
+		}
+		slot.dirtyFirst = 0;
+		slot.dirtyEnd = 0;
+
+		m_geometryVector[0].geometry.instances.data.deviceAddress = slot.deviceAddress;
+		m_buildRangeInfoVector[0].primitiveCount = m_instances.size();
+
+		// the structure was sized for the capacity, prepareBuild won't recreate it
+		VkAccelerationStructureBuildGeometryInfoKHR buildGeometryInfo;
+		prepareBuild(buildGeometryInfo, isRefit);
+		buildGeometryInfo.scratchData.deviceAddress = m_instanceScratchAddress;
+
+		// the previous build and traces have to be done with the structure and scratch memory
+		VkMemoryBarrier barrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+		barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+		barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+		vkCmdPipelineBarrier(cmd,
+			VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+			0, 1, &barrier, 0, nullptr, 0, nullptr
+		);
+
+		const VkAccelerationStructureBuildRangeInfoKHR* pBuildRangeInfo = &m_buildRangeInfoVector[0];
+		vkCmdBuildAccelerationStructuresKHR(cmd, 1, &buildGeometryInfo, &pBuildRangeInfo);
+
+		barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+		barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+		vkCmdPipelineBarrier(cmd,
+			VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+			0, 1, &barrier, 0, nullptr, 0, nullptr
+		);
+
+		m_instanceSlotIndex = (m_instanceSlotIndex + 1) % m_instanceSlots.size();
+	}
+
+	VkAccelerationStructureInstanceKHR* AccelerationStructure::mapInstances(uint32_t count) {
+		m_mappedSlotIndex = -1; // the previously mapped instances are overwritten, no need to read them back
+		setInstanceCount(count);
+
+		// the caller writes the whole slot, the other slots are outdated and get the instances from the cpu copy,
+		// which reads them back from this slot only when they are built or the instances are changed otherwise
+		markInstancesDirty(0, count);
+		InstanceSlot& slot = m_instanceSlots[m_instanceSlotIndex];
+		slot.dirtyFirst = 0;
+		slot.dirtyEnd = 0;
+		m_mappedSlotIndex = m_instanceSlotIndex;
+		return slot.pMappedInstances;
+	}
+
+	void AccelerationStructure::setInstances(uint32_t count, const AccelerationStructureInstance& templateInstance, const AccelerationStructureInstance::Batch& batch) {
+		AccelerationStructureInstance::writeBatch(mapInstances(count), count, templateInstance, batch);
+	}
+
+	void AccelerationStructure::addGeometry(const Buffer& vertexBuffer, uint32_t vertexStride, const Buffer& indexBuffer, VkGeometryFlagsKHR flags) {
+		uint32_t primitiveCount = indexBuffer.getSize() / (sizeof(uint32_t) * 3);
+		addGeometry(vertexBuffer, vertexStride, indexBuffer, 0, primitiveCount, 0, flags);
+	}
+
+	void AccelerationStructure::addGeometry(const Buffer& vertexBuffer, uint32_t vertexStride, const Buffer& indexBuffer,
+		uint32_t firstPrimitive, uint32_t primitiveCount, uint32_t firstVertex, VkGeometryFlagsKHR flags)
+	{
+		TriangleGeometry geometry;
+		geometry.pVertexBuffer = &vertexBuffer;
+		geometry.vertexStride = vertexStride;
+		geometry.pIndexBuffer = &indexBuffer;
+		geometry.firstPrimitive = firstPrimitive;
+		geometry.primitiveCount = primitiveCount;
+		geometry.firstVertex = firstVertex;
+		geometry.flags = flags;
+		addGeometry(geometry);
+	}
+
+	static uint32_t getFormatComponentSize(VkFormat format) {
+		switch (format) {
+		case VK_FORMAT_R32G32_SFLOAT:
+		case VK_FORMAT_R32G32B32_SFLOAT:
+		case VK_FORMAT_R32G32B32A32_SFLOAT:
+		case VK_FORMAT_A2B10G10R10_UNORM_PACK32: // packed formats are aligned to their whole size
+			return 4;
+		case VK_FORMAT_R16G16_SFLOAT:
+		case VK_FORMAT_R16G16B16_SFLOAT:
+		case VK_FORMAT_R16G16B16A16_SFLOAT:
+		case VK_FORMAT_R16G16_SNORM:
+		case VK_FORMAT_R16G16B16_SNORM:
+		case VK_FORMAT_R16G16B16A16_SNORM:
+		case VK_FORMAT_R16G16_UNORM:
+		case VK_FORMAT_R16G16B16_UNORM:
+		case VK_FORMAT_R16G16B16A16_UNORM:
+			return 2;
+		case VK_FORMAT_R8G8_SNORM:
+		case VK_FORMAT_R8G8B8A8_SNORM:
+		case VK_FORMAT_R8G8_UNORM:
+		case VK_FORMAT_R8G8B8A8_UNORM:
+			return 1;
+		default:
+			return 0; // unknown, the alignment can't be checked
+		}
+	}
+
+	static void checkTransformOffset(uint32_t transformOffset) {
+		if (transformOffset % 16 != 0) {
+			std::cerr << "ERROR: Transform offset has to be a multiple of 16 | Offset: " << transformOffset << "\n";
+			throw std::runtime_error("Misaligned transform offset");
+		}
+	}
+
+	void AccelerationStructure::addGeometry(const TriangleGeometry& geometry) {
+		if (!m_geometryVector.empty() && m_geometryVector[0].geometryType != VK_GEOMETRY_TYPE_TRIANGLES_KHR) {
+			std::cerr << "ERROR: AccelerationStructure can't mix triangle and aabb geometries\n";
+			throw std::runtime_error("Mixed geometry types");
+		}
+		if (geometry.pTransformBuffer)
+			checkTransformOffset(geometry.transformOffset); // before anything is added
+
+		VkFormatProperties formatProperties;
+		vkGetPhysicalDeviceFormatProperties(physicalDevice, geometry.vertexFormat, &formatProperties);
+		if (!VK_IS_FLAG_ENABLED(formatProperties.bufferFeatures, VK_FORMAT_FEATURE_ACCELERATION_STRUCTURE_VERTEX_BUFFER_BIT_KHR)) {
+			std::cerr << "ERROR: Vertex format isn't supported for acceleration structures | Format: " << geometry.vertexFormat << "\n";
+			throw std::runtime_error("Unsupported acceleration structure vertex format");
+		}
+		uint32_t componentSize = getFormatComponentSize(geometry.vertexFormat);
+		if (componentSize == 0) {
+			std::cerr << "ERROR: Component size of the acceleration structure vertex format is unknown | Format: " << geometry.vertexFormat << "\n";
+			throw std::runtime_error("Unknown acceleration structure vertex format");
+		}
+		if (geometry.vertexOffset % componentSize != 0) {
+			std::cerr << "ERROR: Vertex offset has to be aligned to the component size of the format | Offset: " << geometry.vertexOffset << "\n";
+			throw std::runtime_error("Misaligned vertex offset");
+		}
+
+		if (geometry.vertexStride == 0) {
+			std::cerr << "ERROR: Vertex stride of acceleration structure geometry can't be 0\n";
+			throw std::runtime_error("Invalid vertex stride");
+		}
+		if (geometry.vertexStride % componentSize != 0) {
+			std::cerr << "ERROR: Vertex stride has to be a multiple of the component size of the format | Stride: " << geometry.vertexStride << "\n";
+			throw std::runtime_error("Misaligned vertex stride");
+		}
+		if (geometry.vertexOffset > geometry.pVertexBuffer->getSize()) {
+			std::cerr << "ERROR: Vertex offset is past the end of the vertex buffer | Offset: " << geometry.vertexOffset << "\n";
+			throw std::runtime_error("Vertex offset out of range");
+		}
 
-		uint32_t primitiveCount = indexBuffer.getSize() / (sizeof(uint32_t) * 3.0f);
+		VkDeviceSize vertexCount = (geometry.pVertexBuffer->getSize() - geometry.vertexOffset) / geometry.vertexStride;
 
 		VkAccelerationStructureGeometryTrianglesDataKHR triangleData{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR };
-		triangleData.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
-		triangleData.vertexData.deviceAddress = vertexAddress;
-		triangleData.vertexStride = vertexStride;
+		triangleData.vertexFormat = geometry.vertexFormat;
+		triangleData.vertexData.deviceAddress = vkUtils::getBufferDeviceAddress(device, *geometry.pVertexBuffer) + geometry.vertexOffset;
+		triangleData.vertexStride = geometry.vertexStride;
+		triangleData.maxVertex = vertexCount > 0 ? vertexCount - 1 : 0;
+		triangleData.transformData.deviceAddress = 0;
+
+		uint32_t primitiveSize; // bytes per primitive in the buffer primitiveOffset applies to
+		uint32_t primitiveCount = geometry.primitiveCount;
+		VkDeviceSize availablePrimitives; // whole primitives from the start of the data to the end of the buffer
+		if (geometry.pIndexBuffer) {
+			uint32_t indexSize;
+			switch (geometry.indexType) {
+			case VK_INDEX_TYPE_UINT16: indexSize = sizeof(uint16_t); break;
+			case VK_INDEX_TYPE_UINT32: indexSize = sizeof(uint32_t); break;
+			default:
+				std::cerr << "ERROR: Acceleration structure indices have to be VK_INDEX_TYPE_UINT16 or VK_INDEX_TYPE_UINT32 | Type: " << geometry.indexType << "\n";
+				throw std::runtime_error("Unsupported acceleration structure index type");
+			}
+			if (geometry.indexOffset % indexSize != 0) {
+				std::cerr << "ERROR: Index offset has to be aligned to the index size | Offset: " << geometry.indexOffset << "\n";
+				throw std::runtime_error("Misaligned index offset");
+			}
+			if (geometry.indexOffset > geometry.pIndexBuffer->getSize()) {
+				std::cerr << "ERROR: Index offset is past the end of the index buffer | Offset: " << geometry.indexOffset << "\n";
+				throw std::runtime_error("Index offset out of range");
+			}
+			triangleData.indexType = geometry.indexType;
+			triangleData.indexData.deviceAddress = vkUtils::getBufferDeviceAddress(device, *geometry.pIndexBuffer) + geometry.indexOffset;
 
-		triangleData.indexType = VK_INDEX_TYPE_UINT32;
-		triangleData.indexData.deviceAddress = indexAddress;
+			primitiveSize = indexSize * 3;
+			availablePrimitives = (geometry.pIndexBuffer->getSize() - geometry.indexOffset) / primitiveSize;
+		}
+		else {
+			// non indexed, primitiveOffset then points into the vertices
+			triangleData.indexType = VK_INDEX_TYPE_NONE_KHR;
+			triangleData.indexData.deviceAddress = 0;
 
-		triangleData.maxVertex = vertexBuffer.getSize() / vertexStride;
+			primitiveSize = geometry.vertexStride * 3;
+			availablePrimitives = vertexCount / 3;
+		}
+		if (primitiveCount == 0) {
+			// count the primitives from firstPrimitive to the end of the buffer
+			if (geometry.firstPrimitive >= availablePrimitives) {
+				std::cerr << "ERROR: First primitive is past the end of the geometry buffer | First primitive: " << geometry.firstPrimitive << " | Primitives in buffer: " << availablePrimitives << "\n";
+				throw std::runtime_error("First primitive out of range");
+			}
+			primitiveCount = availablePrimitives - geometry.firstPrimitive;
+		}
+		else if ((VkDeviceSize)geometry.firstPrimitive + primitiveCount > availablePrimitives) {
+			std::cerr << "ERROR: Primitives are past the end of the geometry buffer | First primitive: " << geometry.firstPrimitive << " | Primitive count: " << primitiveCount << " | Primitives in buffer: " << availablePrimitives << "\n";
+			throw std::runtime_error("Primitives out of range");
+		}
 
 		VkAccelerationStructureGeometryKHR triangleGeometry{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR };
 		triangleGeometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
-		triangleGeometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+		triangleGeometry.flags = geometry.flags;
 		triangleGeometry.geometry.triangles = triangleData;
 
 		VkAccelerationStructureBuildRangeInfoKHR offset;
-		offset.firstVertex = 0;
+		offset.firstVertex = geometry.firstVertex;
 		offset.primitiveCount = primitiveCount;
-		offset.primitiveOffset = 0;
+		offset.primitiveOffset = geometry.firstPrimitive * primitiveSize; // in bytes
 		offset.transformOffset = 0;
 
 		m_geometryVector.push_back(triangleGeometry);
-		m_buildRangeInfoVector.clear(); // remove when supporting multiple geometries
 		m_buildRangeInfoVector.push_back(offset);
+
+		if (geometry.pTransformBuffer)
+			setGeometryTransform(m_geometryVector.size() - 1, *geometry.pTransformBuffer, geometry.transformOffset);
 	}
 
 	void AccelerationStructure::addGeometry(float aabbMin[3], float aabbMax[3]) {
-		vk::Buffer* aabbBuffer = new vk::Buffer(
-			sizeof(float)*6,
+		VkAabbPositionsKHR aabb = { aabbMin[0], aabbMin[1], aabbMin[2], aabbMax[0], aabbMax[1], aabbMax[2] };
+		addAabbs(&aabb, 1, sizeof(VkAabbPositionsKHR), 0);
+	}
+
+	void AccelerationStructure::addAabbs(const VkAabbPositionsKHR* pAabbs, uint32_t aabbCount, uint32_t stride, VkGeometryFlagsKHR flags) {
+		if (aabbCount == 0)
+			return;
+
+		VkDeviceSize size = aabbCount * sizeof(VkAabbPositionsKHR);
+		Buffer aabbBuffer = Buffer(size,
 			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
 			VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
 			VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
 			VK_BUFFER_USAGE_TRANSFER_DST_BIT
 		);
-		aabbBuffer->init(); aabbBuffer->allocate(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		aabbBuffer.init(); aabbBuffer.allocate(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 		{
-			auto staging = vk::Buffer(sizeof(float) * 6, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+			// tightly packed in the staging buffer, so the device copy is a single transfer
+			auto staging = vk::Buffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
 			staging.init(); staging.allocate(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 			void* rawData; staging.map(&rawData);
-			float* data = (float*)rawData;
-			memcpy(data, aabbMin, sizeof(float)*3);
-			memcpy(&data[3], aabbMax, sizeof(float) * 3);
+			if (stride == sizeof(VkAabbPositionsKHR)) {
+				memcpy(rawData, pAabbs, size);
+			}
+			else {
+				VkAabbPositionsKHR* data = (VkAabbPositionsKHR*)rawData;
+				for (uint32_t i = 0; i < aabbCount; i++)
+					data[i] = *(const VkAabbPositionsKHR*)((const uint8_t*)pAabbs + i * stride);
+			}
 			staging.unmap();
-			aabbBuffer->uploadData(&staging);
+			aabbBuffer.uploadData(&staging);
 			staging.destroy();
 		}
-		
-		auto bufferAddress = vkUtils::getBufferDeviceAddress(device, *aabbBuffer);
+
+		m_geometryBuffers.push_back(aabbBuffer);
+		addAabbs(aabbBuffer, aabbCount, sizeof(VkAabbPositionsKHR), 0, flags);
+	}
+
+	void AccelerationStructure::addAabbs(const Buffer& aabbBuffer, uint32_t aabbCount, uint32_t stride, VkDeviceSize offset, VkGeometryFlagsKHR flags) {
+		if (!m_geometryVector.empty() && m_geometryVector[0].geometryType != VK_GEOMETRY_TYPE_AABBS_KHR) {
+			std::cerr << "ERROR: AccelerationStructure can't mix triangle and aabb geometries\n";
+			throw std::runtime_error("Mixed geometry types");
+		}
+		if (stride == 0 || stride % 8 != 0) {
+			std::cerr << "ERROR: Aabb stride has to be a non zero multiple of 8 | Stride: " << stride << "\n";
+			throw std::runtime_error("Invalid aabb stride");
+		}
+		if (offset % 8 != 0) {
+			std::cerr << "ERROR: Aabb offset has to be a multiple of 8 | Offset: " << offset << "\n";
+			throw std::runtime_error("Misaligned aabb offset");
+		}
+		// the last aabb only needs its own size, not a whole stride
+		if (aabbCount > 0 && offset + (VkDeviceSize)(aabbCount - 1) * stride + sizeof(VkAabbPositionsKHR) > aabbBuffer.getSize()) {
+			std::cerr << "ERROR: Aabbs are past the end of the buffer | Offset: " << offset << " | Count: " << aabbCount << " | Stride: " << stride << " | Buffer size: " << aabbBuffer.getSize() << "\n";
+			throw std::runtime_error("Aabbs out of range");
+		}
 
 		VkAccelerationStructureGeometryAabbsDataKHR aabbData{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_AABBS_DATA_KHR };
-		aabbData.data.deviceAddress = bufferAddress;
-		aabbData.stride             = sizeof(float) * 6;
+		aabbData.data.deviceAddress = vkUtils::getBufferDeviceAddress(device, aabbBuffer) + offset;
+		aabbData.stride             = stride;
 
 		VkAccelerationStructureGeometryKHR aabbGeometry{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR };
 		aabbGeometry.geometryType   = VK_GEOMETRY_TYPE_AABBS_KHR;
+		aabbGeometry.flags          = flags;
 		aabbGeometry.geometry.aabbs = aabbData;
 
-		VkAccelerationStructureBuildRangeInfoKHR offset;
-		offset.firstVertex = 0;
-		offset.primitiveCount = 1;
-		offset.primitiveOffset = 0;
-		offset.transformOffset = 0;
+		VkAccelerationStructureBuildRangeInfoKHR offsetInfo;
+		offsetInfo.firstVertex = 0;
+		offsetInfo.primitiveCount = aabbCount;
+		offsetInfo.primitiveOffset = 0;
+		offsetInfo.transformOffset = 0;
 
 		m_geometryVector.push_back(aabbGeometry);
-		m_buildRangeInfoVector.clear(); // remove when supporting multiple geometries
-		m_buildRangeInfoVector.push_back(offset);
-		m_additionalBuffers.push_back(aabbBuffer);
+		m_buildRangeInfoVector.push_back(offsetInfo);
 	}
 
-	VkDeviceAddress AccelerationStructure::getDeviceAddress() {
-		VkAccelerationStructureDeviceAddressInfoKHR addressInfo{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR };
-		addressInfo.accelerationStructure = m_accelerationStructure;
-		return vkGetAccelerationStructureDeviceAddressKHR(device, &addressInfo);
+	void AccelerationStructure::setGeometryTransform(uint32_t geometryIndex, const Buffer& transformBuffer, uint32_t transformOffset) {
+		auto& geometry = m_geometryVector[geometryIndex];
+		if (geometry.geometryType != VK_GEOMETRY_TYPE_TRIANGLES_KHR) {
+			std::cerr << "ERROR: Only triangle geometries can have a transform | Geometry: " << geometryIndex << "\n";
+			throw std::runtime_error("Transform on non triangle geometry");
+		}
+		checkTransformOffset(transformOffset);
+		geometry.geometry.triangles.transformData.deviceAddress = vkUtils::getBufferDeviceAddress(device, transformBuffer);
+		m_buildRangeInfoVector[geometryIndex].transformOffset = transformOffset;
 	}
 
-	/* RtPipeline */
-	RtPipeline::RtPipeline(){}
-
-	RtPipeline::~RtPipeline(){}
-
-	void RtPipeline::init() {
-		if (m_isInit) return;
-
-		VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{ VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
-		pipelineLayoutCreateInfo.setLayoutCount = m_descriptorSetLayouts.size();
-		pipelineLayoutCreateInfo.pSetLayouts = m_descriptorSetLayouts.data();
-		pipelineLayoutCreateInfo.pushConstantRangeCount = 0;
-		pipelineLayoutCreateInfo.pPushConstantRanges = nullptr;
-
-		VkResult result = vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &m_pipelineLayout);
-		VK_ASSERT(result);
+	void AccelerationStructure::setGeometryFlags(uint32_t geometryIndex, VkGeometryFlagsKHR flags) {
+		m_geometryVector[geometryIndex].flags = flags;
+	}
 
-		VkRayTracingPipelineCreateInfoKHR rtPipelineCreateInfo{ VK_STRUCTURE_TYPE_RAY_TRACING_PIPELINE_CREATE_INFO_KHR };
-		rtPipelineCreateInfo.stageCount = m_stages.size();
-		rtPipelineCreateInfo.pStages = m_stages.data();
-		rtPipelineCreateInfo.groupCount = m_shaderGroupes.size();
-		rtPipelineCreateInfo.pGroups = m_shaderGroupes.data();
-		rtPipelineCreateInfo.maxPipelineRayRecursionDepth = 10;
-		rtPipelineCreateInfo.layout = m_pipelineLayout;
+	static VkDeviceSize compactionSavedBytes = 0;
 
-		vkCreateRayTracingPipelinesKHR(device, {}, {}, 1, &rtPipelineCreateInfo, nullptr, &m_pipeline);
+	VkDeviceSize AccelerationStructure::compact(DeletionQueue* pDeletionQueue) {
+		return compact({ this }, pDeletionQueue);
 	}
 
-	void RtPipeline::initShaderBindingTable() {
-		uint32_t missCount = 0;
-		uint32_t hitCount = 0;
-		for (auto group : m_shaderGroupes) {
-			switch (group.type)
-			{
-			case VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR:
-				if (m_stages[group.generalShader].stage == VK_SHADER_STAGE_MISS_BIT_KHR)
-					missCount++;
-				break;
-			case VK_RAY_TRACING_SHADER_GROUP_TYPE_TRIANGLES_HIT_GROUP_KHR:
-				hitCount++;
-				break;
-			case VK_RAY_TRACING_SHADER_GROUP_TYPE_PROCEDURAL_HIT_GROUP_KHR:
-				hitCount++;
-				break;
-			}
+	VkDeviceSize AccelerationStructure::compact(const std::vector<AccelerationStructure*>& accelerationStructures, DeletionQueue* pDeletionQueue) {
+		std::vector<AccelerationStructure*> compactable;
+		std::vector<VkAccelerationStructureKHR> handles;
+		for (AccelerationStructure* pAccelerationStructure : accelerationStructures) {
+			// only what was actually built with the flag can be queried, enabling compaction later takes effect on the next build
+			bool isBuiltCompactable = pAccelerationStructure->m_isBuilt
+				&& VK_IS_FLAG_ENABLED(pAccelerationStructure->m_builtFlags, VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR);
+			if (!pAccelerationStructure->m_isInit || !isBuiltCompactable || pAccelerationStructure->m_geometryVector.empty())
+				continue;
+			compactable.push_back(pAccelerationStructure);
+			handles.push_back(pAccelerationStructure->m_accelerationStructure);
 		}
-		auto     handleCount = 1 + missCount + hitCount;
-		uint32_t handleSize = rtProperties.shaderGroupHandleSize;
+		if (compactable.empty())
+			return 0;
 
-		uint32_t handleSizeAligned = align_up(handleSize, rtProperties.shaderGroupHandleAlignment);
+		// query the compacted sizes
+		VkQueryPoolCreateInfo queryPoolCreateInfo{ VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+		queryPoolCreateInfo.queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR;
+		queryPoolCreateInfo.queryCount = compactable.size();
 
-		m_rgenRegion.stride = align_up(handleSizeAligned, rtProperties.shaderGroupBaseAlignment);
-		m_rgenRegion.size = m_rgenRegion.stride;  // The size member of pRayGenShaderBindingTable must be equal to its stride member
-		m_missRegion.stride = handleSizeAligned;
-		m_missRegion.size = align_up(missCount * handleSizeAligned, rtProperties.shaderGroupBaseAlignment);
-		m_hitRegion.stride = handleSizeAligned;
-		m_hitRegion.size = align_up(hitCount * handleSizeAligned, rtProperties.shaderGroupBaseAlignment);
+		VkQueryPool queryPool;
+		VkResult result = vkCreateQueryPool(device, &queryPoolCreateInfo, nullptr, &queryPool);
+		VK_ASSERT(result)
 
-		uint32_t             dataSize = handleCount * handleSize;
-		std::vector<uint8_t> handles(dataSize);
-		VkResult result = vkGetRayTracingShaderGroupHandlesKHR(device, m_pipeline, 0, handleCount, dataSize, handles.data());
-		VK_ASSERT(result);
+		CommandBuffer cmd; cmd.allocate(); cmd.begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+		vkCmdResetQueryPool(cmd, queryPool, 0, compactable.size());
+		vkCmdWriteAccelerationStructuresPropertiesKHR(cmd, handles.size(), handles.data(), VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, queryPool, 0);
+		cmd.end(); cmd.submit(); cmd.free();
 
-		VkDeviceSize sbtSize = m_rgenRegion.size + m_missRegion.size + m_hitRegion.size + m_callRegion.size;
-		m_rtSBTBuffer = Buffer(sbtSize,
-			VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
-			| VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR);
-		m_rtSBTBuffer.init(); m_rtSBTBuffer.allocate(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		std::vector<VkDeviceSize> compactedSizes(compactable.size());
+		result = vkGetQueryPoolResults(device, queryPool, 0, compactedSizes.size(), compactedSizes.size() * sizeof(VkDeviceSize), compactedSizes.data(),
+			sizeof(VkDeviceSize), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+		VK_ASSERT(result)
+		vkDestroyQueryPool(device, queryPool, nullptr);
 
-		VkDeviceAddress           sbtAddress = m_rtSBTBuffer.getVkDeviceAddress();
-		m_rgenRegion.deviceAddress = sbtAddress;
-		m_missRegion.deviceAddress = sbtAddress + m_rgenRegion.size;
-		m_hitRegion.deviceAddress = sbtAddress + m_rgenRegion.size + m_missRegion.size;
+		// copy every structure into a right sized buffer
+		std::vector<Buffer> compactedBuffers(compactable.size());
+		std::vector<VkAccelerationStructureKHR> compactedHandles(compactable.size());
 
-		auto getHandle = [&](int i) { return handles.data() + i * handleSize; };
+		cmd.allocate(); cmd.begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+		for (size_t i = 0; i < compactable.size(); i++) {
+			compactedBuffers[i] = Buffer(compactedSizes[i], VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+			compactedBuffers[i].init(); compactedBuffers[i].allocate(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-		void* rawData; m_rtSBTBuffer.map(&rawData);
-		uint8_t* pSBTBuffer = (uint8_t*)rawData;
-		uint8_t* pData{ nullptr };
-		uint32_t handleIdx{ 0 };
-		// Raygen
-		pData = pSBTBuffer;
-		memcpy(pData, getHandle(handleIdx++), handleSize);
-		// Miss
-		pData = pSBTBuffer + m_rgenRegion.size;
-		for (uint32_t c = 0; c < missCount; c++) {
-			memcpy(pData, getHandle(handleIdx++), handleSize);
-			pData += m_missRegion.stride;
+			VkAccelerationStructureCreateInfoKHR createInfo{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR };
+			createInfo.buffer = compactedBuffers[i];
+			createInfo.offset = 0;
+			createInfo.size = compactedSizes[i];
+			createInfo.type = compactable[i]->m_type;
+			result = vkCreateAccelerationStructureKHR(device, &createInfo, nullptr, &compactedHandles[i]);
+			VK_ASSERT(result)
+
+			VkCopyAccelerationStructureInfoKHR copyInfo{ VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR };
+			copyInfo.src = handles[i];
+			copyInfo.dst = compactedHandles[i];
+			copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR;
+			vkCmdCopyAccelerationStructureKHR(cmd, &copyInfo);
 		}
-		// Hit
-		pData = pSBTBuffer + m_rgenRegion.size + m_missRegion.size;
-		for (uint32_t c = 0; c < hitCount; c++){
-			memcpy(pData, getHandle(handleIdx++), handleSize);
-			pData += m_hitRegion.stride;
+		cmd.end(); cmd.submit(); cmd.free();
+
+		// swap in the compacted structures and retire the originals
+		VkDeviceSize savedBytes = 0;
+		for (size_t i = 0; i < compactable.size(); i++) {
+			AccelerationStructure& accelerationStructure = *compactable[i];
+			savedBytes += accelerationStructure.m_buffer.getSize() - compactedSizes[i];
+
+			VkAccelerationStructureKHR oldHandle = handles[i];
+			if (pDeletionQueue) {
+				pDeletionQueue->push(accelerationStructure.m_buffer);
+				pDeletionQueue->push([oldHandle]() { vkDestroyAccelerationStructureKHR(device, oldHandle, nullptr); });
+			}
+			else {
+				vkDestroyAccelerationStructureKHR(device, oldHandle, nullptr);
+			}
+			accelerationStructure.m_buffer = compactedBuffers[i]; // destroys the old buffer if it wasn't retired
+			accelerationStructure.m_accelerationStructure = compactedHandles[i];
+
+			accelerationStructure.Registerable::update();
 		}
-		m_rtSBTBuffer.unmap();
+
+		compactionSavedBytes += savedBytes;
+		return savedBytes;
 	}
 
-	void RtPipeline::update() {
-		destroy();
+	VkDeviceSize AccelerationStructure::getCompactionSavedBytes() {
+		return compactionSavedBytes;
+	}
+
+	std::vector<char> AccelerationStructure::serialize() {
+		if (!m_isInit || !m_isBuilt || m_type != VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR) {
+			std::cerr << "ERROR: Only built bottom level acceleration structures can be serialized\n";
+			throw std::runtime_error("AccelerationStructure can't be serialized");
+		}
+
+		// query the serialized size
+		VkQueryPoolCreateInfo queryPoolCreateInfo{ VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+		queryPoolCreateInfo.queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR;
+		queryPoolCreateInfo.queryCount = 1;
+
+		VkQueryPool queryPool;
+		VkResult result = vkCreateQueryPool(device, &queryPoolCreateInfo, nullptr, &queryPool);
+		VK_ASSERT(result)
+
+		CommandBuffer cmd; cmd.allocate(); cmd.begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+		vkCmdResetQueryPool(cmd, queryPool, 0, 1);
+		vkCmdWriteAccelerationStructuresPropertiesKHR(cmd, 1, &m_accelerationStructure, VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR, queryPool, 0);
+		cmd.end(); cmd.submit(); cmd.free();
+
+		VkDeviceSize serializedSize = 0;
+		result = vkGetQueryPoolResults(device, queryPool, 0, 1, sizeof(VkDeviceSize), &serializedSize,
+			sizeof(VkDeviceSize), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+		VK_ASSERT(result)
+		vkDestroyQueryPool(device, queryPool, nullptr);
+
+		// the copy writes through a device address, every buffer has its own allocation so it meets the 256 byte alignment
+		Buffer serializedBuffer = Buffer(serializedSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+		serializedBuffer.init(); serializedBuffer.allocate(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+		VkCopyAccelerationStructureToMemoryInfoKHR copyInfo{ VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_TO_MEMORY_INFO_KHR };
+		copyInfo.src = m_accelerationStructure;
+		copyInfo.dst.deviceAddress = serializedBuffer.getVkDeviceAddress();
+		copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_SERIALIZE_KHR;
+
+		cmd.allocate(); cmd.begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+		vkCmdCopyAccelerationStructureToMemoryKHR(cmd, &copyInfo);
+		cmd.end(); cmd.submit(); cmd.free();
+
+		std::vector<char> data(serializedSize);
+		void* rawData; serializedBuffer.map(&rawData);
+		memcpy(data.data(), rawData, serializedSize);
+		serializedBuffer.unmap();
+		serializedBuffer.destroy();
+
+		return data;
+	}
+
+	bool AccelerationStructure::deserialize(const void* pData, size_t size) {
+		if (!m_isInit || m_type != VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR) {
+			std::cerr << "ERROR: Only initialized bottom level acceleration structures can be deserialized\n";
+			throw std::runtime_error("AccelerationStructure can't be deserialized");
+		}
+
+		// serialized header: driver UUID, compatibility UUID, serialized size, deserialized size, handle count
+		const size_t headerSize = 2 * VK_UUID_SIZE + 3 * sizeof(uint64_t);
+		if (size < headerSize)
+			return false;
+
+		VkAccelerationStructureVersionInfoKHR versionInfo{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_VERSION_INFO_KHR };
+		versionInfo.pVersionData = (const uint8_t*)pData;
+		VkAccelerationStructureCompatibilityKHR compatibility;
+		vkGetDeviceAccelerationStructureCompatibilityKHR(device, &versionInfo, &compatibility);
+		if (compatibility != VK_ACCELERATION_STRUCTURE_COMPATIBILITY_COMPATIBLE_KHR)
+			return false;
+
+		uint64_t serializedSize, deserializedSize;
+		memcpy(&serializedSize, (const uint8_t*)pData + 2 * VK_UUID_SIZE, sizeof(uint64_t));
+		memcpy(&deserializedSize, (const uint8_t*)pData + 2 * VK_UUID_SIZE + sizeof(uint64_t), sizeof(uint64_t));
+		if (serializedSize > size || deserializedSize == 0)
+			return false;
+
+		Buffer serializedBuffer = Buffer(serializedSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+		serializedBuffer.init(); serializedBuffer.allocate(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		void* rawData; serializedBuffer.map(&rawData);
+		memcpy(rawData, pData, serializedSize);
+		serializedBuffer.unmap();
+
+		// like a build, the structure is only recreated if the blob doesn't fit
+		VkAccelerationStructureKHR oldHandle = m_accelerationStructure;
+		if (deserializedSize > m_buffer.getSize()) {
+			m_buffer.resize(deserializedSize);
+
+			vkDestroyAccelerationStructureKHR(device, m_accelerationStructure, nullptr);
+
+			VkAccelerationStructureCreateInfoKHR createInfo;
+			createInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
+			createInfo.pNext = nullptr;
+			createInfo.createFlags = 0;
+			createInfo.buffer = m_buffer;
+			createInfo.offset = 0;
+			createInfo.size = m_buffer.getSize();
+			createInfo.type = m_type;
+			createInfo.deviceAddress = 0;
+
+			VkResult result = vkCreateAccelerationStructureKHR(device, &createInfo, nullptr, &m_accelerationStructure);
+			VK_ASSERT(result)
+		}
+
+		VkCopyMemoryToAccelerationStructureInfoKHR copyInfo{ VK_STRUCTURE_TYPE_COPY_MEMORY_TO_ACCELERATION_STRUCTURE_INFO_KHR };
+		copyInfo.src.deviceAddress = serializedBuffer.getVkDeviceAddress();
+		copyInfo.dst = m_accelerationStructure;
+		copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_DESERIALIZE_KHR;
+
+		CommandBuffer cmd; cmd.allocate(); cmd.begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+		vkCmdCopyMemoryToAccelerationStructureKHR(cmd, &copyInfo);
+		cmd.end(); cmd.submit(); cmd.free();
+
+		serializedBuffer.destroy();
+
+		// the blob was built from the current geometries, so refits work as after a build
+		m_isBuilt = true;
+		m_builtFlags = getBuildFlags();
+		m_builtPrimitiveCounts.resize(m_buildRangeInfoVector.size());
+		for (size_t i = 0; i < m_buildRangeInfoVector.size(); i++)
+			m_builtPrimitiveCounts[i] = m_buildRangeInfoVector[i].primitiveCount;
+
+		if (m_accelerationStructure != oldHandle)
+			Registerable::update();
+		return true;
+	}
+
+	VkDeviceAddress AccelerationStructure::getDeviceAddress() {
+		VkAccelerationStructureDeviceAddressInfoKHR addressInfo{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR };
+		addressInfo.accelerationStructure = m_accelerationStructure;
+		return vkGetAccelerationStructureDeviceAddressKHR(device, &addressInfo);
+	}
+
+	/* AccelerationStructureBuilder */
+	AccelerationStructureBuilder::AccelerationStructureBuilder() {}
+	AccelerationStructureBuilder::~AccelerationStructureBuilder() {}
+
+	void AccelerationStructureBuilder::destroy() {
+		wait();
+		m_scratchBuffer.destroy();
+		if (m_timelineSemaphore != VK_NULL_HANDLE) {
+			destroySemaphore(m_timelineSemaphore);
+			m_timelineSemaphore = VK_NULL_HANDLE;
+			m_timelineValue = 0;
+		}
+	}
+
+	void AccelerationStructureBuilder::add(AccelerationStructure& accelerationStructure, bool isRefit) {
+		m_queued.push_back({ &accelerationStructure, isRefit });
+	}
+
+	void AccelerationStructureBuilder::remove(AccelerationStructure& accelerationStructure) {
+		m_queued.erase(std::remove_if(m_queued.begin(), m_queued.end(),
+			[&](const std::pair<AccelerationStructure*, bool>& queued) { return queued.first == &accelerationStructure; }),
+			m_queued.end());
+
+		uint64_t waitValue = 0;
+		for (const Chunk& chunk : m_chunks) {
+			for (AccelerationStructure* pAccelerationStructure : chunk.accelerationStructures) {
+				if (pAccelerationStructure == &accelerationStructure)
+					waitValue = std::max(waitValue, chunk.timelineValue);
+			}
+		}
+		if (waitValue > 0)
+			wait(waitValue);
+	}
+
+	uint64_t AccelerationStructureBuilder::build() {
+		if (m_timelineSemaphore == VK_NULL_HANDLE)
+			createTimelineSemaphore(&m_timelineSemaphore);
+
+		isFinished(); // retires what already finished without blocking
+		if (m_queued.empty())
+			return m_timelineValue;
+
+		// a structure added twice is built once, refitted only if every add asked for a refit
+		std::vector<std::pair<AccelerationStructure*, bool>> queued;
+		std::unordered_map<AccelerationStructure*, size_t> queuedIndices;
+		for (auto& entry : m_queued) {
+			auto it = queuedIndices.find(entry.first);
+			if (it != queuedIndices.end()) {
+				queued[it->second].second &= entry.second;
+				continue;
+			}
+			queuedIndices[entry.first] = queued.size();
+			queued.push_back(entry);
+		}
+		m_queued.clear();
+
+		// prepareBuild can recreate a structure, so earlier chunks still building it have to finish first
+		uint64_t waitValue = 0;
+		for (const Chunk& chunk : m_chunks) {
+			for (AccelerationStructure* pAccelerationStructure : chunk.accelerationStructures) {
+				if (queuedIndices.count(pAccelerationStructure))
+					waitValue = std::max(waitValue, chunk.timelineValue);
+			}
+		}
+		if (waitValue > 0)
+			wait(waitValue);
+
+		VkDeviceSize alignment = getAccelerationStructureProperties().minAccelerationStructureScratchOffsetAlignment;
+
+		std::vector<VkAccelerationStructureBuildGeometryInfoKHR> buildInfos;
+		std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> buildRanges;
+		std::vector<VkDeviceSize> scratchSizes;
+		std::vector<AccelerationStructure*> accelerationStructures;
+		buildInfos.reserve(queued.size());
+		buildRanges.reserve(queued.size());
+		scratchSizes.reserve(queued.size());
+		accelerationStructures.reserve(queued.size());
+
+		VkDeviceSize maxScratchSize = 0;
+		for (auto& entry : queued) {
+			AccelerationStructure* pAccelerationStructure = entry.first;
+			if (pAccelerationStructure->m_geometryVector.empty())
+				continue;
+			buildInfos.emplace_back();
+			VkDeviceSize scratchSize = align_up(pAccelerationStructure->prepareBuild(buildInfos.back(), entry.second), alignment);
+			buildRanges.push_back(pAccelerationStructure->m_buildRangeInfoVector.data());
+			scratchSizes.push_back(scratchSize);
+			accelerationStructures.push_back(pAccelerationStructure);
+			maxScratchSize = std::max(maxScratchSize, scratchSize);
+		}
+		if (buildInfos.empty())
+			return m_timelineValue;
+
+		// the scratch buffer is kept for later builds, the extra alignment allows aligning its address
+		VkDeviceSize poolSize = std::max(m_scratchSize, maxScratchSize) + alignment;
+		if (m_scratchBuffer.getSize() < poolSize) {
+			wait(); // chunks in flight still use the old scratch buffer
+			m_scratchBuffer.destroy();
+			m_scratchBuffer = Buffer(poolSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+			m_scratchBuffer.init(); m_scratchBuffer.allocate(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		}
+		VkDeviceAddress scratchBase = align_up(m_scratchBuffer.getVkDeviceAddress(), alignment);
+		VkDeviceSize scratchCapacity = m_scratchBuffer.getSize() - alignment;
+
+		// pack the builds into chunks that fit the scratch buffer
+		std::vector<VkAccelerationStructureBuildGeometryInfoKHR> chunkInfos;
+		std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> chunkRanges;
+		std::vector<AccelerationStructure*> chunkStructures;
+		VkDeviceSize scratchOffset = 0;
+		for (size_t i = 0; i < buildInfos.size(); i++) {
+			if (scratchOffset + scratchSizes[i] > scratchCapacity) {
+				submitChunk(chunkInfos, chunkRanges, chunkStructures);
+				chunkInfos.clear();
+				chunkRanges.clear();
+				chunkStructures.clear();
+				scratchOffset = 0;
+			}
+			buildInfos[i].scratchData.deviceAddress = scratchBase + scratchOffset;
+			chunkInfos.push_back(buildInfos[i]);
+			chunkRanges.push_back(buildRanges[i]);
+			chunkStructures.push_back(accelerationStructures[i]);
+			scratchOffset += scratchSizes[i];
+		}
+		submitChunk(chunkInfos, chunkRanges, chunkStructures);
+
+		return m_timelineValue;
+	}
+
+	bool AccelerationStructureBuilder::isFinished() {
+		if (m_chunks.empty())
+			return true;
+
+		uint64_t completedValue;
+		VkResult result = vkGetSemaphoreCounterValue(device, m_timelineSemaphore, &completedValue);
+		VK_ASSERT(result);
+		retire(completedValue);
+		return m_chunks.empty();
+	}
+
+	void AccelerationStructureBuilder::wait() {
+		wait(m_timelineValue);
+	}
+
+	void AccelerationStructureBuilder::wait(uint64_t timelineValue) {
+		if (m_chunks.empty() || m_chunks.front().timelineValue > timelineValue)
+			return;
+
+		VkSemaphoreWaitInfo waitInfo{ VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO };
+		waitInfo.semaphoreCount = 1;
+		waitInfo.pSemaphores = &m_timelineSemaphore;
+		waitInfo.pValues = &timelineValue;
+		VkResult result = vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+		VK_ASSERT(result);
+		retire(timelineValue);
+	}
+
+	void AccelerationStructureBuilder::addWait(CommandBuffer& cmd, VkPipelineStageFlags waitDstStageMask) {
+		if (m_timelineValue == 0)
+			return;
+		cmd.addWaitSemaphore(m_timelineSemaphore, waitDstStageMask, m_timelineValue);
+	}
+
+	void AccelerationStructureBuilder::submitChunk(const std::vector<VkAccelerationStructureBuildGeometryInfoKHR>& buildInfos, const std::vector<const VkAccelerationStructureBuildRangeInfoKHR*>& buildRanges,
+		const std::vector<AccelerationStructure*>& accelerationStructures)
+	{
+		if (buildInfos.empty())
+			return;
+
+		Chunk chunk;
+		chunk.accelerationStructures = accelerationStructures;
+		chunk.cmd.allocate();
+		chunk.cmd.begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+
+		// earlier chunks on the queue, also from earlier builds, have to finish using the shared scratch memory
+		if (m_timelineValue > 0) {
+			VkMemoryBarrier barrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+			barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+			barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+			vkCmdPipelineBarrier(chunk.cmd,
+				VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+				0, 1, &barrier, 0, nullptr, 0, nullptr
+			);
+		}
+
+		vkCmdBuildAccelerationStructuresKHR(chunk.cmd, buildInfos.size(), buildInfos.data(), buildRanges.data());
+
+		chunk.cmd.end();
+
+		chunk.timelineValue = ++m_timelineValue;
+		chunk.cmd.addSignalSemaphore(m_timelineSemaphore, chunk.timelineValue);
+		chunk.cmd.submitTo(getAsyncComputeQueue(), VK_NULL_HANDLE);
+
+		m_chunks.push_back(chunk);
+	}
+
+	void AccelerationStructureBuilder::retire(uint64_t completedValue) {
+		size_t retiredCount = 0;
+		for (; retiredCount < m_chunks.size() && m_chunks[retiredCount].timelineValue <= completedValue; retiredCount++) {
+			Chunk& chunk = m_chunks[retiredCount];
+			chunk.cmd.free();
+			for (AccelerationStructure* pAccelerationStructure : chunk.accelerationStructures)
+				pAccelerationStructure->Registerable::update();
+		}
+		m_chunks.erase(m_chunks.begin(), m_chunks.begin() + retiredCount);
+	}
+
+	/* AccelerationStructureCache */
+	static const uint32_t accelerationStructureCacheMagic = 0x53414B56; // "VKAS"
+	static const uint32_t accelerationStructureCacheVersion = 1; // bump when the file layout or the key changes
+
+	AccelerationStructureCache::AccelerationStructureCache() {}
+	AccelerationStructureCache::~AccelerationStructureCache() {}
+
+	void AccelerationStructureCache::init(const std::string& directory) {
+		if (m_isInit) return;
+		m_isInit = true;
+
+		m_directory = directory;
+		if (!m_directory.empty() && m_directory.back() != '/' && m_directory.back() != '\\')
+			m_directory += '/';
+
+		VkPhysicalDeviceIDProperties idProperties{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES };
+		VkPhysicalDeviceProperties2 properties2{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+		properties2.pNext = &idProperties;
+		vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+		memcpy(m_driverUUID, idProperties.driverUUID, VK_UUID_SIZE);
+	}
+
+	uint64_t AccelerationStructureCache::hash(const void* pData, size_t size, uint64_t seed) {
+		const uint8_t* pBytes = (const uint8_t*)pData;
+		uint64_t value = seed;
+		for (size_t i = 0; i < size; i++) {
+			value ^= pBytes[i];
+			value *= 0x100000001b3;
+		}
+		return value;
+	}
+
+	uint64_t AccelerationStructureCache::getKey(const AccelerationStructure& accelerationStructure, uint64_t geometryHash) const {
+		// device addresses change between launches, only the layout of the geometries is hashed
+		uint64_t key = hash(&geometryHash, sizeof(geometryHash));
+		key = hash(m_driverUUID, VK_UUID_SIZE, key);
+
+		VkBuildAccelerationStructureFlagsKHR buildFlags = accelerationStructure.getBuildFlags();
+		key = hash(&buildFlags, sizeof(buildFlags), key);
+		for (size_t i = 0; i < accelerationStructure.m_geometryVector.size(); i++) {
+			const VkAccelerationStructureGeometryKHR& geometry = accelerationStructure.m_geometryVector[i];
+			key = hash(&geometry.geometryType, sizeof(geometry.geometryType), key);
+			key = hash(&geometry.flags, sizeof(geometry.flags), key);
+			if (geometry.geometryType == VK_GEOMETRY_TYPE_TRIANGLES_KHR) {
+				const VkAccelerationStructureGeometryTrianglesDataKHR& triangles = geometry.geometry.triangles;
+				bool hasTransform = triangles.transformData.deviceAddress != 0;
+				key = hash(&triangles.vertexFormat, sizeof(triangles.vertexFormat), key);
+				key = hash(&triangles.vertexStride, sizeof(triangles.vertexStride), key);
+				key = hash(&triangles.maxVertex, sizeof(triangles.maxVertex), key);
+				key = hash(&triangles.indexType, sizeof(triangles.indexType), key);
+				key = hash(&hasTransform, sizeof(hasTransform), key);
+			}
+			else if (geometry.geometryType == VK_GEOMETRY_TYPE_AABBS_KHR) {
+				key = hash(&geometry.geometry.aabbs.stride, sizeof(geometry.geometry.aabbs.stride), key);
+			}
+
+			const VkAccelerationStructureBuildRangeInfoKHR& range = accelerationStructure.m_buildRangeInfoVector[i];
+			key = hash(&range.primitiveCount, sizeof(range.primitiveCount), key);
+			key = hash(&range.primitiveOffset, sizeof(range.primitiveOffset), key);
+			key = hash(&range.firstVertex, sizeof(range.firstVertex), key);
+			key = hash(&range.transformOffset, sizeof(range.transformOffset), key);
+		}
+		return key;
+	}
+
+	std::string AccelerationStructureCache::getPath(uint64_t key) const {
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.vkas", (unsigned long long)key);
+		return m_directory + name;
+	}
+
+	bool AccelerationStructureCache::load(AccelerationStructure& accelerationStructure, uint64_t geometryHash) {
+		if (!m_isInit) {
+			std::cerr << "ERROR: AccelerationStructureCache isn't initialized\n";
+			throw std::runtime_error("AccelerationStructureCache isn't initialized");
+		}
+
+		uint64_t key = getKey(accelerationStructure, geometryHash);
+		std::ifstream file(getPath(key), std::ios::binary | std::ios::ate);
+		if (!file) {
+			m_missCount++;
+			return false;
+		}
+
+		FileHeader header;
+		size_t fileSize = (size_t)file.tellg();
+		file.seekg(0);
+		if (fileSize < sizeof(FileHeader) || !file.read((char*)&header, sizeof(FileHeader)) ||
+			header.magic != accelerationStructureCacheMagic || header.version != accelerationStructureCacheVersion ||
+			memcmp(header.driverUUID, m_driverUUID, VK_UUID_SIZE) != 0 || header.key != key || header.dataSize != fileSize - sizeof(FileHeader))
+		{
+			m_missCount++;
+			return false;
+		}
+
+		std::vector<char> data(header.dataSize);
+		if (!file.read(data.data(), data.size()) || !accelerationStructure.deserialize(data.data(), data.size())) {
+			m_missCount++;
+			return false;
+		}
+
+		m_hitCount++;
+		return true;
+	}
+
+	void AccelerationStructureCache::store(AccelerationStructure& accelerationStructure, uint64_t geometryHash) {
+		if (!m_isInit) {
+			std::cerr << "ERROR: AccelerationStructureCache isn't initialized\n";
+			throw std::runtime_error("AccelerationStructureCache isn't initialized");
+		}
+
+		std::vector<char> data = accelerationStructure.serialize();
+
+		FileHeader header;
+		header.magic = accelerationStructureCacheMagic;
+		header.version = accelerationStructureCacheVersion;
+		memcpy(header.driverUUID, m_driverUUID, VK_UUID_SIZE);
+		header.key = getKey(accelerationStructure, geometryHash);
+		header.dataSize = data.size();
+
+		// written to a temporary file first, so a crash never leaves a truncated entry behind
+		std::string path = getPath(header.key);
+		std::string tempPath = path + ".tmp";
+		{
+			std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+			if (!file) {
+				std::cerr << "ERROR: Failed to open acceleration structure cache file: " << tempPath << "\n";
+				throw std::runtime_error("Failed to open acceleration structure cache file");
+			}
+			file.write((const char*)&header, sizeof(FileHeader));
+			file.write(data.data(), data.size());
+			if (!file) {
+				std::cerr << "ERROR: Failed to write acceleration structure cache file: " << tempPath << "\n";
+				file.close();
+				std::remove(tempPath.c_str());
+				throw std::runtime_error("Failed to write acceleration structure cache file");
+			}
+		}
+		std::remove(path.c_str());
+		if (std::rename(tempPath.c_str(), path.c_str()) != 0) {
+			std::cerr << "ERROR: Failed to move acceleration structure cache file to: " << path << "\n";
+			std::remove(tempPath.c_str());
+			throw std::runtime_error("Failed to move acceleration structure cache file");
+		}
+	}
+
+	bool AccelerationStructureCache::loadOrBuild(AccelerationStructure& accelerationStructure, uint64_t geometryHash) {
+		if (load(accelerationStructure, geometryHash))
+			return true;
+
+		accelerationStructure.update();
+		try {
+			store(accelerationStructure, geometryHash);
+		}
+		catch (std::exception& e) {
+			// store logged the error, an unwritable cache only means the structure is built again next time
+			std::cerr << "ERROR: AccelerationStructureCache keeps the built structure without caching it | " << e.what() << "\n";
+		}
+		return false;
+	}
+
+	/* AccelerationStructureRegistry */
+	AccelerationStructureRegistry::AccelerationStructureRegistry() {}
+	AccelerationStructureRegistry::~AccelerationStructureRegistry() {}
+
+	void AccelerationStructureRegistry::destroy() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (auto& entry : m_entries) {
+			if (m_pBuilder)
+				m_pBuilder->remove(*entry.second.pAccelerationStructure);
+			entry.second.pAccelerationStructure->destroy();
+			delete entry.second.pAccelerationStructure;
+		}
+		m_entries.clear();
+		m_keys.clear();
+	}
+
+	// hashes everything the build reads except the buffer contents
+	static uint64_t hashGeometries(uint64_t seed, const std::vector<AccelerationStructureRegistry::Geometry>& geometries, bool isContentHashed, VkBuildAccelerationStructureFlagsKHR buildFlags) {
+		uint64_t key = AccelerationStructureCache::hash(&buildFlags, sizeof(buildFlags), seed);
+		key = AccelerationStructureCache::hash(&isContentHashed, sizeof(isContentHashed), key); // a content key never aliases a handle key
+		for (const AccelerationStructureRegistry::Geometry& geometry : geometries) {
+			if (!isContentHashed) {
+				VkBuffer vertexBuffer = *geometry.pVertexBuffer;
+				VkBuffer indexBuffer = *geometry.pIndexBuffer;
+				key = AccelerationStructureCache::hash(&vertexBuffer, sizeof(vertexBuffer), key);
+				key = AccelerationStructureCache::hash(&indexBuffer, sizeof(indexBuffer), key);
+			}
+			VkDeviceSize vertexBufferSize = geometry.pVertexBuffer->getSize();
+			VkDeviceSize indexBufferSize = geometry.pIndexBuffer->getSize();
+			key = AccelerationStructureCache::hash(&vertexBufferSize, sizeof(vertexBufferSize), key);
+			key = AccelerationStructureCache::hash(&indexBufferSize, sizeof(indexBufferSize), key);
+			key = AccelerationStructureCache::hash(&geometry.vertexStride, sizeof(geometry.vertexStride), key);
+			key = AccelerationStructureCache::hash(&geometry.firstPrimitive, sizeof(geometry.firstPrimitive), key);
+			key = AccelerationStructureCache::hash(&geometry.primitiveCount, sizeof(geometry.primitiveCount), key);
+			key = AccelerationStructureCache::hash(&geometry.firstVertex, sizeof(geometry.firstVertex), key);
+			key = AccelerationStructureCache::hash(&geometry.flags, sizeof(geometry.flags), key);
+		}
+		return key;
+	}
+
+	AccelerationStructure& AccelerationStructureRegistry::acquire(const Buffer& vertexBuffer, uint32_t vertexStride, const Buffer& indexBuffer, VkGeometryFlagsKHR flags) {
+		Geometry geometry;
+		geometry.pVertexBuffer = &vertexBuffer;
+		geometry.vertexStride = vertexStride;
+		geometry.pIndexBuffer = &indexBuffer;
+		geometry.flags = flags;
+		return acquire({ geometry });
+	}
+
+	AccelerationStructure& AccelerationStructureRegistry::acquire(const std::vector<Geometry>& geometries) {
+		return acquireKey(hashGeometries(0, geometries, false, m_buildFlags), geometries);
+	}
+
+	AccelerationStructure& AccelerationStructureRegistry::acquire(uint64_t contentHash, const std::vector<Geometry>& geometries) {
+		return acquireKey(hashGeometries(contentHash, geometries, true, m_buildFlags), geometries);
+	}
+
+	AccelerationStructure& AccelerationStructureRegistry::acquireKey(uint64_t key, const std::vector<Geometry>& geometries) {
+		if (geometries.empty()) {
+			std::cerr << "ERROR: AccelerationStructureRegistry needs at least one geometry\n";
+			throw std::runtime_error("AccelerationStructureRegistry needs at least one geometry");
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		auto it = m_entries.find(key);
+		if (it != m_entries.end()) {
+			it->second.referenceCount++;
+			m_duplicateCount++;
+			return *it->second.pAccelerationStructure;
+		}
+
+		// heap allocated so references stay valid while the maps grow
+		AccelerationStructure* pAccelerationStructure = new AccelerationStructure();
+		pAccelerationStructure->setType(VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR);
+		pAccelerationStructure->setBuildFlags(m_buildFlags);
+		pAccelerationStructure->init();
+		for (const Geometry& geometry : geometries) {
+			if (geometry.primitiveCount == 0)
+				pAccelerationStructure->addGeometry(*geometry.pVertexBuffer, geometry.vertexStride, *geometry.pIndexBuffer, geometry.flags);
+			else
+				pAccelerationStructure->addGeometry(*geometry.pVertexBuffer, geometry.vertexStride, *geometry.pIndexBuffer,
+					geometry.firstPrimitive, geometry.primitiveCount, geometry.firstVertex, geometry.flags);
+		}
+		if (m_pBuilder)
+			m_pBuilder->add(*pAccelerationStructure);
+		else
+			pAccelerationStructure->update();
+
+		m_entries[key] = { pAccelerationStructure, 1 };
+		m_keys[pAccelerationStructure] = key;
+		return *pAccelerationStructure;
+	}
+
+	void AccelerationStructureRegistry::release(AccelerationStructure& accelerationStructure, DeletionQueue* pDeletionQueue) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		auto keyIt = m_keys.find(&accelerationStructure);
+		if (keyIt == m_keys.end()) {
+			std::cerr << "ERROR: AccelerationStructure wasn't acquired from this AccelerationStructureRegistry\n";
+			throw std::runtime_error("AccelerationStructure wasn't acquired from this registry");
+		}
+		Entry& entry = m_entries.at(keyIt->second);
+		if (--entry.referenceCount > 0)
+			return;
+
+		AccelerationStructure* pAccelerationStructure = entry.pAccelerationStructure;
+		m_entries.erase(keyIt->second);
+		m_keys.erase(keyIt);
+		// the builder must not build or notify the structure once it's gone
+		if (m_pBuilder)
+			m_pBuilder->remove(*pAccelerationStructure);
+		if (pDeletionQueue) {
+			pDeletionQueue->push([pAccelerationStructure]() {
+				pAccelerationStructure->destroy();
+				delete pAccelerationStructure;
+				});
+		}
+		else {
+			pAccelerationStructure->destroy();
+			delete pAccelerationStructure;
+		}
+	}
+
+	VkDeviceSize AccelerationStructureRegistry::getSavedBytes() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		VkDeviceSize savedBytes = 0;
+		for (auto& entry : m_entries)
+			savedBytes += (entry.second.referenceCount - 1) * entry.second.pAccelerationStructure->getSize();
+		return savedBytes;
+	}
+
+	void AccelerationStructureRegistry::printStats() const {
+		VkDeviceSize savedBytes = getSavedBytes();
+		std::lock_guard<std::mutex> lock(m_mutex);
+		uint32_t referenceCount = 0;
+		for (auto& entry : m_entries)
+			referenceCount += entry.second.referenceCount;
+		std::cout << "AccelerationStructureRegistry: " << m_entries.size() << " unique structures, " << referenceCount << " references, "
+			<< m_duplicateCount << " duplicate builds avoided, " << savedBytes / 1024 << " KiB saved\n";
+	}
+
+	/* InstanceProcessor */
+	InstanceProcessor::InstanceProcessor() {}
+	InstanceProcessor::~InstanceProcessor() {}
+
+	uint32_t InstanceProcessor::addMesh(const std::vector<Lod>& lods, const float boundsCenter[3], float boundsRadius) {
+		if (lods.empty()) {
+			std::cerr << "ERROR: InstanceProcessor mesh needs at least one LOD\n";
+			throw std::runtime_error("InstanceProcessor mesh needs at least one LOD");
+		}
+
+		Mesh mesh;
+		mesh.center[0] = boundsCenter[0];
+		mesh.center[1] = boundsCenter[1];
+		mesh.center[2] = boundsCenter[2];
+		mesh.radius = boundsRadius;
+		mesh.lodFirst = m_lods.size();
+		mesh.lodCount = lods.size();
+		for (const Lod& lod : lods)
+			m_lods.push_back({ lod.pAccelerationStructure->getDeviceAddress(), lod.geometricError });
+
+		m_meshes.push_back(mesh);
+		return m_meshes.size() - 1;
+	}
+
+	uint32_t InstanceProcessor::addInstance(uint32_t mesh, const VkTransformMatrixKHR& transform, uint32_t customIndex, uint32_t mask,
+		uint32_t shaderBindingTableRecordOffset, VkGeometryInstanceFlagsKHR flags)
+	{
+		VkAccelerationStructureInstanceKHR instance{};
+		instance.instanceCustomIndex = customIndex;
+		instance.mask = mask;
+		instance.instanceShaderBindingTableRecordOffset = shaderBindingTableRecordOffset;
+		instance.flags = flags;
+		m_instances.push_back(instance);
+		m_meshIndices.push_back(mesh);
+		m_scales.push_back(0.0f);
+
+		// keep the sphere arrays padded with spheres that are always culled
+		size_t paddedSize = align_up(m_meshIndices.size(), 4);
+		m_sphereX.resize(paddedSize, 0.0f);
+		m_sphereY.resize(paddedSize, 0.0f);
+		m_sphereZ.resize(paddedSize, 0.0f);
+		m_sphereRadius.resize(paddedSize, -std::numeric_limits<float>::infinity());
+
+		uint32_t index = m_meshIndices.size() - 1;
+		setTransform(index, transform);
+		return index;
+	}
+
+	void InstanceProcessor::setTransform(uint32_t instance, const VkTransformMatrixKHR& transform) {
+		m_instances[instance].transform = transform;
+
+		const Mesh& mesh = m_meshes[m_meshIndices[instance]];
+		const float (*m)[4] = transform.matrix;
+		m_sphereX[instance] = m[0][0] * mesh.center[0] + m[0][1] * mesh.center[1] + m[0][2] * mesh.center[2] + m[0][3];
+		m_sphereY[instance] = m[1][0] * mesh.center[0] + m[1][1] * mesh.center[1] + m[1][2] * mesh.center[2] + m[1][3];
+		m_sphereZ[instance] = m[2][0] * mesh.center[0] + m[2][1] * mesh.center[1] + m[2][2] * mesh.center[2] + m[2][3];
+
+		float scale = 0.0f;
+		for (int column = 0; column < 3; column++)
+			scale = std::max(scale, m[0][column] * m[0][column] + m[1][column] * m[1][column] + m[2][column] * m[2][column]);
+		m_scales[instance] = std::sqrt(scale);
+		m_sphereRadius[instance] = mesh.radius * m_scales[instance];
+	}
+
+	void InstanceProcessor::clear() {
+		m_instances.clear();
+		m_meshIndices.clear();
+		m_scales.clear();
+		m_sphereX.clear();
+		m_sphereY.clear();
+		m_sphereZ.clear();
+		m_sphereRadius.clear();
+		m_visibleCount = 0;
+	}
+
+	void InstanceProcessor::setView(const float viewProjection[16], const float cameraPosition[3], float verticalFov, float viewportHeight) {
+		// side planes from the rows of the matrix, near and far are left out so geometry behind the camera can still be hit by secondary rays
+		auto row = [&](int r, int i) { return viewProjection[i * 4 + r]; };
+		for (int i = 0; i < 4; i++) {
+			int r = i / 2;
+			float sign = i % 2 == 0 ? 1.0f : -1.0f;
+			float plane[4];
+			for (int j = 0; j < 4; j++)
+				plane[j] = row(3, j) + sign * row(r, j);
+			float length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+			for (int j = 0; j < 4; j++)
+				m_planes[i][j] = length > 0.0f ? plane[j] / length : 0.0f;
+		}
+
+		m_cameraPosition[0] = cameraPosition[0];
+		m_cameraPosition[1] = cameraPosition[1];
+		m_cameraPosition[2] = cameraPosition[2];
+		m_errorToPixels = viewportHeight / (2.0f * std::tan(verticalFov * 0.5f));
+	}
+
+	void InstanceProcessor::processRange(uint32_t first, uint32_t end, std::vector<VkAccelerationStructureInstanceKHR>& instances) const {
+		float maxDistance = m_maxDistance;
+		float distances[4];
+
+		for (uint32_t group = first; group < end; group += 4) {
+			int visibleMask;
+#if defined(VK_FRAMEWORK_SSE)
+			__m128 x = _mm_loadu_ps(&m_sphereX[group]);
+			__m128 y = _mm_loadu_ps(&m_sphereY[group]);
+			__m128 z = _mm_loadu_ps(&m_sphereZ[group]);
+			__m128 radius = _mm_loadu_ps(&m_sphereRadius[group]);
+
+			__m128 dx = _mm_sub_ps(x, _mm_set1_ps(m_cameraPosition[0]));
+			__m128 dy = _mm_sub_ps(y, _mm_set1_ps(m_cameraPosition[1]));
+			__m128 dz = _mm_sub_ps(z, _mm_set1_ps(m_cameraPosition[2]));
+			__m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+			_mm_storeu_ps(distances, distance);
+
+			__m128 visible = _mm_cmplt_ps(_mm_sub_ps(distance, radius), _mm_set1_ps(maxDistance));
+			if (m_isFrustumCullingEnabled) {
+				__m128 limit = _mm_sub_ps(_mm_setzero_ps(), _mm_add_ps(radius, _mm_set1_ps(m_frustumMargin)));
+				for (int i = 0; i < 4; i++) {
+					__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(m_planes[i][0])), _mm_mul_ps(y, _mm_set1_ps(m_planes[i][1]))),
+						_mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(m_planes[i][2])), _mm_set1_ps(m_planes[i][3])));
+					visible = _mm_and_ps(visible, _mm_cmpgt_ps(d, limit));
+				}
+			}
+			visibleMask = _mm_movemask_ps(visible);
+#elif defined(VK_FRAMEWORK_NEON)
+			float32x4_t x = vld1q_f32(&m_sphereX[group]);
+			float32x4_t y = vld1q_f32(&m_sphereY[group]);
+			float32x4_t z = vld1q_f32(&m_sphereZ[group]);
+			float32x4_t radius = vld1q_f32(&m_sphereRadius[group]);
+
+			float32x4_t dx = vsubq_f32(x, vdupq_n_f32(m_cameraPosition[0]));
+			float32x4_t dy = vsubq_f32(y, vdupq_n_f32(m_cameraPosition[1]));
+			float32x4_t dz = vsubq_f32(z, vdupq_n_f32(m_cameraPosition[2]));
+			float32x4_t distance = vsqrtq_f32(vmlaq_f32(vmlaq_f32(vmulq_f32(dx, dx), dy, dy), dz, dz));
+			vst1q_f32(distances, distance);
+
+			uint32x4_t visible = vcltq_f32(vsubq_f32(distance, radius), vdupq_n_f32(maxDistance));
+			if (m_isFrustumCullingEnabled) {
+				float32x4_t limit = vnegq_f32(vaddq_f32(radius, vdupq_n_f32(m_frustumMargin)));
+				for (int i = 0; i < 4; i++) {
+					float32x4_t d = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(vdupq_n_f32(m_planes[i][3]), x, m_planes[i][0]), y, m_planes[i][1]), z, m_planes[i][2]);
+					visible = vandq_u32(visible, vcgtq_f32(d, limit));
+				}
+			}
+			const int32_t laneBits[4] = { 1, 2, 4, 8 };
+			visibleMask = vaddvq_s32(vandq_s32(vreinterpretq_s32_u32(visible), vld1q_s32(laneBits)));
+#else
+			visibleMask = 0;
+			for (int lane = 0; lane < 4; lane++) {
+				uint32_t i = group + lane;
+				float dx = m_sphereX[i] - m_cameraPosition[0];
+				float dy = m_sphereY[i] - m_cameraPosition[1];
+				float dz = m_sphereZ[i] - m_cameraPosition[2];
+				distances[lane] = std::sqrt(dx * dx + dy * dy + dz * dz);
+				bool isVisible = distances[lane] - m_sphereRadius[i] < maxDistance;
+				for (int p = 0; m_isFrustumCullingEnabled && p < 4; p++)
+					isVisible &= m_planes[p][0] * m_sphereX[i] + m_planes[p][1] * m_sphereY[i] + m_planes[p][2] * m_sphereZ[i] + m_planes[p][3] > -(m_sphereRadius[i] + m_frustumMargin);
+				visibleMask |= isVisible ? 1 << lane : 0;
+			}
+#endif
+
+			// LOD selection only runs for the visible instances
+			for (int lane = 0; lane < 4; lane++) {
+				if (!(visibleMask & (1 << lane)))
+					continue;
+				uint32_t i = group + lane;
+				const Mesh& mesh = m_meshes[m_meshIndices[i]];
+
+				// error in pixels per unit of object space error at the closest point of the bounds
+				float pixelsPerError = m_errorToPixels * m_scales[i] / std::max(distances[lane] - m_sphereRadius[i], 1e-3f);
+				uint32_t lod = mesh.lodFirst;
+				for (uint32_t l = mesh.lodFirst + mesh.lodCount; l-- > mesh.lodFirst;) {
+					if (m_lods[l].geometricError * pixelsPerError <= m_maxScreenSpaceError) {
+						lod = l;
+						break;
+					}
+				}
+
+				instances.push_back(m_instances[i]);
+				instances.back().accelerationStructureReference = m_lods[lod].accelerationStructureReference;
+			}
+		}
+	}
+
+	uint32_t InstanceProcessor::process(AccelerationStructure& tlas) {
+		uint32_t instanceCount = m_meshIndices.size();
+		uint32_t groupCount = (instanceCount + 3) / 4;
+
+		// small scenes aren't worth waking threads for
+		uint32_t threadCount = m_threadCount > 0 ? m_threadCount : std::max(1u, std::thread::hardware_concurrency());
+		threadCount = std::max(1u, std::min(threadCount, instanceCount / 2048));
+
+		m_threadInstances.resize(threadCount);
+		uint32_t groupsPerThread = (groupCount + threadCount - 1) / threadCount;
+		auto processThread = [&](uint32_t thread) {
+			m_threadInstances[thread].clear();
+			uint32_t first = std::min(groupCount, thread * groupsPerThread) * 4;
+			uint32_t end = std::min(groupCount, (thread + 1) * groupsPerThread) * 4;
+			processRange(first, end, m_threadInstances[thread]);
+			};
+
+		std::vector<std::thread> threads;
+		for (uint32_t thread = 1; thread < threadCount; thread++)
+			threads.emplace_back(processThread, thread);
+		processThread(0);
+		for (std::thread& thread : threads)
+			thread.join();
+
+		m_visibleCount = 0;
+		for (auto& instances : m_threadInstances)
+			m_visibleCount += instances.size();
+
+		// the per thread results are appended in order, so the instance order stays stable between frames
+		VkAccelerationStructureInstanceKHR* pMappedInstances = tlas.mapInstances(m_visibleCount);
+		for (auto& instances : m_threadInstances) {
+			memcpy(pMappedInstances, instances.data(), instances.size() * sizeof(VkAccelerationStructureInstanceKHR));
+			pMappedInstances += instances.size();
+		}
+		return m_visibleCount;
+	}
+
+	/* ShaderBindingTable */
+	ShaderBindingTable::ShaderBindingTable() {}
+
+	ShaderBindingTable::~ShaderBindingTable() {}
+
+	void ShaderBindingTable::init() {
+		if (m_isInit)
+			return;
+		m_isInit = true;
+
+		m_handlesChanged = true;
+		m_writeAll = true;
+		update();
+	}
+
+	void ShaderBindingTable::destroy() {
+		if (!m_isInit)
+			return;
+		m_isInit = false;
+
+		m_buffer.destroy();
+		m_buffer = Buffer();
+		m_deviceAddress = 0;
+		m_handles.clear();
+		m_handleCount = 0;
+		for (uint32_t region = 0; region < eREGION_COUNT; region++) {
+			m_offsets[region] = 0;
+			m_strides[region] = 0;
+			m_capacities[region] = 0;
+		}
+	}
+
+	void ShaderBindingTable::update(DeletionQueue* pDeletionQueue) {
+		if (!m_isInit)
+			return;
+		if (m_pipeline == VK_NULL_HANDLE) {
+			std::cerr << "ERROR: Shader binding table has no pipeline, call setPipeline first\n";
+			throw std::runtime_error("Shader binding table without pipeline");
+		}
+		if (m_records[eREGION_RAYGEN].empty()) {
+			std::cerr << "ERROR: Shader binding table needs at least one raygen record\n";
+			throw std::runtime_error("Shader binding table without raygen record");
+		}
+
+		uint32_t handleSize = rtProperties.shaderGroupHandleSize;
+
+		uint32_t groupCount = 0;
+		for (uint32_t region = 0; region < eREGION_COUNT; region++)
+			for (const Record& record : m_records[region])
+				groupCount = std::max(groupCount, record.groupIndex + 1);
+
+		if (m_handlesChanged || groupCount > m_handleCount) {
+			m_handles.resize(groupCount * handleSize);
+			VkResult result = vkGetRayTracingShaderGroupHandlesKHR(device, m_pipeline, 0, groupCount, m_handles.size(), m_handles.data());
+			VK_ASSERT(result);
+			m_handleCount = groupCount;
+			m_handlesChanged = false;
+			m_writeAll = true;
+		}
+
+		// every record of a region has the same stride, so the largest inline data decides it
+		bool isRelayout = false;
+		VkDeviceSize strides[eREGION_COUNT];
+		for (uint32_t region = 0; region < eREGION_COUNT; region++) {
+			VkDeviceSize dataSize = m_maxDataSizes[region];
+			for (const Record& record : m_records[region])
+				dataSize = std::max<VkDeviceSize>(dataSize, record.data.size());
+
+			strides[region] = align_up<VkDeviceSize>(handleSize + dataSize, rtProperties.shaderGroupHandleAlignment);
+			if (region == eREGION_RAYGEN) // every raygen record is the start of its own region
+				strides[region] = align_up<VkDeviceSize>(strides[region], rtProperties.shaderGroupBaseAlignment);
+			if (strides[region] > rtProperties.maxShaderGroupStride) {
+				std::cerr << "ERROR: Shader binding table record exceeds maxShaderGroupStride | Stride: " << strides[region] << " Max: " << rtProperties.maxShaderGroupStride << "\n";
+				throw std::runtime_error("Shader binding table record too large");
+			}
+			if (strides[region] != m_strides[region] || m_records[region].size() > m_capacities[region])
+				isRelayout = true;
+		}
+
+		bool isReallocated = false;
+		if (isRelayout) {
+			VkDeviceSize size = 0;
+			for (uint32_t region = 0; region < eREGION_COUNT; region++) {
+				uint32_t count = m_records[region].size();
+				if (count > m_capacities[region]) // leave room so adding records doesn't recreate the buffer every time
+					m_capacities[region] = std::max(count, m_capacities[region] + m_capacities[region] / 2);
+				m_strides[region] = strides[region];
+				m_offsets[region] = size;
+				size += align_up<VkDeviceSize>(m_capacities[region] * m_strides[region], rtProperties.shaderGroupBaseAlignment);
+			}
+			if (size > m_buffer.getSize() || m_buffer.getVkBuffer() == VK_NULL_HANDLE || m_isPlacementChanged) {
+				reallocate(size, pDeletionQueue);
+				isReallocated = true;
+			}
+			m_writeAll = true;
+		}
+		else if (m_buffer.getVkBuffer() == VK_NULL_HANDLE || m_isPlacementChanged) { // handed to a deletion queue from outside or placed differently
+			reallocate(m_buffer.getSize(), pDeletionQueue);
+			isReallocated = true;
+			m_writeAll = true;
+		}
+
+		// with a deletion queue changes go into a new buffer, frames in flight keep reading the old one until it is retired
+		bool hasDirtyRecords = m_writeAll;
+		for (uint32_t region = 0; region < eREGION_COUNT; region++)
+			for (const Record& record : m_records[region])
+				hasDirtyRecords |= record.isDirty;
+		if (pDeletionQueue && hasDirtyRecords && !isReallocated) {
+			reallocate(m_buffer.getSize(), pDeletionQueue);
+			m_writeAll = true;
+		}
+
+		// srcOffset is the position in the packed staging buffer, unused when the table is mapped directly
+		std::vector<Record*> pRecords;
+		std::vector<VkBufferCopy> copies;
+		VkDeviceSize stagingSize = 0;
+		for (uint32_t region = 0; region < eREGION_COUNT; region++) {
+			for (uint32_t i = 0; i < m_records[region].size(); i++) {
+				Record& record = m_records[region][i];
+				if (!m_writeAll && !record.isDirty)
+					continue;
+				VkDeviceSize recordSize = handleSize + record.data.size();
+				pRecords.push_back(&record);
+				copies.push_back({ stagingSize, m_offsets[region] + i * m_strides[region], recordSize });
+				stagingSize += recordSize;
+			}
+		}
+		m_writeAll = false;
+		if (copies.empty())
+			return;
+
+		Buffer stagingBuffer;
+		uint8_t* pData = nullptr;
+		if (m_isStaged) {
+			stagingBuffer = Buffer(stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+			stagingBuffer.init(); stagingBuffer.allocate(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+			stagingBuffer.map((void**)&pData);
+		}
+		else
+			m_buffer.map((void**)&pData);
+
+		for (uint32_t i = 0; i < pRecords.size(); i++) {
+			Record& record = *pRecords[i];
+			uint8_t* pRecord = pData + (m_isStaged ? copies[i].srcOffset : copies[i].dstOffset);
+			memcpy(pRecord, m_handles.data() + record.groupIndex * handleSize, handleSize);
+			if (!record.data.empty())
+				memcpy(pRecord + handleSize, record.data.data(), record.data.size());
+			record.isDirty = false;
+		}
+
+		if (!m_isStaged) {
+			m_buffer.unmap();
+			return;
+		}
+		stagingBuffer.unmap();
+
+		CommandBuffer commandBuffer = CommandBuffer(true);
+		commandBuffer.begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+		// traces submitted before on this queue have to be done reading the records
+		VkMemoryBarrier barrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+		barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer.getVkCommandBuffer(),
+			VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0, 1, &barrier, 0, nullptr, 0, nullptr
+		);
+
+		vkCmdCopyBuffer(commandBuffer.getVkCommandBuffer(), stagingBuffer, m_buffer, copies.size(), copies.data());
+
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer.getVkCommandBuffer(),
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+			0, 1, &barrier, 0, nullptr, 0, nullptr
+		);
+		commandBuffer.end();
+		commandBuffer.submit();
+		commandBuffer.free();
+
+		stagingBuffer.destroy();
+	}
+
+	void ShaderBindingTable::reallocate(VkDeviceSize size, DeletionQueue* pDeletionQueue) {
+		if (pDeletionQueue)
+			pDeletionQueue->push(m_buffer);
+		else
+			m_buffer.destroy();
+
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+		MemoryPlacement memoryPlacement = m_memoryPlacement;
+		if (memoryPlacement == eMEMORY_PLACEMENT_AUTO) {
+			// integrated gpus share the memory and with resizable BAR device local memory can be written directly
+			bool isIntegrated = properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU;
+			memoryPlacement = isIntegrated || isResizableBarAvailable() ? eMEMORY_PLACEMENT_HOST_VISIBLE : eMEMORY_PLACEMENT_DEVICE_LOCAL;
+		}
+
+		VkMemoryPropertyFlags memoryPropertyFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+		m_isStaged = memoryPlacement == eMEMORY_PLACEMENT_DEVICE_LOCAL;
+		if (!m_isStaged) {
+			memoryPropertyFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+			if (m_memoryPlacement == eMEMORY_PLACEMENT_AUTO && isMemoryTypeAvailable(memoryPropertyFlags | VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+				memoryPropertyFlags |= VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+		}
+		m_isPlacementChanged = false;
+
+		m_buffer = Buffer(size,
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+			| VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR);
+		m_buffer.init(); m_buffer.allocate(memoryPropertyFlags);
+		m_deviceAddress = m_buffer.getVkDeviceAddress();
+	}
+
+	void ShaderBindingTable::setMemoryPlacement(MemoryPlacement memoryPlacement) {
+		if (m_memoryPlacement == memoryPlacement)
+			return;
+		m_memoryPlacement = memoryPlacement;
+		m_isPlacementChanged = true;
+	}
+
+	void ShaderBindingTable::setPipeline(VkPipeline pipeline) {
+		m_pipeline = pipeline;
+		m_handlesChanged = true;
+	}
+
+	uint32_t ShaderBindingTable::addRecord(Region region, uint32_t groupIndex, const void* pData, uint32_t dataSize) {
+		Record record{ groupIndex, {}, true };
+		if (pData && dataSize > 0)
+			record.data.assign((const uint8_t*)pData, (const uint8_t*)pData + dataSize);
+		m_records[region].push_back(record);
+		return m_records[region].size() - 1;
+	}
+
+	void ShaderBindingTable::setRecordGroup(Region region, uint32_t index, uint32_t groupIndex) {
+		Record& record = m_records[region][index];
+		if (record.groupIndex == groupIndex)
+			return;
+		record.groupIndex = groupIndex;
+		record.isDirty = true;
+	}
+
+	void ShaderBindingTable::setRecordData(Region region, uint32_t index, const void* pData, uint32_t dataSize, uint32_t offset) {
+		Record& record = m_records[region][index];
+		if (record.data.size() < offset + dataSize)
+			record.data.resize(offset + dataSize, 0);
+		memcpy(record.data.data() + offset, pData, dataSize);
+		record.isDirty = true;
+	}
+
+	void ShaderBindingTable::setRecordCount(Region region, uint32_t count) {
+		m_records[region].resize(count, { 0, {}, true });
+	}
+
+	void ShaderBindingTable::clear() {
+		for (uint32_t region = 0; region < eREGION_COUNT; region++)
+			m_records[region].clear();
+	}
+
+	VkStridedDeviceAddressRegionKHR ShaderBindingTable::getRayGenRegion(uint32_t index) const {
+		VkStridedDeviceAddressRegionKHR region = {};
+		if (index >= m_records[eREGION_RAYGEN].size() || m_deviceAddress == 0)
+			return region;
+		region.deviceAddress = m_deviceAddress + m_offsets[eREGION_RAYGEN] + index * m_strides[eREGION_RAYGEN];
+		region.stride = m_strides[eREGION_RAYGEN];
+		region.size = region.stride; // The size member of pRayGenShaderBindingTable must be equal to its stride member
+		return region;
+	}
+
+	VkStridedDeviceAddressRegionKHR ShaderBindingTable::getRegion(Region region) const {
+		VkStridedDeviceAddressRegionKHR stridedRegion = {};
+		if (m_records[region].empty() || m_deviceAddress == 0)
+			return stridedRegion;
+		stridedRegion.deviceAddress = m_deviceAddress + m_offsets[region];
+		stridedRegion.stride = m_strides[region];
+		stridedRegion.size = m_records[region].size() * m_strides[region];
+		return stridedRegion;
+	}
+
+	/* RtPipeline */
+	RtPipeline::RtPipeline(){}
+
+	RtPipeline::~RtPipeline(){}
+
+	void RtPipeline::init() {
+		if (m_isInit) return;
+
+		// the layout is only recreated if the descriptor set layouts changed, the libraries are compiled against it
+		if (m_isLayoutChanged) {
+			destroyLibraries();
+			vkDestroyPipelineLayout(device, m_pipelineLayout, nullptr);
+
+			VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{ VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+			pipelineLayoutCreateInfo.setLayoutCount = m_descriptorSetLayouts.size();
+			pipelineLayoutCreateInfo.pSetLayouts = m_descriptorSetLayouts.data();
+			pipelineLayoutCreateInfo.pushConstantRangeCount = 0;
+			pipelineLayoutCreateInfo.pPushConstantRanges = nullptr;
+
+			VkResult result = vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &m_pipelineLayout);
+			VK_ASSERT(result);
+			m_isLayoutChanged = false;
+		}
+
+		if (m_useLibraries && m_libraryCreateFlags != m_createFlags) {
+			destroyLibraries();
+			m_libraryCreateFlags = m_createFlags;
+		}
+		BuildState state = getBuildState();
+		if (m_useLibraries) {
+			compileLibraries(state);
+			m_libraries = state.libraries;
+			m_pipeline = linkLibraries(state);
+		}
+		else
+			m_pipeline = createVkPipeline(state);
+	}
+
+	RtPipeline::BuildState RtPipeline::getBuildState() const {
+		BuildState state;
+		state.layout = m_pipelineLayout;
+		state.createFlags = m_createFlags;
+		state.useLibraries = m_useLibraries;
+		state.libraryInterface = m_libraryInterface;
+		state.stages = m_stages;
+		state.groups = m_shaderGroupes;
+		if (m_useLibraries) {
+			// libraries compiled with other flags can't be linked, they all get compiled again
+			if (m_libraryCreateFlags == m_createFlags)
+				state.libraries = m_libraries;
+			state.libraries.resize(m_shaderGroupes.size(), VK_NULL_HANDLE);
+		}
+		return state;
+	}
+
+	VkPipeline RtPipeline::createVkPipeline(const BuildState& state) {
+		VkRayTracingPipelineCreateInfoKHR rtPipelineCreateInfo{ VK_STRUCTURE_TYPE_RAY_TRACING_PIPELINE_CREATE_INFO_KHR };
+		rtPipelineCreateInfo.flags = state.createFlags;
+		rtPipelineCreateInfo.stageCount = state.stages.size();
+		rtPipelineCreateInfo.pStages = state.stages.data();
+		rtPipelineCreateInfo.groupCount = state.groups.size();
+		rtPipelineCreateInfo.pGroups = state.groups.data();
+		rtPipelineCreateInfo.maxPipelineRayRecursionDepth = 10;
+		rtPipelineCreateInfo.layout = state.layout;
+
+		VkPipeline pipeline;
+		VkResult result = vkCreateRayTracingPipelinesKHR(device, {}, {}, 1, &rtPipelineCreateInfo, nullptr, &pipeline);
+		VK_ASSERT(result);
+		return pipeline;
+	}
+
+	void RtPipeline::enableLibraries(uint32_t maxPipelineRayPayloadSize, uint32_t maxPipelineRayHitAttributeSize) {
+		m_useLibraries = true;
+		if (m_libraryInterface.maxPipelineRayPayloadSize != maxPipelineRayPayloadSize
+			|| m_libraryInterface.maxPipelineRayHitAttributeSize != maxPipelineRayHitAttributeSize)
+			destroyLibraries();
+		m_libraryInterface.maxPipelineRayPayloadSize = maxPipelineRayPayloadSize;
+		m_libraryInterface.maxPipelineRayHitAttributeSize = maxPipelineRayHitAttributeSize;
+	}
+
+	void RtPipeline::compileLibraries(BuildState& state) {
+		// every library holds a single group and the stages it references, with the indices remapped
+		std::vector<uint32_t> groupIndices;
+		for (uint32_t i = 0; i < state.libraries.size(); i++) {
+			if (state.libraries[i] == VK_NULL_HANDLE)
+				groupIndices.push_back(i);
+		}
+		if (groupIndices.empty())
+			return;
+
+		std::vector<std::vector<VkPipelineShaderStageCreateInfo>> stages(groupIndices.size());
+		std::vector<VkRayTracingShaderGroupCreateInfoKHR> groups(groupIndices.size());
+		std::vector<VkRayTracingPipelineCreateInfoKHR> createInfos(groupIndices.size());
+		for (uint32_t i = 0; i < groupIndices.size(); i++) {
+			VkRayTracingShaderGroupCreateInfoKHR& group = groups[i];
+			group = state.groups[groupIndices[i]];
+			for (uint32_t* pShader : { &group.generalShader, &group.closestHitShader, &group.anyHitShader, &group.intersectionShader }) {
+				if (*pShader == VK_SHADER_UNUSED_KHR)
+					continue;
+				stages[i].push_back(state.stages[*pShader]);
+				*pShader = stages[i].size() - 1;
+			}
+
+			VkRayTracingPipelineCreateInfoKHR& createInfo = createInfos[i];
+			createInfo = { VK_STRUCTURE_TYPE_RAY_TRACING_PIPELINE_CREATE_INFO_KHR };
+			createInfo.flags = state.createFlags | VK_PIPELINE_CREATE_LIBRARY_BIT_KHR;
+			createInfo.stageCount = stages[i].size();
+			createInfo.pStages = stages[i].data();
+			createInfo.groupCount = 1;
+			createInfo.pGroups = &group;
+			createInfo.maxPipelineRayRecursionDepth = 10;
+			createInfo.pLibraryInterface = &state.libraryInterface;
+			createInfo.layout = state.layout;
+		}
+
+		std::vector<VkPipeline> libraries(groupIndices.size());
+		VkResult result = vkCreateRayTracingPipelinesKHR(device, {}, {}, createInfos.size(), createInfos.data(), nullptr, libraries.data());
+		VK_ASSERT(result);
+		for (uint32_t i = 0; i < groupIndices.size(); i++)
+			state.libraries[groupIndices[i]] = libraries[i];
+	}
+
+	VkPipeline RtPipeline::linkLibraries(const BuildState& state) {
+		// the groups of the libraries are concatenated in order, so the group indices stay the same as without libraries
+		VkPipelineLibraryCreateInfoKHR libraryCreateInfo{ VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR };
+		libraryCreateInfo.libraryCount = state.libraries.size();
+		libraryCreateInfo.pLibraries = state.libraries.data();
+
+		VkRayTracingPipelineCreateInfoKHR rtPipelineCreateInfo{ VK_STRUCTURE_TYPE_RAY_TRACING_PIPELINE_CREATE_INFO_KHR };
+		rtPipelineCreateInfo.flags = state.createFlags;
+		rtPipelineCreateInfo.stageCount = 0;
+		rtPipelineCreateInfo.groupCount = 0;
+		rtPipelineCreateInfo.maxPipelineRayRecursionDepth = 10;
+		rtPipelineCreateInfo.pLibraryInfo = &libraryCreateInfo;
+		rtPipelineCreateInfo.pLibraryInterface = &state.libraryInterface;
+		rtPipelineCreateInfo.layout = state.layout;
+
+		VkPipeline pipeline;
+		VkResult result = vkCreateRayTracingPipelinesKHR(device, {}, {}, 1, &rtPipelineCreateInfo, nullptr, &pipeline);
+		VK_ASSERT(result);
+		return pipeline;
+	}
+
+	void RtPipeline::destroyLibraries() {
+		for (VkPipeline& library : m_libraries) {
+			vkDestroyPipeline(device, library, nullptr);
+			library = VK_NULL_HANDLE;
+		}
+	}
+
+	void RtPipeline::invalidateLibraries(BuildState& state, VkShaderModule module) {
+		for (uint32_t i = 0; i < state.libraries.size(); i++) {
+			const VkRayTracingShaderGroupCreateInfoKHR& group = state.groups[i];
+			for (uint32_t shader : { group.generalShader, group.closestHitShader, group.anyHitShader, group.intersectionShader }) {
+				if (shader != VK_SHADER_UNUSED_KHR && state.stages[shader].module == module) {
+					state.libraries[i] = VK_NULL_HANDLE;
+					break;
+				}
+			}
+		}
+	}
+
+	void RtPipeline::initShaderBindingTable() {
+		if (m_hasDefaultRecords || (m_shaderBindingTable.getRecordCount(ShaderBindingTable::eREGION_RAYGEN) == 0
+			&& m_shaderBindingTable.getRecordCount(ShaderBindingTable::eREGION_MISS) == 0
+			&& m_shaderBindingTable.getRecordCount(ShaderBindingTable::eREGION_HIT) == 0
+			&& m_shaderBindingTable.getRecordCount(ShaderBindingTable::eREGION_CALLABLE) == 0))
+		{
+			// one record per group, records keep their data as long as their position in the region stays the same
+			std::vector<uint32_t> groupIndices[ShaderBindingTable::eREGION_COUNT];
+			for (uint32_t i = 0; i < m_shaderGroupes.size(); i++) {
+				const VkRayTracingShaderGroupCreateInfoKHR& group = m_shaderGroupes[i];
+				if (group.type != VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR) {
+					groupIndices[ShaderBindingTable::eREGION_HIT].push_back(i);
+					continue;
+				}
+				switch (m_stages[group.generalShader].stage)
+				{
+				case VK_SHADER_STAGE_RAYGEN_BIT_KHR:
+					groupIndices[ShaderBindingTable::eREGION_RAYGEN].push_back(i);
+					break;
+				case VK_SHADER_STAGE_MISS_BIT_KHR:
+					groupIndices[ShaderBindingTable::eREGION_MISS].push_back(i);
+					break;
+				case VK_SHADER_STAGE_CALLABLE_BIT_KHR:
+					groupIndices[ShaderBindingTable::eREGION_CALLABLE].push_back(i);
+					break;
+				default:
+					break;
+				}
+			}
+			for (uint32_t region = 0; region < ShaderBindingTable::eREGION_COUNT; region++) {
+				ShaderBindingTable::Region sbtRegion = static_cast<ShaderBindingTable::Region>(region);
+				m_shaderBindingTable.setRecordCount(sbtRegion, groupIndices[region].size());
+				for (uint32_t i = 0; i < groupIndices[region].size(); i++)
+					m_shaderBindingTable.setRecordGroup(sbtRegion, i, groupIndices[region][i]);
+			}
+			m_hasDefaultRecords = true;
+		}
+
+		m_shaderBindingTable.setPipeline(m_pipeline);
+		m_shaderBindingTable.init();
+		m_shaderBindingTable.update();
+	}
+
+	void RtPipeline::update() {
+		// the shader binding table is kept and only gets the handles of the new pipeline
+		vkDestroyPipeline(device, m_pipeline, nullptr);
+		m_pipeline = VK_NULL_HANDLE;
 		init();
 		initShaderBindingTable();
 	}
 
 	void RtPipeline::destroy() {
-		m_rtSBTBuffer.destroy();
+		m_shaderBindingTable.destroy();
+		destroyLibraries();
+		m_libraries.clear();
 		vkDestroyPipelineLayout(device, m_pipelineLayout, nullptr);
 		vkDestroyPipeline(device, m_pipeline, nullptr);
+		m_pipelineLayout = VK_NULL_HANDLE;
+		m_pipeline = VK_NULL_HANDLE;
+		m_isLayoutChanged = true;
 	}
 
 	void RtPipeline::addShader(const VkPipelineShaderStageCreateInfo& shaderStage) {
@@ -2405,6 +5735,7 @@ namespace vk
 
 	void RtPipeline::delShader(uint32_t index) {
 		m_stages.erase(m_stages.begin()+index);
+		destroyLibraries(); // the stage indices of the groups shift
 	}
 
 	void RtPipeline::addGroup(const VkRayTracingShaderGroupCreateInfoKHR& group) {
@@ -2413,18 +5744,502 @@ namespace vk
 
 	void RtPipeline::delGroup(uint32_t index) {
 		m_shaderGroupes.erase(m_shaderGroupes.begin() + index);
+		if (index < m_libraries.size()) {
+			vkDestroyPipeline(device, m_libraries[index], nullptr);
+			m_libraries.erase(m_libraries.begin() + index);
+		}
 	}
 
 	void RtPipeline::addDescriptorSetLayout(VkDescriptorSetLayout setLayout){
 		m_descriptorSetLayouts.push_back(setLayout);
+		m_isLayoutChanged = true;
 	}
 
 	void RtPipeline::setDescriptorSetLayout(int index, VkDescriptorSetLayout setLayout) {
 		m_descriptorSetLayouts[index] = setLayout;
+		m_isLayoutChanged = true;
 	}
 
 	void RtPipeline::delDescriptorSetLayout(int index){
 		m_descriptorSetLayouts.erase(m_descriptorSetLayouts.begin() + index);
+		m_isLayoutChanged = true;
+	}
+
+	/* DeletionQueue */
+	DeletionQueue::DeletionQueue() {}
+	DeletionQueue::~DeletionQueue() {}
+
+	void DeletionQueue::push(std::function<void()> destroyFunction) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_entries.push_back({ m_frame, destroyFunction });
+	}
+
+	void DeletionQueue::push(Buffer& buffer) {
+		VkBuffer vkBuffer = buffer.m_isInit ? buffer.m_buffer : VK_NULL_HANDLE;
+		VkDeviceMemory deviceMemory = buffer.m_isAlloc ? buffer.m_deviceMemory : VK_NULL_HANDLE;
+		buffer.m_isInit = false;
+		buffer.m_isAlloc = false;
+		buffer.m_buffer = VK_NULL_HANDLE;
+		buffer.m_deviceMemory = VK_NULL_HANDLE;
+
+		push([vkBuffer, deviceMemory]() {
+			if (deviceMemory != VK_NULL_HANDLE)
+				vkFreeMemory(device, deviceMemory, nullptr);
+			if (vkBuffer != VK_NULL_HANDLE)
+				vkDestroyBuffer(device, vkBuffer, nullptr);
+			});
+	}
+
+	void DeletionQueue::nextFrame() {
+		std::vector<std::function<void()>> expired;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_frame++;
+			uint32_t i = 0;
+			while (i < m_entries.size()) {
+				if (m_frame - m_entries[i].first > m_frameDelay) {
+					expired.push_back(m_entries[i].second);
+					m_entries.erase(m_entries.begin() + i);
+				}
+				else {
+					i++;
+				}
+			}
+		}
+		for (auto& destroyFunction : expired)
+			destroyFunction();
+	}
+
+	void DeletionQueue::flush() {
+		std::vector<std::pair<uint64_t, std::function<void()>>> entries;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			entries.swap(m_entries);
+		}
+		for (auto& entry : entries)
+			entry.second();
+	}
+
+	/* ShaderHotReloader */
+	static void replaceShaderModule(std::vector<VkPipelineShaderStageCreateInfo>& stages, VkShaderModule oldModule, VkShaderModule newModule) {
+		for (auto& stage : stages) {
+			if (stage.module == oldModule)
+				stage.module = newModule;
+		}
+	}
+
+	ShaderHotReloader::ShaderHotReloader() {}
+	ShaderHotReloader::~ShaderHotReloader() {
+		destroy();
+	}
+
+	void ShaderHotReloader::init() {
+		if (m_isRunning)
+			return;
+		m_isRunning = true;
+
+#ifdef __linux__
+		m_inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (m_inotifyFd < 0) {
+			std::cerr << "ERROR: ShaderHotReloader failed to initialize inotify\n";
+			throw std::runtime_error("Failed to initialize inotify");
+		}
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			for (auto& watch : m_watches)
+				addDirectoryWatch(watch.directory);
+		}
+#endif
+
+		m_thread = std::thread(&ShaderHotReloader::watch, this);
+	}
+
+	void ShaderHotReloader::destroy() {
+		if (!m_isRunning)
+			return;
+		m_isRunning = false;
+		m_thread.join();
+
+#ifdef __linux__
+		close(m_inotifyFd);
+		m_inotifyFd = -1;
+		m_watchDescriptors.clear();
+#endif
+
+		for (auto& reload : m_pendingReloads)
+			vkDestroyShaderModule(device, reload.module, nullptr);
+		for (auto* pBuilds : { &m_pendingBuilds, &m_finishedBuilds }) {
+			for (auto& build : *pBuilds) {
+				destroyPipelines(build);
+				vkDestroyShaderModule(device, build.reload.module, nullptr);
+			}
+		}
+		m_pendingReloads.clear();
+		m_pendingBuilds.clear();
+		m_finishedBuilds.clear();
+		m_buildingShaders.clear();
+		m_buildCondition.notify_all();
+		m_deletionQueue.flush();
+	}
+
+	void ShaderHotReloader::update() {
+		std::vector<Build> builds;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			builds.swap(m_finishedBuilds);
+		}
+
+		// a reload whose pipelines changed while they were built starts over from their current state
+		std::vector<Reload> reloads;
+		for (auto& build : builds) {
+			if (build.isFailed) {
+				destroyPipelines(build);
+				vkDestroyShaderModule(device, build.reload.module, nullptr);
+			}
+			else if (!isCurrent(build)) {
+				destroyPipelines(build);
+				reloads.push_back(build.reload);
+			}
+			else
+				apply(build);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			for (auto& build : builds)
+				m_buildingShaders.erase(std::find(m_buildingShaders.begin(), m_buildingShaders.end(), build.reload.pShader));
+
+			reloads.insert(reloads.end(), m_pendingReloads.begin(), m_pendingReloads.end());
+			m_pendingReloads.clear();
+			for (uint32_t i = 0; i < reloads.size(); i++) {
+				// a shader saved twice before its pipelines are built only needs its latest module
+				bool isSuperseded = false;
+				for (uint32_t j = i + 1; j < reloads.size(); j++)
+					isSuperseded |= reloads[j].pShader == reloads[i].pShader;
+				if (isSuperseded) {
+					vkDestroyShaderModule(device, reloads[i].module, nullptr);
+					continue;
+				}
+				if (std::find(m_buildingShaders.begin(), m_buildingShaders.end(), reloads[i].pShader) != m_buildingShaders.end()) {
+					m_pendingReloads.push_back(reloads[i]);
+					continue;
+				}
+				m_buildingShaders.push_back(reloads[i].pShader);
+				m_pendingBuilds.push_back(prepareBuild(reloads[i]));
+			}
+		}
+
+		m_deletionQueue.nextFrame();
+	}
+
+	void ShaderHotReloader::wait() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_buildCondition.wait(lock, [this]() { return !m_isRunning || (m_pendingBuilds.empty() && !m_isBuilding); });
+	}
+
+	ShaderHotReloader::Build ShaderHotReloader::prepareBuild(const Reload& reload) {
+		Build build;
+		build.reload = reload;
+		build.oldModule = reload.pShader->m_module;
+
+		for (Pipeline* pPipeline : reload.pipelines) {
+			build.pipelineStates.push_back(*pPipeline);
+			replaceShaderModule(build.pipelineStates.back().m_shaderStages, build.oldModule, reload.module);
+			build.oldPipelines.push_back(pPipeline->m_isInit ? pPipeline->m_pipeline : VK_NULL_HANDLE);
+		}
+
+		for (RtPipeline* pRtPipeline : reload.rtPipelines) {
+			// only the libraries of groups using the shader are compiled again and then relinked with the others
+			RtPipeline::BuildState state = pRtPipeline->getBuildState();
+			if (state.useLibraries)
+				RtPipeline::invalidateLibraries(state, build.oldModule);
+			replaceShaderModule(state.stages, build.oldModule, reload.module);
+			build.rtPipelineStates.push_back(state);
+			build.oldRtPipelines.push_back(pRtPipeline->m_pipeline);
+			build.oldLibraries.push_back(pRtPipeline->m_libraries);
+		}
+		return build;
+	}
+
+	void ShaderHotReloader::buildPipelines(Build& build) {
+		try {
+			for (uint32_t i = 0; i < build.pipelineStates.size(); i++) {
+				const Pipeline& state = build.pipelineStates[i];
+				build.pipelines.push_back(build.oldPipelines[i] != VK_NULL_HANDLE ? state.createVkPipeline(state.m_shaderStages) : VK_NULL_HANDLE);
+			}
+			for (uint32_t i = 0; i < build.rtPipelineStates.size(); i++) {
+				RtPipeline::BuildState& state = build.rtPipelineStates[i];
+				VkPipeline pipeline = VK_NULL_HANDLE;
+				if (build.oldRtPipelines[i] != VK_NULL_HANDLE) {
+					if (state.useLibraries) {
+						RtPipeline::compileLibraries(state);
+						pipeline = RtPipeline::linkLibraries(state);
+					}
+					else
+						pipeline = RtPipeline::createVkPipeline(state);
+				}
+				build.rtPipelines.push_back(pipeline);
+			}
+		}
+		catch (std::exception& e) {
+			std::cerr << "ERROR: ShaderHotReloader failed to rebuild the pipelines of: " << build.reload.pShader->getPath() << " | " << e.what() << "\n";
+			build.isFailed = true;
+		}
+	}
+
+	void ShaderHotReloader::buildPending() {
+		while (m_isRunning) {
+			Build build;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (m_pendingBuilds.empty())
+					return;
+				build = std::move(m_pendingBuilds.front());
+				m_pendingBuilds.erase(m_pendingBuilds.begin());
+				m_isBuilding = true;
+			}
+
+			buildPipelines(build);
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_finishedBuilds.push_back(std::move(build));
+				m_isBuilding = false;
+			}
+			m_buildCondition.notify_all();
+		}
+	}
+
+	bool ShaderHotReloader::isCurrent(const Build& build) {
+		if (build.reload.pShader->m_module != build.oldModule)
+			return false;
+		for (uint32_t i = 0; i < build.reload.pipelines.size(); i++) {
+			const Pipeline* pPipeline = build.reload.pipelines[i];
+			if ((pPipeline->m_isInit ? pPipeline->m_pipeline : VK_NULL_HANDLE) != build.oldPipelines[i])
+				return false;
+		}
+		for (uint32_t i = 0; i < build.reload.rtPipelines.size(); i++) {
+			const RtPipeline* pRtPipeline = build.reload.rtPipelines[i];
+			if (pRtPipeline->m_pipeline != build.oldRtPipelines[i] || pRtPipeline->m_libraries != build.oldLibraries[i]
+				|| pRtPipeline->m_pipelineLayout != build.rtPipelineStates[i].layout)
+				return false;
+		}
+		return true;
+	}
+
+	void ShaderHotReloader::apply(Build& build) {
+		Shader* pShader = build.reload.pShader;
+		VkShaderModule oldModule = build.oldModule;
+		VkShaderModule newModule = build.reload.module;
+
+		for (uint32_t i = 0; i < build.reload.pipelines.size(); i++) {
+			Pipeline* pPipeline = build.reload.pipelines[i];
+			replaceShaderModule(pPipeline->m_shaderStages, oldModule, newModule);
+			if (build.pipelines[i] == VK_NULL_HANDLE)
+				continue;
+
+			VkPipeline oldPipeline = pPipeline->m_pipeline;
+			m_deletionQueue.push([oldPipeline]() { vkDestroyPipeline(device, oldPipeline, nullptr); });
+			pPipeline->m_pipeline = build.pipelines[i];
+		}
+
+		for (uint32_t i = 0; i < build.reload.rtPipelines.size(); i++) {
+			RtPipeline* pRtPipeline = build.reload.rtPipelines[i];
+			replaceShaderModule(pRtPipeline->m_stages, oldModule, newModule);
+			if (build.rtPipelines[i] == VK_NULL_HANDLE)
+				continue;
+
+			const RtPipeline::BuildState& state = build.rtPipelineStates[i];
+			if (state.useLibraries) {
+				// the libraries that were compiled again replace the old ones
+				const std::vector<VkPipeline>& oldLibraries = build.oldLibraries[i];
+				for (uint32_t j = 0; j < oldLibraries.size(); j++) {
+					VkPipeline oldLibrary = oldLibraries[j];
+					if (oldLibrary != VK_NULL_HANDLE && (j >= state.libraries.size() || state.libraries[j] != oldLibrary))
+						m_deletionQueue.push([oldLibrary]() { vkDestroyPipeline(device, oldLibrary, nullptr); });
+				}
+				pRtPipeline->m_libraries = state.libraries;
+				pRtPipeline->m_libraryCreateFlags = state.createFlags;
+			}
+
+			VkPipeline oldPipeline = pRtPipeline->m_pipeline;
+			m_deletionQueue.push([oldPipeline]() { vkDestroyPipeline(device, oldPipeline, nullptr); });
+			m_deletionQueue.push(pRtPipeline->m_shaderBindingTable.m_buffer); // the shader group handles change with the pipeline
+			pRtPipeline->m_pipeline = build.rtPipelines[i];
+			pRtPipeline->initShaderBindingTable();
+		}
+
+		m_deletionQueue.push([oldModule]() { vkDestroyShaderModule(device, oldModule, nullptr); });
+		pShader->m_module = newModule;
+		pShader->m_shaderStage.module = newModule;
+	}
+
+	void ShaderHotReloader::destroyPipelines(Build& build) {
+		for (VkPipeline pipeline : build.pipelines)
+			vkDestroyPipeline(device, pipeline, nullptr);
+		for (VkPipeline pipeline : build.rtPipelines)
+			vkDestroyPipeline(device, pipeline, nullptr);
+		for (uint32_t i = 0; i < build.rtPipelineStates.size(); i++) {
+			const std::vector<VkPipeline>& libraries = build.rtPipelineStates[i].libraries;
+			const std::vector<VkPipeline>& oldLibraries = build.oldLibraries[i];
+			for (uint32_t j = 0; j < libraries.size(); j++) {
+				if (j >= oldLibraries.size() || libraries[j] != oldLibraries[j])
+					vkDestroyPipeline(device, libraries[j], nullptr);
+			}
+		}
+		build.pipelines.clear();
+		build.rtPipelines.clear();
+	}
+
+	void ShaderHotReloader::addShader(Shader& shader, std::string srcPath) {
+		Watch watch;
+		watch.pShader = &shader;
+		watch.srcPath = srcPath;
+
+		size_t separator = srcPath.find_last_of("/\\");
+		if (separator == std::string::npos) {
+			watch.directory = ".";
+			watch.fileName = srcPath;
+		}
+		else {
+			watch.directory = srcPath.substr(0, separator);
+			watch.fileName = srcPath.substr(separator + 1);
+		}
+
+		struct stat fileStat;
+		if (stat(srcPath.c_str(), &fileStat) == 0)
+			watch.lastWriteTime = fileStat.st_mtime;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+#ifdef __linux__
+		if (m_inotifyFd >= 0)
+			addDirectoryWatch(watch.directory);
+#endif
+		m_watches.push_back(watch);
+	}
+
+	void ShaderHotReloader::addDependency(Shader& shader, Pipeline& pipeline) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Watch* pWatch = findWatch(&shader);
+		if (!pWatch) {
+			std::cerr << "ERROR: Shader: " << &shader << " is not watched, call addShader first\n";
+			throw std::runtime_error("Shader is not watched");
+		}
+		pWatch->pipelines.push_back(&pipeline);
+	}
+	void ShaderHotReloader::addDependency(Shader& shader, RtPipeline& rtPipeline) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Watch* pWatch = findWatch(&shader);
+		if (!pWatch) {
+			std::cerr << "ERROR: Shader: " << &shader << " is not watched, call addShader first\n";
+			throw std::runtime_error("Shader is not watched");
+		}
+		pWatch->rtPipelines.push_back(&rtPipeline);
+	}
+
+	ShaderHotReloader::Watch* ShaderHotReloader::findWatch(Shader* pShader) {
+		for (auto& watch : m_watches) {
+			if (watch.pShader == pShader)
+				return &watch;
+		}
+		return nullptr;
+	}
+
+	void ShaderHotReloader::addDirectoryWatch(const std::string& directory) {
+#ifdef __linux__
+		// editors often save by renaming a temporary file, so the directory is watched instead of the file
+		int watchDescriptor = inotify_add_watch(m_inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+		if (watchDescriptor < 0) {
+			std::cerr << "ERROR: ShaderHotReloader failed to watch directory: " << directory << "\n";
+			return;
+		}
+		m_watchDescriptors[watchDescriptor] = directory;
+#endif
+	}
+
+	void ShaderHotReloader::watch() {
+		while (m_isRunning) {
+			buildPending();
+
+			std::vector<Watch> changed;
+#ifdef __linux__
+			pollfd pollFd = { m_inotifyFd, POLLIN, 0 };
+			if (poll(&pollFd, 1, 100) <= 0)
+				continue;
+
+			alignas(inotify_event) char eventBuffer[4096];
+			ssize_t length = read(m_inotifyFd, eventBuffer, sizeof(eventBuffer));
+			if (length <= 0)
+				continue;
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				const inotify_event* pEvent = nullptr;
+				for (char* ptr = eventBuffer; ptr < eventBuffer + length; ptr += sizeof(inotify_event) + pEvent->len) {
+					pEvent = (const inotify_event*)ptr;
+					if (pEvent->len == 0 || !m_watchDescriptors.count(pEvent->wd))
+						continue;
+					const std::string& directory = m_watchDescriptors.at(pEvent->wd);
+					for (auto& watch : m_watches) {
+						if (watch.directory != directory || watch.fileName != pEvent->name)
+							continue;
+						bool isDuplicate = false;
+						for (auto& other : changed)
+							isDuplicate |= other.pShader == watch.pShader;
+						if (!isDuplicate)
+							changed.push_back(watch);
+					}
+				}
+			}
+#else
+			std::this_thread::sleep_for(std::chrono::milliseconds(250));
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				for (auto& watch : m_watches) {
+					struct stat fileStat;
+					if (stat(watch.srcPath.c_str(), &fileStat) != 0 || fileStat.st_mtime == watch.lastWriteTime)
+						continue;
+					watch.lastWriteTime = fileStat.st_mtime;
+					changed.push_back(watch);
+				}
+			}
+#endif
+			for (auto& watch : changed)
+				reload(watch);
+		}
+	}
+
+	void ShaderHotReloader::reload(const Watch& watch) {
+		if (!Shader::compile(watch.srcPath, watch.pShader->getPath())) {
+			std::cerr << "ERROR: ShaderHotReloader failed to compile: " << watch.srcPath << ", keeping the old shader\n";
+			return;
+		}
+
+		// the pipelines are only read on the thread calling update(), which copies their state for the build
+		Reload reload;
+		reload.pShader = watch.pShader;
+		reload.module = VK_NULL_HANDLE;
+		reload.pipelines = watch.pipelines;
+		reload.rtPipelines = watch.rtPipelines;
+		try {
+			auto code = vkUtils::readFile(watch.pShader->getPath().c_str());
+
+			VkShaderModuleCreateInfo moduleCreateInfo{ VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
+			moduleCreateInfo.codeSize = code.size();
+			moduleCreateInfo.pCode = (uint32_t*)code.data();
+
+			VkResult result = vkCreateShaderModule(device, &moduleCreateInfo, nullptr, &reload.module);
+			VK_ASSERT(result);
+		}
+		catch (std::exception& e) {
+			std::cerr << "ERROR: ShaderHotReloader failed to load: " << watch.pShader->getPath() << " | " << e.what() << "\n";
+			if (reload.module != VK_NULL_HANDLE)
+				vkDestroyShaderModule(device, reload.module, nullptr);
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_pendingReloads.push_back(reload);
 	}
 
 	void acquireNextImage(VkSwapchainKHR swapchain, VkSemaphore semaphore, VkFence fence, uint32_t *pImageIndex)
@@ -2508,6 +6323,8 @@ namespace vk
 		{
 			vkQueueWaitIdle(queue);
 		}
+		if (vk::hasAsyncComputeQueue)
+			vkQueueWaitIdle(vk::asyncComputeQueue);
 	}
 }
 
@@ -2595,6 +6412,33 @@ void initVulkan(vk::initInfo& info)
 	vkCmdBuildAccelerationStructuresKHR_ = (PFN_vkCmdBuildAccelerationStructuresKHR)vkGetDeviceProcAddr(vk::device, "vkCmdBuildAccelerationStructuresKHR");
 	vkGetAccelerationStructureDeviceAddressKHR_ = (PFN_vkGetAccelerationStructureDeviceAddressKHR)vkGetDeviceProcAddr(vk::device, "vkGetAccelerationStructureDeviceAddressKHR");
 	vkDestroyAccelerationStructureKHR_ = (PFN_vkDestroyAccelerationStructureKHR)vkGetDeviceProcAddr(vk::device, "vkDestroyAccelerationStructureKHR");
+	vkCreateShadersEXT_ = (PFN_vkCreateShadersEXT)vkGetDeviceProcAddr(vk::device, "vkCreateShadersEXT");
+	vkDestroyShaderEXT_ = (PFN_vkDestroyShaderEXT)vkGetDeviceProcAddr(vk::device, "vkDestroyShaderEXT");
+	vkCmdBindShadersEXT_ = (PFN_vkCmdBindShadersEXT)vkGetDeviceProcAddr(vk::device, "vkCmdBindShadersEXT");
+	vkCmdSetPolygonModeEXT_ = (PFN_vkCmdSetPolygonModeEXT)vkGetDeviceProcAddr(vk::device, "vkCmdSetPolygonModeEXT");
+	vkCmdSetRasterizationSamplesEXT_ = (PFN_vkCmdSetRasterizationSamplesEXT)vkGetDeviceProcAddr(vk::device, "vkCmdSetRasterizationSamplesEXT");
+	vkCmdSetSampleMaskEXT_ = (PFN_vkCmdSetSampleMaskEXT)vkGetDeviceProcAddr(vk::device, "vkCmdSetSampleMaskEXT");
+	vkCmdSetAlphaToCoverageEnableEXT_ = (PFN_vkCmdSetAlphaToCoverageEnableEXT)vkGetDeviceProcAddr(vk::device, "vkCmdSetAlphaToCoverageEnableEXT");
+	vkCmdSetColorBlendEnableEXT_ = (PFN_vkCmdSetColorBlendEnableEXT)vkGetDeviceProcAddr(vk::device, "vkCmdSetColorBlendEnableEXT");
+	vkCmdSetColorBlendEquationEXT_ = (PFN_vkCmdSetColorBlendEquationEXT)vkGetDeviceProcAddr(vk::device, "vkCmdSetColorBlendEquationEXT");
+	vkCmdSetColorWriteMaskEXT_ = (PFN_vkCmdSetColorWriteMaskEXT)vkGetDeviceProcAddr(vk::device, "vkCmdSetColorWriteMaskEXT");
+	vkCmdSetVertexInputEXT_ = (PFN_vkCmdSetVertexInputEXT)vkGetDeviceProcAddr(vk::device, "vkCmdSetVertexInputEXT");
+	vkCmdSetDepthClampEnableEXT_ = (PFN_vkCmdSetDepthClampEnableEXT)vkGetDeviceProcAddr(vk::device, "vkCmdSetDepthClampEnableEXT");
+	vkCmdSetLogicOpEnableEXT_ = (PFN_vkCmdSetLogicOpEnableEXT)vkGetDeviceProcAddr(vk::device, "vkCmdSetLogicOpEnableEXT");
+	vkCmdSetPatchControlPointsEXT_ = (PFN_vkCmdSetPatchControlPointsEXT)vkGetDeviceProcAddr(vk::device, "vkCmdSetPatchControlPointsEXT");
+	vkCmdSetTessellationDomainOriginEXT_ = (PFN_vkCmdSetTessellationDomainOriginEXT)vkGetDeviceProcAddr(vk::device, "vkCmdSetTessellationDomainOriginEXT");
+	vkCmdPushDescriptorSetKHR_ = (PFN_vkCmdPushDescriptorSetKHR)vkGetDeviceProcAddr(vk::device, "vkCmdPushDescriptorSetKHR");
+	vkCmdPushDescriptorSetWithTemplateKHR_ = (PFN_vkCmdPushDescriptorSetWithTemplateKHR)vkGetDeviceProcAddr(vk::device, "vkCmdPushDescriptorSetWithTemplateKHR");
+	vkGetDescriptorSetLayoutSizeEXT_ = (PFN_vkGetDescriptorSetLayoutSizeEXT)vkGetDeviceProcAddr(vk::device, "vkGetDescriptorSetLayoutSizeEXT");
+	vkGetDescriptorSetLayoutBindingOffsetEXT_ = (PFN_vkGetDescriptorSetLayoutBindingOffsetEXT)vkGetDeviceProcAddr(vk::device, "vkGetDescriptorSetLayoutBindingOffsetEXT");
+	vkGetDescriptorEXT_ = (PFN_vkGetDescriptorEXT)vkGetDeviceProcAddr(vk::device, "vkGetDescriptorEXT");
+	vkCmdBindDescriptorBuffersEXT_ = (PFN_vkCmdBindDescriptorBuffersEXT)vkGetDeviceProcAddr(vk::device, "vkCmdBindDescriptorBuffersEXT");
+	vkCmdSetDescriptorBufferOffsetsEXT_ = (PFN_vkCmdSetDescriptorBufferOffsetsEXT)vkGetDeviceProcAddr(vk::device, "vkCmdSetDescriptorBufferOffsetsEXT");
+	vkCmdWriteAccelerationStructuresPropertiesKHR_ = (PFN_vkCmdWriteAccelerationStructuresPropertiesKHR)vkGetDeviceProcAddr(vk::device, "vkCmdWriteAccelerationStructuresPropertiesKHR");
+	vkCmdCopyAccelerationStructureKHR_ = (PFN_vkCmdCopyAccelerationStructureKHR)vkGetDeviceProcAddr(vk::device, "vkCmdCopyAccelerationStructureKHR");
+	vkCmdCopyAccelerationStructureToMemoryKHR_ = (PFN_vkCmdCopyAccelerationStructureToMemoryKHR)vkGetDeviceProcAddr(vk::device, "vkCmdCopyAccelerationStructureToMemoryKHR");
+	vkCmdCopyMemoryToAccelerationStructureKHR_ = (PFN_vkCmdCopyMemoryToAccelerationStructureKHR)vkGetDeviceProcAddr(vk::device, "vkCmdCopyMemoryToAccelerationStructureKHR");
+	vkGetDeviceAccelerationStructureCompatibilityKHR_ = (PFN_vkGetDeviceAccelerationStructureCompatibilityKHR)vkGetDeviceProcAddr(vk::device, "vkGetDeviceAccelerationStructureCompatibilityKHR");
 
 	// Get Properties
 	VkPhysicalDeviceProperties2 prop2{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
@@ -2605,6 +6449,10 @@ void initVulkan(vk::initInfo& info)
 	for (size_t i = 0; i < vk::queues.size(); i++)
 		vkGetDeviceQueue(vk::device, vk::queueFamily, i, &vk::queues[i]); // Get Queues from Device
 	vkUtils::queueHandler::init(vk::queues);
+	if (vk::hasAsyncComputeQueue)
+		vkGetDeviceQueue(vk::device, vk::queueFamily, vk::queues.size(), &vk::asyncComputeQueue);
+	else
+		vk::asyncComputeQueue = vk::queues[0];
 
 	// TODO Make compile automatic in shader class
 
@@ -2617,6 +6465,8 @@ void terminateVulkan()
 	{
 		vkQueueWaitIdle(queue);
 	}
+	if (vk::hasAsyncComputeQueue)
+		vkQueueWaitIdle(vk::asyncComputeQueue);
 
 	vkDestroyCommandPool(vk::device, vk::commandPool, nullptr);
 